@@ -0,0 +1,178 @@
+#!/usr/bin/python3
+#
+# Copyright 2019 International Business Machines
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Stand-in for Cronus putmemproc / getmemproc, to exercise the oc-flash / oc-reload
+# Cronus backends without a lab system.
+#
+# The card behind the Cronus bridge is a plain register file: config space with the
+# card IDs, and an AXI bridge (CFG_FLASH_ADDR / CFG_FLASH_DATA) that completes every
+# operation at once against a register array. HWICAP SR reads ICAPEn+EOS and CR reads
+# idle, so oc-reload runs to the end. It does not model the Quad SPI core or FLASH,
+# use 'oc-flash --backend emu' for that.
+#
+# Modes:
+#   Session (for --backend cronus_session:cmd=debug/cronus_standin.py):
+#     cronus_standin.py
+#     Reads commands on stdin, one per line, and answers on stdout:
+#       putmemproc -ci <addr> <hex>    no reply, "ERR put <text>" on failure
+#       getmemproc -ci <addr> <bytes>  one line: <hex> (memory byte order), or "ERR get <text>"
+#       sync <tag>                     "sync <tag>", once all earlier commands are done
+#       quit
+#   One process per command (for --backend cronus), called through links in $PATH:
+#     mkdir -p /tmp/cronus_bin
+#     ln -sf $PWD/debug/cronus_standin.py /tmp/cronus_bin/putmemproc
+#     ln -sf $PWD/debug/cronus_standin.py /tmp/cronus_bin/getmemproc
+#     PATH=/tmp/cronus_bin:$PATH ./oc-reload --backend cronus --devicebdf lab
+#     State is kept between processes as JSON in $CRONUS_STANDIN_STATE (default
+#     $XDG_RUNTIME_DIR/cronus_standin.state, or ~/.cronus_standin.state without it).
+
+import os
+import sys
+import json
+
+BRIDGE_ADDR = 0x60302016E0000     # Selects the config register
+BRIDGE_DATA = 0x60302016E0080     # Data of the selected config register
+
+CFG_DEVID      = 0x000
+CFG_SUBSYS     = 0x02C
+CFG_FLASH_ADDR = 0x630
+CFG_FLASH_DATA = 0x634
+
+FA_RD       = 0x00010000
+FA_WR       = 0x00020000
+FA_ICAP     = 0x00004000
+DEVSTAT_EOS = 0x01000000
+
+
+class Card:
+    def __init__(self):
+        self.cfg = bytearray(4096)
+        self.sel = 0
+        self.axi = {}
+        self.set32(CFG_DEVID, 0x062B1014)
+        self.set32(CFG_SUBSYS, 0x06661014)
+        self.set32(CFG_FLASH_ADDR, DEVSTAT_EOS)
+
+    def save(self, path):
+        state = {"cfg": self.cfg.hex(), "sel": self.sel,
+                 "axi": {"%x" % reg: val for reg, val in self.axi.items()}}
+        with os.fdopen(os.open(path, os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0o600), "w") as f:
+            json.dump(state, f)
+
+    @classmethod
+    def load(cls, path):
+        card = cls()
+        with open(path) as f:
+            state = json.load(f)
+        cfg = bytes.fromhex(state["cfg"])
+        if len(cfg) != len(card.cfg):
+            raise ValueError("config space of %d bytes" % len(cfg))
+        card.cfg[:] = cfg
+        card.sel = int(state["sel"])
+        card.axi = {int(reg, 16): int(val) for reg, val in state["axi"].items()}
+        return card
+
+    def get32(self, addr):
+        return int.from_bytes(self.cfg[addr:addr + 4], "little")
+
+    def set32(self, addr, val):
+        self.cfg[addr:addr + 4] = val.to_bytes(4, "little")
+
+    def axi_op(self):
+        fa = self.get32(CFG_FLASH_ADDR)
+        reg = fa & 0xFFFF
+        if fa & FA_WR:
+            self.axi[reg] = self.get32(CFG_FLASH_DATA)
+        elif fa & FA_RD:
+            if reg == FA_ICAP | 0x110:      # ICAP SR: ICAPEn, EOS
+                val = 0x5
+            elif reg == FA_ICAP | 0x10C:    # ICAP CR: operations complete at once
+                val = 0x0
+            else:
+                val = self.axi.get(reg, 0)
+            self.set32(CFG_FLASH_DATA, val)
+        self.set32(CFG_FLASH_ADDR, (fa & ~(FA_WR | FA_RD)) | DEVSTAT_EOS)
+
+    def put(self, addr, data):
+        if addr == BRIDGE_ADDR:
+            self.sel = int(data[5:8], 16)
+        elif addr == BRIDGE_DATA:
+            raw = bytes.fromhex(data)
+            self.cfg[self.sel:self.sel + len(raw)] = raw
+            if self.sel <= CFG_FLASH_ADDR < self.sel + len(raw):
+                self.axi_op()
+        else:
+            raise ValueError("address %x is not the config bridge" % addr)
+
+    def get(self, addr, nbytes):
+        if addr != BRIDGE_DATA:
+            raise ValueError("address %x is not the config bridge data" % addr)
+        return self.cfg[self.sel:self.sel + nbytes].hex()
+
+
+def session(card):
+    for line in sys.stdin:
+        words = line.split()
+        if not words:
+            continue
+        try:
+            if words[0] == "putmemproc":
+                card.put(int(words[-2], 16), words[-1])
+            elif words[0] == "getmemproc":
+                print(card.get(int(words[-2], 16), int(words[-1])))
+            elif words[0] == "sync":
+                print(line.strip())
+            elif words[0] == "quit":
+                break
+            else:
+                raise ValueError("unknown command " + words[0])
+        except (ValueError, IndexError) as e:
+            print("ERR %s %s" % ("get" if words[0] == "getmemproc" else "put", e))
+        if words[0] != "putmemproc":
+            sys.stdout.flush()
+
+
+def state_path():
+    if "CRONUS_STANDIN_STATE" in os.environ:
+        return os.environ["CRONUS_STANDIN_STATE"]
+    if os.environ.get("XDG_RUNTIME_DIR"):
+        return os.path.join(os.environ["XDG_RUNTIME_DIR"], "cronus_standin.state")
+    return os.path.join(os.path.expanduser("~"), ".cronus_standin.state")
+
+
+def one_command(cmd, argv):
+    state = state_path()
+    try:
+        card = Card.load(state)
+    except (OSError, ValueError, KeyError, TypeError, AttributeError):
+        card = Card()
+    if cmd == "putmemproc":
+        card.put(int(argv[-2], 16), argv[-1])
+        card.save(state)
+    else:
+        # Output as Cronus prints it: data starts at column 18 of the second line
+        print("getmemproc " + " ".join(argv))
+        print("%-18s%s" % ("p9n:k0:n0:s0:p00", card.get(int(argv[-2], 16), int(argv[-1]))))
+
+
+if __name__ == "__main__":
+    name = os.path.basename(sys.argv[0])
+    if name in ("putmemproc", "getmemproc"):
+        one_command(name, sys.argv[1:])
+    elif len(sys.argv) > 1 and sys.argv[1] in ("putmemproc", "getmemproc"):
+        one_command(sys.argv[1], sys.argv[2:])
+    else:
+        session(Card())
@@ -0,0 +1,77 @@
+#ifndef FLSH_CFG_BACKEND_H_
+#define FLSH_CFG_BACKEND_H_
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+// --------------------------------------------------------------------------------------------------------
+// Config space backends
+// - config_write() / config_read() reach the AFU config space through the backend selected at run time
+//   (--backend <name>[:<args>]). Each backend is a table of functions, so a new transport is added by
+//   writing one table and listing it in CFG_BACKENDS[] (src/flsh_cfg_backend.c).
+// - Functions return 0 on success and -1 on failure (errno set where it has a meaning). Reporting the
+//   error and bumping ERRORS_DETECTED is left to the config_* callers.
+// - 'args' is the optional text after ':' in the backend spec, a comma separated list of key=value pairs.
+// --------------------------------------------------------------------------------------------------------
+
+// Type of access in a batch entry
+#define CFG_OP_WR 0
+#define CFG_OP_RD 1
+
+typedef struct {
+  int   op;          // CFG_OP_WR or CFG_OP_RD
+  u32   addr;        // Configuration register address
+  u32   wdata;       // Write data (CFG_OP_WR)
+  int   num_bytes;   // Write: 1, 2 or 4 bytes. Read: 4 bytes, or 8 bytes to read addr and addr+4 together
+  u32  *rdata;       // Read data destination (CFG_OP_RD), 2 words when num_bytes is 8
+} cfg_batch_op;
+
+typedef struct {
+  const char *name;                                             // Name used with --backend
+  const char *help;                                             // One line description for usage text
+  int  (*open)  (char *cfgbdf, char *args);                     // Attach to the card (cfgbdf is the PCI domain:bus:dev.fn)
+  int  (*read32)(u32 addr, u32 *rdata, char *s);                // Read 4 bytes
+  int  (*write) (u32 addr, u32 wdata, int num_bytes, char *s);  // Write 1, 2 or 4 bytes
+  int  (*batch) (cfg_batch_op *ops, int num_ops, char *s);      // Perform accesses in order, NULL if not supported
+  void (*close) (void);                                         // Detach, print any backend statistics
+  int    chains;                                                // 1 if a batch costs a single round trip, so AXI writes are worth queueing
+} cfg_backend;
+
+// Backend in use, selected by cfg_backend_select()
+extern cfg_backend *CFG_BACKEND;
+
+int  cfg_backend_select(char *spec);                  // Pick backend from "<name>[:<args>]", returns -1 if unknown
+int  cfg_backend_open(char *cfgbdf);                  // Open selected backend (default one if none selected)
+void cfg_backend_close(void);
+void cfg_backend_usage(FILE *f);                      // List available backends
+
+// Helpers for backends parsing their 'args' string
+int  cfg_backend_arg(char *args, const char *key, char *val, int val_len);   // Returns 1 and copies value if key is present
+long cfg_backend_arg_num(char *args, const char *key, long dflt);            // Number with optional K/M/G suffix
+
+// Available backends
+extern cfg_backend CFG_BACKEND_SYSFS;
+extern cfg_backend CFG_BACKEND_URING;
+extern cfg_backend CFG_BACKEND_CRONUS;
+extern cfg_backend CFG_BACKEND_CRONUS_SESSION;
+extern cfg_backend CFG_BACKEND_EMU;
+#ifdef USE_SIM_TO_TEST
+extern cfg_backend CFG_BACKEND_SIM;
+#endif
+
+#endif
@@ -39,17 +39,10 @@ typedef unsigned char byte;
 // For function(s): config_write(), config_read()
 // - Addresses in the OpenCAPI Configuration register space for the regs that create the AXI4-Lite master interface
 // - Found in Function 0, Vendor DVSEC
-#ifdef USE_CRONUS_ACCESS
-  #define CFG_DEVID      ((const unsigned char *)"000")
-  #define CFG_FLASH_ADDR ((const unsigned char *)"630")
-  #define CFG_FLASH_DATA ((const unsigned char *)"634")
-#endif
-#ifndef USE_CRONUS_ACCESS
-  #define CFG_DEVID      0x000
-  #define CFG_FLASH_ADDR 0x630
-  #define CFG_FLASH_DATA 0x634 
-#endif
- #define CFG_SUBSYS 0x02C
+#define CFG_DEVID      0x000
+#define CFG_FLASH_ADDR 0x630
+#define CFG_FLASH_DATA 0x634
+#define CFG_SUBSYS     0x02C
 // For function(s): form_FLASH_ADDR()
 // - Values for fields that combine to form the contents of CFG_FLASH_ADDR
 // - Values are already aligned to make combining them easy. Do not change the values unless the hardware implementation changes.
@@ -147,8 +140,80 @@ typedef unsigned char byte;
 #define FO_DIR_WR   2
 
 // Global variables for 'flash_op', enable or disable extra QSPI checks (use with FLASH_OP_CHECK)
-#define FO_CHK_OFF 0
-#define FO_CHK_ON  1
+// - FO_CHK_SAMPLED: one op in FLASH_OP_CHECK_EVERY on average is checked, switching to FO_CHK_ON after the first anomaly
+#define FO_CHK_OFF     0
+#define FO_CHK_ON      1
+#define FO_CHK_SAMPLED 2
+
+// Global variables for 'flash_op', how data moves through the QSPI FIFOs (use with FLASH_OP_ENGINE)
+// - FOE_LOCKSTEP: fill the DTR FIFO, wait for it to drain, read the DRR FIFO, repeat
+// - FOE_STREAM  : top up the DTR and read the DRR by their occupancy while the SPI master runs
+#define FOE_LOCKSTEP 0
+#define FOE_STREAM   1
+
+// Global variables for waiting on the QSPI DTR Empty interrupt and ICAP EOS (use with DEVSTAT_WAIT)
+// - DSW_ON : completion is taken from the device status bits in CFG_FLASH_ADDR[27:24], seen by the polls of every AXI operation
+// - DSW_OFF: completion is polled with AXI reads of QSPI IPISR and ICAP SR
+#define DSW_OFF 0
+#define DSW_ON  1
+
+// Global variables for the QSPI / ICAP control register shadow in axi_write (use with AXI_SHADOW_REGS)
+#define SHD_OFF 0
+#define SHD_ON  1
+
+// Global variables for FLASH command sequences between flash_session_begin() and flash_session_end() (use with FLASH_SESSIONS)
+// - FSS_ON : the device stays selected in SPISSR and the FIFOs are reset once per command, chip select follows the master inhibit
+// - FSS_OFF: every flash_op selects the device, resets the FIFOs, and deselects all devices again
+#define FSS_OFF 0
+#define FSS_ON  1
+
+// Global variables for the erase, program and read commands of the facility functions (use with FLASH_4B_OPCODES)
+// - F4B_OFF: 0x20, 0xD8, 0x03, 0x02 with a 4 byte address, relying on the FLASH being in 4 byte address mode
+// - F4B_ON : their 4-byte opcode variants 0x21, 0xDC, 0x13, 0x12, that take a 4 byte address in either mode
+#define F4B_OFF 0
+#define F4B_ON  1
+
+// Global variables for the end of program / erase wait in fr_wait_for_WRITE_IN_PROGRESS_to_clear (use with FLASH_WIP_WAIT)
+// - WIPW_SR : poll READ STATUS REGISTER, [0] Write In Progress
+// - WIPW_FSR: poll READ FLAG STATUS REGISTER, [7] Program or erase controller ready, and check its error bits when ready
+#define WIPW_SR  0
+#define WIPW_FSR 1
+
+// Global variables for the FLASH busy time model (use with FLASH_BUSY_MODEL)
+// - BSY_ON : fr_wait_for_WRITE_IN_PROGRESS_to_clear sleeps through most of the expected program / erase time before polling
+// - BSY_OFF: polling starts right after the command
+#define BSY_OFF 0
+#define BSY_ON  1
+
+// Global variables for quad data lanes (use with FLASH_QUAD), see flash_quad_identify()
+// - FQ_OFF : read and program with the single lane commands
+// - FQ_AUTO: use QUAD OUTPUT FAST READ when the FLASH allows it and a probe read shows the Quad SPI core is built in
+//            quad mode, program on one lane
+// - FQ_ON  : take the core's quad mode for granted (a blank FLASH can't tell), also program with QUAD INPUT FAST PROGRAM
+#define FQ_OFF  0
+#define FQ_AUTO 1
+#define FQ_ON   2
+
+// Global variables for differential flashing in update_image (use with FLASH_DIFF)
+// - FDF_OFF: erase every sector of the image, program and read back every page
+// - FDF_ON : read each sector first, leave alone the ones that match, program without an erase the ones that only clear bits
+#define FDF_OFF 0
+#define FDF_ON  1
+
+// Global variables for programming both FLASH of SPIx8 mode (use with FLASH_INTERLEAVE)
+// - FIL_OFF: update DEV1 to completion, then DEV2
+// - FIL_ON : send the erases and page programs of one FLASH while the other one is busy with its own
+#define FIL_OFF 0
+#define FIL_ON  1
+
+// FLASH operations timed by the busy model, see flash_busy_issued()
+#define BUSY_NONE    -1
+#define BUSY_PP       0             // PAGE PROGRAM
+#define BUSY_SSE      1             // 4KB SUBSECTOR ERASE
+#define BUSY_SE32     2             // 32KB SUBSECTOR ERASE
+#define BUSY_SE       3             // 64KB SECTOR ERASE
+#define BUSY_DIE      4             // DIE ERASE
+#define BUSY_NUM_OPS  5
 
 
 
@@ -30,6 +30,17 @@ u32  config_read(                     // Host issues 'config_read' instruction o
                   u32 addr            //   Always reads 4 bytes
                 , char *s);           //   String to add to trace print message, identifying more about this instance of invocation. Set to NULL if unused.
 
+void config_batch(                    // Perform a list of config reads and writes in order, as one backend call when the backend supports it
+                   cfg_batch_op *ops  //   Accesses to perform (cfg_batch_op is in flsh_cfg_backend.h). Read data is returned through 'rdata'.
+                 , int num_ops        //   Number of entries in 'ops'
+                 , char *s);          //   String to add to trace print message, identifying more about this instance of invocation. Set to NULL if unused.
+
+void config_read_pair(                // Read two adjacent config registers (addr and addr+4), as a single 8 byte access when the transport allows it
+                       u32 addr       //   Configuration register address of the first register
+                     , u32 *rdata_lo  //   Returns contents of register at addr
+                     , u32 *rdata_hi  //   Returns contents of register at addr+4
+                     , char *s);      //   String to add to trace print message, identifying more about this instance of invocation. Set to NULL if unused.
+
 u32  form_FLASH_ADDR(                 // Assemble fields into value to load into CFG_FLASH_ADDR register
                       u32 devsel      //   Select Quad SPI or HWICAP core as AXI target 
                     , u32 addr        //   Select target register within the selected core
@@ -75,6 +86,57 @@ void  axi_write(                     // Initiate a write operation on the AXI4-L
                , char *s             //   Comment to be printed in trace message
                );
 
+void  axi_write_check(              // Check response and device status of a completed AXI write (FLASH_ADDR read back after the Write Strobe dropped)
+                 u32 read_FA         //   FLASH_ADDR contents
+               , u32 axi_devsel      //   AXI4-Lite slave that was the target of the write
+               , u32 axi_addr        //   Target register within the selected core
+               , u32 exp_enab        //   Byte expander enable and direction of the write, for error messages
+               , u32 exp_dir
+               , u32 axi_wdata       //   Data written, for error messages
+               , char *s             //   Comment of the axi_write, for error messages
+               );
+
+void  axi_write_chain(              // Fill in the 3 config accesses of one AXI write: FLASH_DATA write, FLASH_ADDR write, FLASH_ADDR read back
+                 cfg_batch_op *chain //   3 entries
+               , u32 axi_devsel      //   Select AXI4-Lite slave that is target of operation
+               , u32 axi_addr        //   Select target register within the selected core
+               , u32 exp_enab        //   Choose whether to use data expander
+               , u32 exp_dir         //   Determine expander direction
+               , u32 axi_wdata       //   Data written to AXI4-Lite slave
+               , u32 *read_FA        //   Receives FLASH_ADDR read back after the write was started
+               );
+
+void  axi_write_post(               // Start an AXI write without waiting for it, completion is checked by the next axi_fence()
+                 u32 axi_devsel      //   Select AXI4-Lite slave that is target of operation
+               , u32 axi_addr        //   Select target register within the selected core
+               , u32 exp_enab        //   Choose whether to use data expander
+               , u32 exp_dir         //   Determine expander direction
+               , u32 axi_wdata       //   Data written to AXI4-Lite slave
+               , char *s             //   Comment to be printed in trace message
+               );
+
+int   axi_fence(                     // Complete all posted AXI writes and check them, naming the write that failed. Returns the number of errors found.
+                 char *s);           //   Comment to be printed in trace and error messages
+
+int   axi_wait_devstat(              // Wait for device status bits in CFG_FLASH_ADDR, using the status of the last AXI operation first.
+                 u32 bits            //   DEVSTAT_* bits that must all be 1
+               , poll_site *site     //   Spin, backoff and deadline of the wait (see flsh_poll.h)
+               , char *s);           //   Comment to be printed in trace message
+                                     // Returns the number of FLASH_ADDR polls it took (0 = already seen), -1 on timeout
+
+int   axi_devstat_in_use(u32 bits);  // 1 if QSPI_setup() enabled the device status bits as completion signals (DEVSTAT_WAIT)
+
+u32   axi_poll(                      // Read an AXI register until (rdata & mask) == value. Returns the last read data, an error is counted on timeout.
+                 u32 axi_devsel      //   Select AXI4-Lite slave that is target of operation
+               , u32 axi_addr        //   Select target register within the selected core
+               , u32 mask            //   Bits compared
+               , u32 value           //   Value they must have
+               , poll_site *site     //   Spin, backoff and deadline of the wait
+               , char *s);           //   Comment to be printed in trace and error messages
+
+void  axi_shadow_invalidate(         // Forget the shadowed control registers of a core, the next write to each goes to the core
+                 u32 axi_devsel);    //   FA_QSPI or FA_ICAP
+
 u32  axi_read(                      // Initiate a read operation on the AXI4-Lite bus. Read data is returned.
                 u32 axi_devsel      //   Select AXI4-Lite slave that is target of operation
               , u32 axi_addr        //   Select target register within the selected core
@@ -118,6 +180,49 @@ void fo_read_DRR(                     // Obtain shifted out data. Check that RX
                 , int   dir           // Skip some steps based on the direction of the FLASH operation (FO_DIR_XCHG, FO_DIR_RD, FO_DIR_WR)
                 );
 
+// FLASH command template
+// - The header (cmd, address and dummy bytes) layout and the number of shifted out bytes to skip are worked out when the
+//   template is built, flash_cmd() only fills in the address and the data. FO_TEMPLATE is a constant initializer.
+// - skip_bytes assumes dummy cycles only occur on bulk data movement which will use Quad mode on the SPI bus: every dummy
+//   cycle captures 4 bits from the FLASH, so 2 cycles equal a byte, and num_dummy is even (true of all Micron commands).
+typedef struct {
+  byte  cmd;                        // Command to send to FLASH
+  int   num_addr;                   // Number of address bytes (0-4)
+  int   num_dummy;                  // Number of dummy cycles (0 to 10 for Micron FLASH parts)
+  int   dir;                        // FO_DIR_XCHG, FO_DIR_RD, FO_DIR_WR
+  char *name;                       // Comment to be printed in trace string
+  byte  header[16];                 // cmd, then zeros for the address and dummy bytes
+  int   header_bytes;               // 1 + num_addr + num_dummy
+  int   skip_bytes;                 // Shifted out bytes of the cmd, addr and dummy cycles, not returned in rdata
+} fo_template;
+
+#define FO_TEMPLATE(c, na, nd, d, n) \
+  { .cmd = c, .num_addr = na, .num_dummy = nd, .dir = d, .name = n, .header = { c }, .header_bytes = 1 + (na) + (nd), .skip_bytes = 1 + (na) + (nd) / 2 }
+
+// Commands whose dummy cycles are clocked in extended SPI mode, like FAST READ: 8 cycles per dummy byte in the DTR, and
+// every one of those bytes is shifted out before the data
+#define FO_TEMPLATE_X1(c, na, nd, d, n) \
+  { .cmd = c, .num_addr = na, .num_dummy = nd, .dir = d, .name = n, .header = { c }, .header_bytes = 1 + (na) + (nd) / 8, .skip_bytes = 1 + (na) + (nd) / 8 }
+
+// Commands whose dummy cycles and data move on 4 lanes when the Quad SPI core is built in quad mode, like QUAD OUTPUT
+// FAST READ: 2 cycles per dummy byte in the DTR, and every one of those bytes is shifted out before the data
+#define FO_TEMPLATE_X4(c, na, nd, d, n) \
+  { .cmd = c, .num_addr = na, .num_dummy = nd, .dir = d, .name = n, .header = { c }, .header_bytes = 1 + (na) + (nd) / 2, .skip_bytes = 1 + (na) + (nd) / 2 }
+
+extern fo_template FOT_RESET_ENABLE, FOT_RESET_MEMORY, FOT_ENTER_4B_ADDR_MODE, FOT_WRITE_ENABLE;
+extern fo_template FOT_READ_EVCR, FOT_WRITE_EVCR, FOT_READ_EAR, FOT_WRITE_EAR, FOT_READ_SR, FOT_WRITE_SR, FOT_READ_FSR, FOT_CLEAR_FSR;
+extern fo_template FOT_READ_NVCR, FOT_WRITE_NVCR, FOT_READ_VCR, FOT_WRITE_VCR, FOT_READ_ID, FOT_READ_SFDP;
+// Reads, programs and erases depend on the part, their templates are built per FLASH from its capabilities (flash_caps_of)
+
+void flash_cmd(                     // Replay a command template (see flash_op for the transfer)
+                u32  devsel         // Select FLASH device to target (use SPISSR_SEL_DEV1 or SPISSR_SEL_DEV2)
+              , fo_template *t      // Command, address and dummy bytes, direction
+              , u32  addr           // Address, if the command has one (t->num_addr bytes of it are sent)
+              , int  num_bytes      // Number of data bytes, 0-N
+              , byte *wdata         // Reference to array of bytes to write to FLASH, NULL to send zeros (note: wdata and rdata arrays should be the same size)
+              , byte *rdata         // Reference to array of bytes to place data read from FLASH
+              );
+
 void flash_op(                      // The SPI interface shifts data in while simultaneously shifting data out, thus "read" is the same as a "write".
                u32  devsel          // Select FLASH device to target (use SPISSR_SEL_DEV1 or SPISSR_SEL_DEV2) 
              , byte cmd             // Command to sent to FLASH
@@ -131,9 +236,38 @@ void flash_op(                      // The SPI interface shifts data in while si
              , char *s              // Comment to be printed in trace string
              );
 
+void flash_session_begin(u32 devsel);   // Keep 'devsel' selected for the flash_op's that follow (see FLASH_SESSIONS)
+void flash_session_end(void);           // Deselect the FLASH of the open session
+
 void flash_setup(u32 devsel);       // Setup selected FLASH for 9V3 board usage (pass in SPISSR_SEL_DEV1 or SPISSR_SEL_DEV2)
  
+void flash_caps_identify(u32 devsel);           // READ ID and SFDP of the FLASH, pick its opcodes and sizes (called by flash_setup)
+flash_caps *flash_caps_of(u32 devsel);          // What is known of the FLASH part (Micron MT25Q defaults until identified)
+
+typedef struct {                    // One erase of a plan made by flash_erase_plan()
+  u32   addr;
+  u32   size;                       // 4KB, 32KB, 64KB, or the die / chip size of flash_caps
+  long  typ_us;                     // Typical time, 0 if not known
+} flash_erase_step;
+
+#define FLASH_ERASE_PLAN_MAX(len)  ((len) / 0x1000 + 2)   // Steps a range of 'len' bytes can need at most
+
+int  flash_erase_plan(u32 devsel, u32 addr, u32 len, flash_erase_step *steps, int max_steps);   // Cheapest erases covering the range, returns their number (-1 on error)
+u32  flash_erase_unit(u32 devsel);   // Smallest erase of the FLASH: plans are rounded out to it, 0 if it has none
+void flash_erase_plan_print(u32 devsel, flash_erase_step *steps, int num_steps);   // Counts per erase size and estimated time
+void flash_erase_issue(u32 devsel, flash_erase_step *s);     // Send the erase of one step (WRITE ENABLE first, wait after)
+
+void flash_busy_identify(u32 devsel);           // Pick the busy times of the FLASH part from its READ ID, else its SFDP (called by flash_setup)
+void flash_busy_issued(u32 devsel, int op);     // A program / erase (BUSY_PP, ...) was sent to the FLASH, start its clock
+void flash_busy_stats(FILE *f);                 // Print the busy times measured per FLASH and operation
+long flash_busy_left_us(u32 devsel);            // Expected time until the program / erase in progress on the FLASH completes, 0 if none
+void flash_busy_sleep_expected(u32 devsel);     // Sleep through that time (with FLASH_BUSY_MODEL)
+
+void flash_quad_identify(u32 devsel);           // Decide whether reads and programs use 4 data lanes (called by flash_setup)
+const char *flash_quad_lanes(u32 devsel);       // "x4", or "x1" and the reason, for printing
+
 void fr_wait_for_WRITE_IN_PROGRESS_to_clear(u32 devsel);  // Wait for 'WRITE IN PROGRESS' status bit to return to not busy state
+int  fr_WRITE_IN_PROGRESS_cleared(u32 devsel);            // Poll it once: 1 if the program / erase completed (or timed out), 0 if still busy
 
 void read_flash_regs(u32 devsel);   // Read all registers in the targeted FLASH (pass in SPISSR_SEL_DEV1 or SPISSR_SEL_DEV2)
 
@@ -180,11 +314,15 @@ void fw_Nonvolatile_Configuration_Register(u32 devsel, u32 wdata);
 byte fr_Volatile_Configuration_Register(u32 devsel);
 void fw_Volatile_Configuration_Register(u32 devsel, byte wdata);
 void fr_Device_ID_Register(u32 devsel, byte *rdata);    // 20 bytes of read data stored in buffer whose address is passed in
+void fr_SFDP(u32 devsel, u32 addr, int num_bytes, byte *rary);   // READ SFDP, always a 3 byte address
 
 // These commands use a 3 byte address. The value in the EXTENDED ADDRESS REGISTER is used to provide the upper bit of address.
 void fw_4KB_Subsector_Erase(u32 devsel, u32 addr); 
+void fw_32KB_Subsector_Erase(u32 devsel, u32 addr);
 void fw_64KB_Sector_Erase(u32 devsel, u32 addr);
+void fw_Die_Erase(u32 devsel, u32 addr);                                 // DIE ERASE of the die holding 'addr', or CHIP ERASE
 void fr_Read(u32 devsel, u32 addr, int num_bytes, byte *rary);           
+void fr_Fast_Read(u32 devsel, u32 addr, int num_bytes, byte *rary);     // Any length, in one FAST READ (8 dummy cycles), on 4 lanes if it can
 void fw_Page_Program(u32 devsel, u32 addr, int num_bytes, byte *wary);  
 
 
@@ -200,5 +338,6 @@ void read_FPGA_IDCODE();
 u32 read_ICAP_wfifo_size();
 void write_ICAP_bitstream_word(u32 wdata);
 u32 wait_ICAP_write_done();
+void wait_ICAP_EOS(char *s);   // Wait for ICAP SR = h5 (done, EOS) once CR shows the write finished
 
 #endif
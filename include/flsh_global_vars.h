@@ -32,10 +32,43 @@ extern int ERRORS_DETECTED;
 
 // When enabled, flash_op does extra checking on the Quad SPI core. However this may impact performance.
 extern int FLASH_OP_CHECK;
+extern int FLASH_OP_CHECK_EVERY;
+
+// How flash_op moves data through the QSPI FIFOs, lockstep fill / drain cycles or streaming
+extern int FLASH_OP_ENGINE;
+
+// When enabled, the DTR FIFO and ICAP waits use the device status in CFG_FLASH_ADDR instead of AXI reads of IPISR and SR
+extern int DEVSTAT_WAIT;
+
+// When enabled, axi_write skips writes that leave a shadowed QSPI / ICAP control register unchanged
+extern int AXI_SHADOW_REGS;
+
+// When enabled, flash_session_begin() keeps the FLASH selected across the commands of a sequence
+extern int FLASH_SESSIONS;
+
+// When enabled, the facility functions erase, program and read with the 4-byte opcodes of the FLASH
+extern int FLASH_4B_OPCODES;
+
+// Which status register fr_wait_for_WRITE_IN_PROGRESS_to_clear polls, and how many samples of it one poll clocks out
+extern int FLASH_WIP_WAIT;
+extern int FLASH_WIP_SAMPLES;
+
+// When enabled, waits for the end of a program / erase sleep through the time it is known to take
+extern int FLASH_BUSY_MODEL;
+extern int FLASH_QUAD;
+extern int FLASH_DIFF;
+extern int FLASH_INTERLEAVE;
 
 // Accumulate the number of FLASH ops performed since the test started
 extern int FLASH_OP_COUNT;    
 
+// Accumulate the number of config space accesses (one syscall each on real hardware) since the test started
+extern long CONFIG_OP_COUNT;
+
+// Accumulate the number of AXI operations issued, and of axi_write's skipped by the register shadow, since the test started
+extern long AXI_OP_COUNT;
+extern long AXI_WRITES_SKIPPED;
+
 // Reusable array of bytes to hold lower 3 bytes of address, use for invoking FLASH operation
 extern byte FLASH_ADDR[];
 
@@ -44,7 +77,7 @@ extern byte FLASH_ADDR[];
 extern byte FLASH_UPPER_ADDR_DEV1;
 extern byte FLASH_UPPER_ADDR_DEV2;
 
-// Set to size of DTR / DRR FIFOs used in IP wizard when generating Quad SPI core (16 or 256 bytes)
-extern const int FIFO_DEPTH;
+// Size of DTR / DRR FIFOs used in IP wizard when generating Quad SPI core (16 or 256 bytes), probed by QSPI_setup()
+extern int FIFO_DEPTH;
 
 #endif
@@ -0,0 +1,80 @@
+#ifndef FLSH_POLL_H_
+#define FLSH_POLL_H_
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+// --------------------------------------------------------------------------------------------------------
+// Poll engine
+// - Every busy wait of the tools (AXI strobes, DTR FIFO drain, FLASH Write In Progress, ICAP, ZynqMP mailbox) is a
+//   'poll site'. A wait has a deadline on the monotonic clock, polls back to back 'spin' times, then sleeps between
+//   polls with clock_nanosleep(), doubling the sleep from 'sleep_min' up to 'sleep_max'.
+// - Each site counts its waits and keeps histograms of polls per wait and of wait latency (printed with --poll_stats),
+//   so the spin / sleep / timeout of a site can be tuned with --poll <site>:<key>=<value>,...
+// - Usage:
+//     poll_wait w;
+//     poll_start(&w, &POLL_FLASH_WIP);
+//     while (<not done>) {
+//       if (poll_again(&w) != 0) { <timeout error>; break; }
+//       <poll>
+//     }
+//     poll_end(&w);
+// --------------------------------------------------------------------------------------------------------
+
+#define POLL_HIST_BUCKETS 24        // Bucket b counts values 2^(b-1) .. 2^b - 1 (bucket 0: value 0), the last one is open ended
+
+typedef struct {
+  const char *name;                 // Site name, for --poll and --poll_stats
+  const char *help;
+  long  timeout_us;                 // Deadline, counted from poll_start() (0 = none)
+  int   spin;                       // Polls made back to back before the first sleep
+  long  sleep_min_ns;               // First sleep, doubled on each further poll ...
+  long  sleep_max_ns;               //   ... up to this
+  unsigned long long waits, timeouts, polls, max_polls;
+  unsigned long long total_ns, max_ns;
+  unsigned long long hist_polls[POLL_HIST_BUCKETS];   // Waits by number of polls after the first check
+  unsigned long long hist_us[POLL_HIST_BUCKETS];      // Waits by latency in microseconds
+} poll_site;
+
+typedef struct {
+  poll_site *site;
+  unsigned long long start_ns, deadline_ns;
+  long  sleep_ns;                   // Next sleep
+  int   polls;                      // poll_again() calls so far
+  int   timed_out;
+} poll_wait;
+
+extern poll_site POLL_AXI_STROBE;   // Write / Read Strobe of an AXI operation in CFG_FLASH_ADDR
+extern poll_site POLL_DTR_EMPTY;    // QSPI DTR FIFO drained to the FLASH
+extern poll_site POLL_SPI_STREAM;   // Room in the QSPI FIFOs while streaming (flash_op with FOE_STREAM)
+extern poll_site POLL_FLASH_WIP;    // FLASH STATUS[0] Write In Progress clear after program / erase
+extern poll_site POLL_ICAP_CR;      // ICAP CR write command done (write FIFO flushed)
+extern poll_site POLL_ICAP_EOS;     // ICAP SR = h5 (done, EOS)
+extern poll_site POLL_ZYNQ_ACK;     // 250SOC ZynqMP firmware took the mailbox page
+
+void poll_start(poll_wait *w, poll_site *site);   // Begin a wait, before the first check of the condition
+int  poll_again(poll_wait *w);                    // The check found the condition false: back off. Returns 0 to poll again, -1 when the deadline passed.
+void poll_end(poll_wait *w);                      // The check found the condition true (or the caller gave up): record the wait
+long poll_elapsed_us(poll_wait *w);               // Time since poll_start()
+void poll_set_timeout(poll_wait *w, long timeout_us);   // Move the deadline of a wait, counted from poll_start() (0 = none)
+unsigned long long poll_now_ns(void);             // Monotonic clock the waits are timed with
+void poll_sleep_ns(long ns);                      // Sleep, with the timer slack the poll sleeps use
+int  poll_config(char *arg);                      // Apply "<site>:<key>=<value>,..." (keys spin, sleep_min, sleep_max in us, timeout in ms). Returns 0 if OK.
+void poll_stats(FILE *f);                         // Print counts and histograms of the sites that waited
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef FLSH_SFDP_H_
+#define FLSH_SFDP_H_
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+#include "flsh_common_defs.h"
+
+// --------------------------------------------------------------------------------------------------------
+// FLASH capabilities
+// - What the tools need to know about a FLASH part: size, page size, erase types and their times, the opcodes of the fast
+//   and quad reads with their dummy cycles, and the 4-byte address opcodes. flash_setup() fills one per device from the
+//   JEDEC SFDP tables (JESD216, READ SFDP 0x5A) and READ ID, see flash_caps_of().
+// - sfdp_parse() only decodes bytes already read from the FLASH. A part without SFDP (or with a table that doesn't parse)
+//   keeps sfdp_defaults(), the Micron MT25Q the tools were written for.
+// --------------------------------------------------------------------------------------------------------
+
+#define SFDP_READ_BYTES   512       // Bytes of the SFDP space read by flash_setup, tables beyond them are ignored
+#define SFDP_MAX_ERASE    4         // Erase types of the Basic Flash Parameter Table
+
+typedef struct {
+  u32   size;                       // Bytes, a power of 2
+  byte  cmd;                        // Opcode taking the address in the current address mode
+  byte  cmd_4b;                     // 4-byte address opcode, 0 if none
+  long  typ_us, max_us;             // 0 if not known
+} flash_erase_type;
+
+typedef struct {
+  const char *source;               // "SFDP" or "defaults"
+  byte  id[3];                      // READ ID: manufacturer, memory type, capacity
+  int   sfdp_rev;                   // BFPT revision (major << 8 | minor), 0 without SFDP
+  u32   size;                       // Bytes
+  int   page_size;                  // Bytes of one PAGE PROGRAM
+  int   num_erase;                  // Entries in 'erase', smallest first
+  flash_erase_type erase[SFDP_MAX_ERASE];
+  long  pp_typ_us, pp_max_us;       // PAGE PROGRAM times, 0 if not known
+  long  die_typ_us, die_max_us;     // Chip / die erase times, 0 if not known
+  byte  die_cmd;                    // CHIP ERASE (0xC7), or DIE ERASE (0xC4) of the die holding the address
+  u32   die_size;                   //   Bytes it erases, 0 if not known (no chip / die erase is used then)
+  byte  read_cmd, read_cmd_4b;      // READ (0x03 / 0x13)
+  byte  fast_read_cmd, fast_read_cmd_4b;     // FAST READ 1-1-1, 8 dummy cycles (0x0B / 0x0C)
+  byte  quad_read_cmd, quad_read_cmd_4b;     // QUAD OUTPUT FAST READ 1-1-4 (0x6B / 0x6C), 0 if not supported
+  int   quad_read_dummy;                     //   Dummy cycles, mode clocks included
+  byte  program_cmd, program_cmd_4b;         // PAGE PROGRAM (0x02 / 0x12)
+  byte  quad_program_cmd, quad_program_cmd_4b;   // QUAD INPUT FAST PROGRAM 1-1-4 (0x32 / 0x34), 0 if not supported
+} flash_caps;
+
+void sfdp_defaults(flash_caps *c);                        // Micron MT25Q, used when the part has no SFDP
+int  sfdp_parse(flash_caps *c, byte *sfdp, int len);      // Decode the SFDP space read from offset 0. Returns 0 if OK, -1 (c unchanged) if not SFDP.
+flash_erase_type *sfdp_erase_type(flash_caps *c, u32 size);   // Erase type of 'size' bytes, NULL if the part has none
+void sfdp_print(FILE *f, flash_caps *c);                  // One paragraph per part, for --verbose
+
+#endif
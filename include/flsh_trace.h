@@ -0,0 +1,60 @@
+#ifndef FLSH_TRACE_H_
+#define FLSH_TRACE_H_
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+// --------------------------------------------------------------------------------------------------------
+// Trace ring
+// - config, AXI and FLASH operations record a fixed size binary event into a ring buffer holding the last
+//   N events. Nothing is formatted when an event is recorded, text is produced only when the ring is
+//   dumped, or at once for the layers whose TRC_* flag is on (same text as the ring dump).
+// - trace_record() records an event. The comment string of an event is kept as a pointer, so it must be a string literal.
+// - The ring can be saved to a file and decoded later (oc-flash --trace_decode <file>).
+// --------------------------------------------------------------------------------------------------------
+
+// Event types
+#define TRC_EV_CONFIG_WR     1   // addr, data = wdata, aux = num_bytes
+#define TRC_EV_CONFIG_RD     2   // addr, data = rdata
+#define TRC_EV_CONFIG_RD2    3   // addr, data = rdata at addr, aux = rdata at addr+4
+#define TRC_EV_AXI_WR        4   // devsel, addr, data = wdata, aux = exp_enab | exp_dir
+#define TRC_EV_AXI_RD        5   // devsel, addr, aux = exp_enab | exp_dir
+#define TRC_EV_AXI_RD_DONE   6   // data = rdata
+#define TRC_EV_FLASH_OP      7   // devsel, addr, data = cmd | num_addr << 8 | num_dummy << 16 | dir << 24, aux = num_bytes
+
+typedef struct {
+  unsigned long long ts;    // Nanoseconds since trace_init()
+  u32  type;                // TRC_EV_*
+  u32  devsel;
+  u32  addr;
+  u32  data;
+  u32  aux;
+  const char *s;            // Comment, a string literal
+} trace_event;
+
+#define TRACE_EVENTS_DEFAULT 4096   // Ring size unless --trace_events is given
+#define TRACE_EVENTS_ON_FAIL 64     // Events printed by Check_Accumulated_Errors() when the run failed
+
+void trace_init(int num_events);              // Allocate a ring of num_events (0 = ring off, TRC_* printing still works)
+void trace_record(u32 type, u32 devsel, u32 addr, u32 data, u32 aux, const char *s);   // Record an event
+void trace_set_file(char *path);              // Save ring to 'path' with trace_save()
+void trace_dump(FILE *f, int last_n);         // Print the last 'last_n' events
+int  trace_save(void);                        // Save ring to the file set with trace_set_file(), if any
+int  trace_decode(char *path);                // Print a saved ring
+
+#endif
@@ -0,0 +1,476 @@
+#ifndef FLSH_CFG_BACKEND_C_
+#define FLSH_CFG_BACKEND_C_
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+// For open, pread, pwrite, and the Cronus session process
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "flsh_common_defs.h"
+#include "flsh_global_vars.h"
+#include "flsh_cfg_backend.h"
+
+// Provide cross references to System Verilog tasks for Incisive simulation of C code
+#ifdef USE_SIM_TO_TEST
+  #include "svdpi.h"
+  extern void CFG_WR_C(unsigned int, unsigned int, unsigned int, const char*);
+  extern void CFG_RD_C(unsigned int, unsigned int*, const char*);
+#endif
+
+// List of selectable backends. The first entry is the default.
+static cfg_backend *CFG_BACKENDS[] = {
+#if defined USE_SIM_TO_TEST
+  &CFG_BACKEND_SIM,
+#elif defined USE_CRONUS_ACCESS
+  &CFG_BACKEND_CRONUS,
+#endif
+  &CFG_BACKEND_SYSFS,
+  &CFG_BACKEND_URING,
+  &CFG_BACKEND_CRONUS,
+  &CFG_BACKEND_CRONUS_SESSION,
+  &CFG_BACKEND_EMU,
+  NULL
+};
+
+cfg_backend *CFG_BACKEND = NULL;
+static char CFG_BACKEND_ARGS[1024] = "";
+
+
+// --------------------------------------------------------------------------------------------------------
+int cfg_backend_select(char *spec)     // Pick backend from "<name>[:<args>]", returns -1 if unknown
+{ char  name[64];
+  char *colon;
+  int   len, i;
+
+  colon = strchr(spec, ':');
+  len   = (colon == NULL) ? (int) strlen(spec) : (int) (colon - spec);
+  if (len >= (int) sizeof(name)) len = sizeof(name) - 1;
+  memcpy(name, spec, len);
+  name[len] = '\0';
+
+  for (i = 0; CFG_BACKENDS[i] != NULL; i++) {
+    if (strcmp(CFG_BACKENDS[i]->name, name) == 0) {
+      CFG_BACKEND = CFG_BACKENDS[i];
+      snprintf(CFG_BACKEND_ARGS, sizeof(CFG_BACKEND_ARGS), "%s", (colon == NULL) ? "" : colon + 1);
+      return 0;
+    }
+  }
+  printf("ERROR: unknown config space backend '%s'\n", name);
+  cfg_backend_usage(stdout);
+  return -1;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+int cfg_backend_open(char *cfgbdf)     // Open selected backend (default one if none selected)
+{ if (CFG_BACKEND == NULL)
+    CFG_BACKEND = CFG_BACKENDS[0];
+  return CFG_BACKEND->open(cfgbdf, CFG_BACKEND_ARGS);
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+void cfg_backend_close(void)
+{ if (CFG_BACKEND != NULL && CFG_BACKEND->close != NULL)
+    CFG_BACKEND->close();
+  return;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+void cfg_backend_usage(FILE *f)        // List available backends
+{ int i;
+  fprintf(f, " Config space backends (--backend <name>[:<key>=<value>,...]):\n");
+  for (i = 0; CFG_BACKENDS[i] != NULL; i++) {
+    if (i > 0 && CFG_BACKENDS[i] == CFG_BACKENDS[0]) continue;   // Default is listed twice in the table
+    fprintf(f, "   %-10s %s%s\n", CFG_BACKENDS[i]->name, CFG_BACKENDS[i]->help, (i == 0) ? " (default)" : "");
+  }
+  return;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+int cfg_backend_arg(char *args, const char *key, char *val, int val_len)   // Returns 1 and copies value if key is present
+{ char *p = args;
+  int   key_len = strlen(key);
+  int   len;
+
+  while (p != NULL && *p != '\0') {
+    if (strncmp(p, key, key_len) == 0 && (p[key_len] == '=' || p[key_len] == ',' || p[key_len] == '\0')) {
+      p = p + key_len;
+      if (*p == '=') p++;
+      len = strcspn(p, ",");
+      if (len >= val_len) len = val_len - 1;
+      memcpy(val, p, len);
+      val[len] = '\0';
+      return 1;
+    }
+    p = strchr(p, ',');
+    if (p != NULL) p++;
+  }
+  return 0;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+long cfg_backend_arg_num(char *args, const char *key, long dflt)   // Number with optional K/M/G suffix
+{ char  val[64];
+  char *end;
+  long  num;
+
+  if (!cfg_backend_arg(args, key, val, sizeof(val)) || val[0] == '\0')
+    return dflt;
+  num = strtol(val, &end, 0);
+  switch (*end)
+    { case 'k': case 'K': num = num << 10; break;
+      case 'm': case 'M': num = num << 20; break;
+      case 'g': case 'G': num = num << 30; break;
+      default : break;
+    }
+  return num;
+}
+
+
+
+// --------------------------------------------------------------------------------------------------------
+// sysfs backend: /sys/bus/pci/devices/<bdf>/config of the card, using positional reads and writes.
+// - path=<file> opens another file instead, e.g. a regular file standing in for config space
+// --------------------------------------------------------------------------------------------------------
+static int sysfs_open(char *cfgbdf, char *args)
+{ char cfg_file[1024];
+
+  if (!cfg_backend_arg(args, "path", cfg_file, sizeof(cfg_file)))
+    snprintf(cfg_file, sizeof(cfg_file), "/sys/bus/pci/devices/%s/config", cfgbdf);
+
+  if ((CFG_FD = open(cfg_file, O_RDWR)) < 0) {
+    printf("Can not open %s\n", cfg_file);
+    return -1;
+  }
+  return 0;
+}
+
+static int sysfs_read32(u32 addr, u32 *rdata, char *s)
+{ (void) s;
+  return (pread(CFG_FD, rdata, 4, addr) == 4) ? 0 : -1;
+}
+
+static int sysfs_write(u32 addr, u32 wdata, int num_bytes, char *s)
+{ (void) s;
+  return (pwrite(CFG_FD, &wdata, num_bytes, addr) == num_bytes) ? 0 : -1;
+}
+
+static int sysfs_batch(cfg_batch_op *ops, int num_ops, char *s)
+{ int i;
+  (void) s;
+  for (i = 0; i < num_ops; i++) {
+    if (ops[i].op == CFG_OP_WR) {
+      if (pwrite(CFG_FD, &ops[i].wdata, ops[i].num_bytes, ops[i].addr) != ops[i].num_bytes) return -1;
+    } else {
+      // An 8 byte read is split by the kernel into aligned dword config reads in ascending address order
+      if (pread(CFG_FD, ops[i].rdata, ops[i].num_bytes, ops[i].addr) != ops[i].num_bytes) return -1;
+    }
+  }
+  return 0;
+}
+
+static void sysfs_close(void)
+{ close(CFG_FD);
+  return;
+}
+
+cfg_backend CFG_BACKEND_SYSFS = {
+  "sysfs", "PCI config space through /sys/bus/pci/devices/<bdf>/config [path=<file>]",
+  sysfs_open, sysfs_read32, sysfs_write, sysfs_batch, sysfs_close, 0
+};
+
+
+
+// --------------------------------------------------------------------------------------------------------
+// cronus backend: Cronus putmemproc / getmemproc commands, one process per command.
+// - The config address is written to the bridge at 60302016E0000, the data moves through 60302016E0080.
+// --------------------------------------------------------------------------------------------------------
+static int cronus_open(char *cfgbdf, char *args)
+{ (void) cfgbdf; (void) args;   // The Cronus bridge address is fixed
+  return 0;
+}
+
+static int cronus_select_addr(u32 addr)   // Point the Cronus bridge at a config register
+{ char command[1024];
+  snprintf(command, sizeof(command), "putmemproc -ci 60302016E0000 80000%03x00000000", addr);
+  //printf("%s\n",command);
+  return (system(command) == 0) ? 0 : -1;
+}
+
+static void cronus_format_data(u32 wdata, int num_bytes, char *str)   // Data as Cronus takes it: bytes in memory (little endian) order
+{ char writedatastr[16];
+  int  i;
+  sprintf(writedatastr, "%08x", wdata);
+  //Swap endianness, keep only the bytes being written
+  for (i = 0; i < num_bytes; i++) {
+    str[2*i  ] = writedatastr[6-2*i];
+    str[2*i+1] = writedatastr[7-2*i];
+  }
+  str[2*num_bytes] = '\0';
+  return;
+}
+
+static u32 cronus_parse_data(char *str)   // Inverse of cronus_format_data() for 4 bytes
+{ char readdatastr2[16] = "";
+  int  i;
+  //Swap endianness
+  for (i = 0; i < 4; i++) {
+    readdatastr2[2*i  ] = str[6-2*i];
+    readdatastr2[2*i+1] = str[7-2*i];
+  }
+  return strtoul(readdatastr2, NULL, 16);
+}
+
+static int cronus_write(u32 addr, u32 wdata, int num_bytes, char *s)
+{ char command[1024];
+  char writedatastr[16];
+  (void) s;
+
+  if (cronus_select_addr(addr) != 0) return -1;
+  cronus_format_data(wdata, num_bytes, writedatastr);
+  snprintf(command, sizeof(command), "putmemproc -ci 60302016E0080 %s", writedatastr);
+  //printf("%s\n",command);
+  return (system(command) == 0) ? 0 : -1;
+}
+
+static int cronus_read32(u32 addr, u32 *rdata, char *s)
+{ char outputjunkbuffer[1024];
+  FILE *memprocout;
+  (void) s;
+
+  if (cronus_select_addr(addr) != 0) return -1;
+  memprocout = popen("getmemproc -ci 60302016E0080 4", "r");
+  if (!memprocout) return -1;
+  //toss out first line. relevant cronus output on second line from console.
+  if (fgets(outputjunkbuffer, sizeof(outputjunkbuffer), memprocout) == NULL ||
+      fgets(outputjunkbuffer, sizeof(outputjunkbuffer), memprocout) == NULL) {
+    pclose(memprocout);
+    return -1;
+  }
+  pclose(memprocout);
+  //grab portion of string that is relevant
+  *rdata = cronus_parse_data(&outputjunkbuffer[18]);
+  return 0;
+}
+
+cfg_backend CFG_BACKEND_CRONUS = {
+  "cronus", "Cronus putmemproc/getmemproc, one process per access",
+  cronus_open, cronus_read32, cronus_write, NULL, NULL, 0
+};
+
+
+
+// --------------------------------------------------------------------------------------------------------
+// cronus_session backend: one long lived Cronus / eCMD session process, fed through a pipe.
+// - cmd=<command> is started once with /bin/sh -c. It takes the same putmemproc / getmemproc command lines
+//   as the one-process-per-access backend on its stdin, and answers on its stdout:
+//     putmemproc -ci <addr> <hex>    no reply, or "ERR put <text>" on failure
+//     getmemproc -ci <addr> <bytes>  one line with <hex> in memory byte order, or "ERR get <text>"
+//     sync <tag>                     "sync <tag>" once all earlier commands are done
+//     quit                           end the session
+//   debug/cronus_standin.py implements this against a register file, for testing without a lab system.
+// - Writes are only buffered, reads and batches flush the buffer and wait for their replies, so a run of
+//   writes costs no round trips. Errors of buffered writes show up on the next read, or at close.
+// - The config register selected in the Cronus bridge is remembered, so polling one register
+//   (FLASH_ADDR while an AXI operation completes) only sends the data command.
+// --------------------------------------------------------------------------------------------------------
+static struct {
+  FILE  *to_cp;                 // Commands to the session process
+  FILE  *from_cp;               // Replies from the session process
+  pid_t  pid;
+  u32    sel_addr;              // Config register selected in the bridge, CRONUS_SEL_NONE if not known
+  long   n_cmds;
+  long   n_syncs;               // Round trips to the session process
+  int    stats;
+} CS;
+
+#define CRONUS_SEL_NONE 0xFFFFFFFF
+
+static int cs_reply(char *line, int len)   // Next reply line, reporting any write errors ahead of it
+{ int write_errors = 0;
+
+  if (fflush(CS.to_cp) != 0) return -1;
+  CS.n_syncs++;
+  while (fgets(line, len, CS.from_cp) != NULL) {
+    line[strcspn(line, "\n")] = '\0';
+    if (strncmp(line, "ERR put", 7) != 0)
+      return (write_errors > 0 || strncmp(line, "ERR", 3) == 0) ? -1 : 0;
+    printf("*** ERROR in cronus_session: %s\n", line);
+    CS.sel_addr = CRONUS_SEL_NONE;   // Bridge state is unknown after a failed write
+    write_errors++;
+  }
+  printf("*** ERROR in cronus_session: session process ended\n");
+  return -1;
+}
+
+static int cs_send_select(u32 addr)
+{ if (addr == CS.sel_addr) return 0;
+  CS.sel_addr = addr;
+  CS.n_cmds++;
+  return (fprintf(CS.to_cp, "putmemproc -ci 60302016E0000 80000%03x00000000\n", addr) < 0) ? -1 : 0;
+}
+
+static int cs_send_write(u32 addr, u32 wdata, int num_bytes)
+{ char writedatastr[16];
+  if (cs_send_select(addr) != 0) return -1;
+  cronus_format_data(wdata, num_bytes, writedatastr);
+  CS.n_cmds++;
+  return (fprintf(CS.to_cp, "putmemproc -ci 60302016E0080 %s\n", writedatastr) < 0) ? -1 : 0;
+}
+
+static int cs_send_read(u32 addr)
+{ if (cs_send_select(addr) != 0) return -1;
+  CS.n_cmds++;
+  return (fprintf(CS.to_cp, "getmemproc -ci 60302016E0080 4\n") < 0) ? -1 : 0;
+}
+
+static int cs_open(char *cfgbdf, char *args)
+{ char  cmd[1024], val[16];
+  int   to_fd[2], from_fd[2];
+  (void) cfgbdf;
+
+  if (!cfg_backend_arg(args, "cmd", cmd, sizeof(cmd))) {
+    printf("cronus_session: cmd=<command> is required, e.g. --backend cronus_session:cmd=debug/cronus_standin.py\n");
+    return -1;
+  }
+  CS.stats    = cfg_backend_arg(args, "stats", val, sizeof(val));
+  CS.sel_addr = CRONUS_SEL_NONE;
+
+  if (pipe(to_fd) != 0 || pipe(from_fd) != 0) return -1;
+  if ((CS.pid = fork()) < 0) return -1;
+  if (CS.pid == 0) {
+    dup2(to_fd[0], 0);
+    dup2(from_fd[1], 1);
+    close(to_fd[0]);   close(to_fd[1]);
+    close(from_fd[0]); close(from_fd[1]);
+    execl("/bin/sh", "sh", "-c", cmd, (char *) NULL);
+    _exit(127);
+  }
+  close(to_fd[0]);
+  close(from_fd[1]);
+  signal(SIGPIPE, SIG_IGN);   // A session process that dies shows up as a write error, not as a signal
+  CS.to_cp   = fdopen(to_fd[1], "w");
+  CS.from_cp = fdopen(from_fd[0], "r");
+  if (CS.to_cp == NULL || CS.from_cp == NULL) return -1;
+  setvbuf(CS.to_cp, NULL, _IOFBF, 65536);
+  return 0;
+}
+
+static int cs_write(u32 addr, u32 wdata, int num_bytes, char *s)
+{ (void) s;
+  return cs_send_write(addr, wdata, num_bytes);
+}
+
+static int cs_read32(u32 addr, u32 *rdata, char *s)
+{ char line[256];
+  (void) s;
+
+  if (cs_send_read(addr) != 0 || cs_reply(line, sizeof(line)) != 0) return -1;
+  *rdata = cronus_parse_data(line);
+  return 0;
+}
+
+static int cs_batch(cfg_batch_op *ops, int num_ops, char *s)
+{ char line[256];
+  int  i, rc = 0;
+  (void) s;
+
+  // Send the whole batch, then collect read replies in order
+  for (i = 0; i < num_ops; i++) {
+    if (ops[i].op == CFG_OP_WR) {
+      if (cs_send_write(ops[i].addr, ops[i].wdata, ops[i].num_bytes) != 0) return -1;
+    } else {
+      if (cs_send_read(ops[i].addr) != 0) return -1;
+      if (ops[i].num_bytes == 8 && cs_send_read(ops[i].addr + 4) != 0) return -1;
+    }
+  }
+  for (i = 0; i < num_ops; i++) {
+    if (ops[i].op == CFG_OP_WR) continue;
+    if (cs_reply(line, sizeof(line)) != 0) rc = -1;
+    else ops[i].rdata[0] = cronus_parse_data(line);
+    if (ops[i].num_bytes != 8) continue;
+    if (cs_reply(line, sizeof(line)) != 0) rc = -1;
+    else ops[i].rdata[1] = cronus_parse_data(line);
+  }
+  return rc;
+}
+
+static void cs_close(void)
+{ char line[256];
+
+  // Make sure buffered writes reached the card before the session ends
+  fprintf(CS.to_cp, "sync 0\n");
+  if (cs_reply(line, sizeof(line)) != 0 || strcmp(line, "sync 0") != 0) {
+    printf("*** ERROR in cronus_session: no sync reply at close\n");
+    ERRORS_DETECTED++;
+  }
+  fprintf(CS.to_cp, "quit\n");
+  fclose(CS.to_cp);
+  fclose(CS.from_cp);
+  waitpid(CS.pid, NULL, 0);
+  if (CS.stats)
+    printf("cronus_session: %ld commands, %ld round trips\n", CS.n_cmds, CS.n_syncs);
+  return;
+}
+
+cfg_backend CFG_BACKEND_CRONUS_SESSION = {
+  "cronus_session", "One long lived Cronus session process fed through a pipe [cmd=<command>,stats]",
+  cs_open, cs_read32, cs_write, cs_batch, cs_close, 1
+};
+
+
+
+#ifdef USE_SIM_TO_TEST
+// --------------------------------------------------------------------------------------------------------
+// sim backend: System Verilog tasks when running under Incisive
+// --------------------------------------------------------------------------------------------------------
+static int sim_open(char *cfgbdf, char *args)
+{ (void) cfgbdf; (void) args;
+  return 0;
+}
+
+static int sim_read32(u32 addr, u32 *rdata, char *s)
+{ CFG_RD_C(addr, rdata, s);
+  return 0;
+}
+
+static int sim_write(u32 addr, u32 wdata, int num_bytes, char *s)
+{ CFG_WR_C(addr, wdata, num_bytes, s);
+  return 0;
+}
+
+cfg_backend CFG_BACKEND_SIM = {
+  "sim", "Incisive simulation through CFG_WR_C / CFG_RD_C",
+  sim_open, sim_read32, sim_write, NULL, NULL, 0
+};
+#endif
+
+
+#endif
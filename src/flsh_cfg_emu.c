@@ -0,0 +1,747 @@
+#ifndef FLSH_CFG_EMU_C_
+#define FLSH_CFG_EMU_C_
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// --------------------------------------------------------------------------------------------------------
+// In-process card emulator, used as config space backend 'emu'
+// - Models the parts of an OpenCAPI card that oc-flash / oc-reload touch: the config space IDs, the
+//   FLASH_ADDR / FLASH_DATA AXI4-Lite bridge (with Byte Expander), the AXI Quad SPI core, two Micron
+//   style SPI FLASH parts behind it, and enough of the HWICAP core for the reload and PR sequences.
+// - Meant for trying out transports and flash algorithms without a card, and for counting operations.
+//   It is not cycle accurate. The SPI shift rate is expressed in bytes per config access, FLASH busy
+//   times are real (monotonic clock) times scaled by 'tscale'.
+// - Options (--backend emu:<key>=<value>,...):
+//     subsys=<id>     Subsystem ID reported in config space (default 0x0666, AD9H7)
+//     fifo=<n>        DTR / DRR FIFO depth of the Quad SPI core, 16 or 256 (default 16)
+//     size=<n>        Size of each FLASH part, K/M/G suffix allowed (default 128M)
+//     flash=<file>    Keep FLASH contents in <file> (DEV1) and <file>.dev2 (DEV2) between runs.
+//                     Data is stored inverted, so a new (sparse) file reads back as erased FLASH.
+//     spi=<n>         Bytes shifted on the SPI bus per config access, 0 = transfer completes at once (default 0)
+//     quad            Quad SPI core built in quad mode: dummy cycles and data of 0x6B / 0x6C / 0x32 / 0x34 move on 4 lanes,
+//                     4 bytes in the time of one. Without it the core is in standard mode and those commands come out
+//                     garbled, as on a card (the FLASH drives 4 lanes, the core samples DQ1 only).
+//     nosfdp          The FLASH parts answer READ SFDP (0x5A) with 0xFF, like parts without SFDP tables
+//     axi_busy=<n>    Number of FLASH_ADDR polls for which an AXI strobe stays set (default 0)
+//     wr_fail=<n>     The n-th AXI write is dropped and answered with a slave error (default 0, never)
+//     tscale=<f>      Multiplier applied to FLASH program / erase times (default 1.0, 0 = never busy)
+//     stats           Print operation counts when the backend is closed
+// --------------------------------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include "flsh_common_defs.h"
+#include "flsh_global_vars.h"
+#include "flsh_cfg_backend.h"
+
+#define EMU_FIFO_MAX   256
+#define EMU_ICAP_WF_DEPTH 0x3F         // Vacancy of the empty HWICAP write FIFO
+#define EMU_PAGE_SIZE  256
+#define EMU_SFDP_SIZE  256
+
+// Typical Micron MT25Q times, in microseconds
+#define EMU_T_PP         120
+#define EMU_T_SSE      50000
+#define EMU_T_SE32    100000
+#define EMU_T_SE      150000
+#define EMU_T_REG        100
+#define EMU_T_DIE   60000000        // Per 128MB
+#define EMU_DIE_SIZE  0x4000000     // Parts larger than a 512Mb die are stacked from them, DIE ERASE (0xC4) erases one
+
+typedef struct {                    // One SPI FLASH part
+  byte   *mem;                      //   Contents, stored inverted (0x00 = erased)
+  u32     size;
+  int     fd;
+  // Transaction state, valid while chip select is asserted
+  int     selected;
+  int     nbytes;                   //   Bytes shifted in during this transaction
+  byte    cmd;
+  int     addr_bytes;
+  int     dummy_bytes;
+  int     lanes;                    //   Lanes of the byte last shifted: 4 in the quad phase of a quad command on a quad core
+  u32     addr;
+  byte    data_in[EMU_PAGE_SIZE];   //   Write payload, applied when chip select is released
+  int     data_in_cnt;
+  // Registers
+  byte    sr;                       //   Status: [1] WEL. WIP [0] is derived from busy_until.
+  byte    fsr;                      //   Flag status: [5] erase error, [4] program error, [0] 4B mode. Ready [7] derived.
+  byte    evcr;
+  byte    vcr;
+  byte    ear;
+  u32     nvcr;
+  byte    sfdp[EMU_SFDP_SIZE];      //   READ SFDP space, 0xFF past the tables
+  int     addr4;                    //   4 byte address mode
+  int     reset_enabled;            //   Last command was RESET ENABLE
+  double  busy_until;               //   Monotonic time (seconds) the current program / erase completes
+} emu_flash;
+
+static struct {
+  // Options
+  u32     subsys;
+  int     fifo_depth;
+  u32     flash_size;
+  int     spi_rate;
+  int     quad;
+  int     nosfdp;
+  int     axi_busy;
+  long    wr_fail;
+  double  tscale;
+  int     stats;
+  // Config space
+  u32     cfg[1024];
+  int     strobe_pending;           // FLASH_ADDR polls left before the strobe is shown as clear
+  u32     strobe;                   // FA_WR or FA_RD of the AXI operation in progress
+  // Quad SPI core
+  u32     spicr, spissr, ipisr, ipier, dgier;
+  byte    tx[EMU_FIFO_MAX];
+  int     tx_head, tx_cnt;
+  byte    rx[EMU_FIFO_MAX];
+  int     rx_head, rx_cnt;
+  emu_flash *active;                // FLASH part with chip select asserted, NULL if none
+  emu_flash  dev[2];
+  // HWICAP core and 250SOC mailbox
+  u32     icap_cr, icap_sz, icap_rfo, icap_wf_cnt;
+  u32     mailbox[2048];
+  // Statistics
+  long    n_cfg_rd, n_cfg_wr, n_axi_rd, n_axi_wr, n_spi_bytes, n_spi_clocks, n_xact, n_program, n_erase, n_slverr;
+} emu;
+
+
+// --------------------------------------------------------------------------------------------------------
+static double emu_now(void)
+{ struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int emu_busy(emu_flash *f)
+{ return emu_now() < f->busy_until;
+}
+
+static void emu_set_busy(emu_flash *f, double usec)
+{ f->busy_until = emu_now() + usec * emu.tscale / 1e6;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+// FLASH part
+// --------------------------------------------------------------------------------------------------------
+static void emu_flash_reset(emu_flash *f)    // Power on / RESET MEMORY state of volatile registers
+{ f->sr    = 0x00;
+  f->fsr   = 0x00;
+  f->evcr  = 0xDF;
+  f->vcr   = 0xFB;
+  f->ear   = 0x00;
+  f->addr4 = ((f->nvcr & 0x0001) == 0);     // NVCR[0] = 0 selects 4 byte address mode at power on
+  f->reset_enabled = 0;
+}
+
+static void emu_flash_sfdp_dword(emu_flash *f, int at, u32 dw)
+{ f->sfdp[at]   = (byte) dw;          f->sfdp[at+1] = (byte) (dw >> 8);
+  f->sfdp[at+2] = (byte) (dw >> 16);  f->sfdp[at+3] = (byte) (dw >> 24);
+}
+
+static u32 emu_die_size(emu_flash *f)
+{ return (f->size > EMU_DIE_SIZE) ? EMU_DIE_SIZE : f->size;
+}
+
+static u32 emu_flash_sfdp_die_time(emu_flash *f)   // BFPT DWORD 11 bits 24 to 30: die erase time, count and unit
+{ static const double unit_us[4] = { 16000, 256000, 4000000, 64000000 };
+  double die_us = EMU_T_DIE * ((double) emu_die_size(f) / 0x08000000);
+  u32  u = 0, count;
+
+  while (u < 3 && die_us > 32 * unit_us[u]) u++;
+  count = (u32) ((die_us + unit_us[u] - 1) / unit_us[u]);
+  if (count < 1)  count = 1;
+  if (count > 32) count = 32;
+  return ((count - 1) << 24) | (u << 29);
+}
+
+static void emu_flash_sfdp(emu_flash *f)     // SFDP of an MT25QU: BFPT (JESD216B, 16 DWORDs) at 0x30, 4BAIT at 0x80
+{ unsigned long long bits = (unsigned long long) f->size * 8;
+  int log2_bits = 0;
+  static const byte header[24] = { 'S', 'F', 'D', 'P', 0x06, 0x01, 0x01, 0xFF,     // Rev 1.6, 2 parameter headers
+                                   0x00, 0x06, 0x01, 0x10, 0x30, 0x00, 0x00, 0xFF,     // BFPT
+                                   0x84, 0x00, 0x01, 0x02, 0x80, 0x00, 0x00, 0xFF };   // 4BAIT
+
+  memset(f->sfdp, 0xFF, sizeof(f->sfdp));
+  if (emu.nosfdp) return;
+  while ((1ULL << log2_bits) < bits) log2_bits++;
+  memcpy(f->sfdp, header, sizeof(header));
+  emu_flash_sfdp_dword(f, 0x30, 0x00332005);                                        // 4KB erase 0x20, 1-1-4 fast read
+  emu_flash_sfdp_dword(f, 0x34, (bits <= 0x100000000ULL) ? (u32) (bits - 1) : 0x80000000 | log2_bits);
+  emu_flash_sfdp_dword(f, 0x38, 0x6B08EB29);                                        // 1-1-4: 0x6B, 8 dummy cycles
+  emu_flash_sfdp_dword(f, 0x3C, 0x3B08BB08);
+  emu_flash_sfdp_dword(f, 0x4C, 0x520F200C);                                        // Erase types 4KB 0x20, 32KB 0x52
+  emu_flash_sfdp_dword(f, 0x50, 0x0000D810);                                        //   64KB 0xD8
+  emu_flash_sfdp_dword(f, 0x54, 3 | (2 << 4) | (1 << 9) | (5 << 11) | (1 << 16) | (8 << 18) | (1 << 23));   // 48 / 96 / 144 ms
+  emu_flash_sfdp_dword(f, 0x58, 6 | (8 << 4) | (14 << 8) | emu_flash_sfdp_die_time(f));   // 256B pages, PP 120us, one die
+  emu_flash_sfdp_dword(f, 0x80, 0x00000EF3);                                        // 0x13 0x0C 0x6C 0x12 0x34, 4B erases
+  emu_flash_sfdp_dword(f, 0x84, 0xFFDC5C21);                                        //   0x21 0x5C 0xDC
+}
+
+static int emu_flash_open(emu_flash *f, char *path)
+{ f->size = emu.flash_size;
+  f->nvcr = 0xFFFF;
+  f->fd   = -1;
+  if (path != NULL) {
+    if ((f->fd = open(path, O_RDWR | O_CREAT, 0644)) < 0 || ftruncate(f->fd, f->size) != 0) {
+      printf("emu: Can not open %s\n", path);
+      return -1;
+    }
+    f->mem = mmap(NULL, f->size, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+  } else {
+    f->mem = mmap(NULL, f->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+  if (f->mem == MAP_FAILED) {
+    printf("emu: Can not map %u bytes of FLASH\n", f->size);
+    return -1;
+  }
+  emu_flash_sfdp(f);
+  emu_flash_reset(f);
+  return 0;
+}
+
+static void emu_flash_close(emu_flash *f)
+{ munmap(f->mem, f->size);
+  if (f->fd >= 0) close(f->fd);
+  return;
+}
+
+static int emu_flash_cmd_addr_bytes(emu_flash *f, byte cmd)   // Number of address bytes following 'cmd'
+{ switch (cmd)
+    { case 0x03: case 0x0B: case 0x6B: case 0x02: case 0x32: case 0x20: case 0x52: case 0xD8: case 0xC4:
+        return f->addr4 ? 4 : 3;
+      case 0x13: case 0x0C: case 0x6C: case 0x12: case 0x34: case 0x21: case 0x5C: case 0xDC:
+        return 4;
+      case 0x5A:                                                // READ SFDP, 3 bytes in either address mode
+        return 3;
+      default:
+        return 0;
+    }
+}
+
+static int emu_flash_cmd_quad(byte cmd)                       // Dummy cycles and data on DQ0-DQ3
+{ return cmd == 0x6B || cmd == 0x6C || cmd == 0x32 || cmd == 0x34;
+}
+
+static int emu_flash_cmd_dummy_bytes(byte cmd)                // Dummy bytes between address and data (8 cycles)
+{ switch (cmd)
+    { case 0x0B: case 0x0C: case 0x5A: return 1;
+      case 0x6B: case 0x6C: return emu.quad ? 4 : 1;          // 2 cycles per byte on a quad core
+      default:              return 0;
+    }
+}
+
+static u32 emu_flash_addr(emu_flash *f)      // Full address, with EXTENDED ADDRESS REGISTER for 3 byte commands
+{ u32 addr = f->addr;
+  if (f->addr_bytes == 3) addr = addr | ((u32) f->ear << 24);
+  return addr % f->size;
+}
+
+static byte emu_flash_dq1(emu_flash *f, int idx)   // Byte a standard mode core samples from DQ1 during a quad read:
+{ byte d, b = 0;                                   // bit 1 of the 8 nibbles (4 bytes) the FLASH drives in 8 cycles
+  int  i;
+  for (i = 0; i < 4; i++) {
+    d = ~f->mem[(emu_flash_addr(f) + 4 * idx + i) % f->size];
+    b = (byte) ((b << 2) | (((d >> 5) & 1) << 1) | ((d >> 1) & 1));
+  }
+  return b;
+}
+
+static void emu_flash_data_in(emu_flash *f, int idx, byte in)   // Write payload byte, page program wraps in the page
+{ if (f->cmd == 0x02 || f->cmd == 0x12 || f->cmd == 0x32 || f->cmd == 0x34) {
+    if (f->data_in_cnt < EMU_PAGE_SIZE) f->data_in_cnt++;
+    f->data_in[(emu_flash_addr(f) + idx) % EMU_PAGE_SIZE] = in;
+  } else if (idx < EMU_PAGE_SIZE) {
+    f->data_in[idx] = in;
+    f->data_in_cnt  = idx + 1;
+  }
+}
+
+static void emu_flash_select(emu_flash *f)
+{ f->selected    = 1;
+  f->nbytes      = 0;
+  f->addr        = 0;
+  f->data_in_cnt = 0;
+  emu.n_xact++;
+}
+
+static byte emu_flash_xfer(emu_flash *f, byte in)   // Shift one byte in, return the byte shifted out
+{ int pos = f->nbytes++;
+  int idx, i;
+
+  f->lanes = (emu.quad && emu_flash_cmd_quad(f->cmd) && pos > f->addr_bytes) ? 4 : 1;
+  if (pos == 0) {
+    f->cmd         = in;
+    f->addr_bytes  = emu_flash_cmd_addr_bytes(f, in);
+    f->dummy_bytes = emu_flash_cmd_dummy_bytes(in);
+    return 0xFF;
+  }
+  if (pos <= f->addr_bytes) {
+    f->addr = (f->addr << 8) | in;
+    return 0xFF;
+  }
+  if (pos <= f->addr_bytes + f->dummy_bytes)
+    return 0xFF;
+
+  idx = pos - 1 - f->addr_bytes - f->dummy_bytes;   // Index of data byte
+  if (emu_busy(f) && f->cmd != 0x05 && f->cmd != 0x70)
+    return 0xFF;                                     // Only status reads are answered while busy
+
+  switch (f->cmd)
+    { case 0x05: return f->sr | (emu_busy(f) ? 0x01 : 0x00);            // READ STATUS REGISTER (repeats)
+      case 0x70: return f->fsr | (f->addr4 ? 0x01 : 0x00) | (emu_busy(f) ? 0x00 : 0x80);  // READ FLAG STATUS REGISTER
+      case 0x9E: case 0x9F:                                             // READ ID
+        switch (idx)
+          { case 0:  return 0x20;                                       // Micron
+            case 1:  return 0xBB;                                       // 1.8V MT25QU
+            case 2:  return (f->size >= 0x10000000) ? 0x22 : (f->size >= 0x08000000) ? 0x21 : 0x20;
+            case 3:  return 0x10;
+            default: return 0x00;
+          }
+      case 0x03: case 0x13: case 0x0B: case 0x0C:                       // READ, FAST READ
+        return ~f->mem[(emu_flash_addr(f) + idx) % f->size];
+      case 0x5A:                                                        // READ SFDP
+        return (f->addr + idx < EMU_SFDP_SIZE) ? f->sfdp[f->addr + idx] : 0xFF;
+      case 0x6B: case 0x6C:                                             // QUAD OUTPUT FAST READ
+        return emu.quad ? ~f->mem[(emu_flash_addr(f) + idx) % f->size] : emu_flash_dq1(f, idx);
+      case 0x65: return f->evcr;
+      case 0x85: return f->vcr;
+      case 0xC8: return f->ear;
+      case 0xB5: return (idx == 0) ? (byte) (f->nvcr & 0xFF) : (byte) (f->nvcr >> 8);
+      case 0x32: case 0x34:                                             // QUAD INPUT FAST PROGRAM
+        if (emu.quad) {
+          emu_flash_data_in(f, idx, in);
+        } else {                                                        // 8 cycles of DQ0, DQ1-DQ3 pulled up
+          for (i = 0; i < 4; i++)
+            emu_flash_data_in(f, 4 * idx + i, (byte) (0xEE | (((in >> (7 - 2*i)) & 1) << 4) | ((in >> (6 - 2*i)) & 1)));
+        }
+        return 0xFF;
+      default:
+        emu_flash_data_in(f, idx, in);
+        return 0xFF;
+    }
+}
+
+static void emu_flash_erase(emu_flash *f, u32 block)
+{ u32 addr = emu_flash_addr(f) & ~(block - 1);
+  memset(f->mem + addr, 0x00, block);
+  emu.n_erase++;
+}
+
+static void emu_flash_deselect(emu_flash *f)   // Chip select released, execute the command
+{ int  wel = (f->sr & 0x02) != 0;
+  int  reset_enabled = f->reset_enabled;
+  u32  addr, i, first;
+
+  f->selected      = 0;
+  f->reset_enabled = 0;
+  if (f->nbytes == 0) return;
+  if (emu_busy(f)) return;                    // Commands other than status reads are ignored while busy
+
+  switch (f->cmd)
+    { case 0x06: f->sr = f->sr |  0x02; return;                     // WRITE ENABLE
+      case 0x04: f->sr = f->sr & ~0x02; return;                     // WRITE DISABLE
+      case 0x66: f->reset_enabled = 1;  return;                     // RESET ENABLE
+      case 0x99: if (reset_enabled) emu_flash_reset(f); return;     // RESET MEMORY
+      case 0xB7: f->addr4 = 1; return;                              // ENTER 4 BYTE ADDRESS MODE
+      case 0xE9: f->addr4 = 0; return;                              // EXIT 4 BYTE ADDRESS MODE
+      case 0x50: f->fsr = f->fsr & ~0x3E; return;                   // CLEAR FLAG STATUS REGISTER
+      default:   break;
+    }
+
+  if (!wel) {
+    switch (f->cmd)                            // Program / erase / register writes need WRITE ENABLE first
+      { case 0x01: case 0x61: case 0x81: case 0xB1: case 0xC5: case 0x02: case 0x12: case 0x32: case 0x34:
+        case 0x20: case 0x21: case 0x52: case 0x5C: case 0xD8: case 0xDC: case 0xC4: case 0xC7: case 0x60:
+          f->fsr = f->fsr | 0x02;              // Protection error
+        default:
+          return;
+      }
+  }
+
+  switch (f->cmd)
+    { case 0x01: if (f->data_in_cnt >= 1) f->sr = f->data_in[0] & 0xFC; emu_set_busy(f, EMU_T_REG); break;
+      case 0x61: if (f->data_in_cnt >= 1) f->evcr = f->data_in[0]; break;
+      case 0x81: if (f->data_in_cnt >= 1) f->vcr  = f->data_in[0]; break;
+      case 0xC5: if (f->data_in_cnt >= 1) f->ear  = f->data_in[0]; break;
+      case 0xB1: if (f->data_in_cnt >= 2) f->nvcr = f->data_in[0] | (f->data_in[1] << 8); emu_set_busy(f, EMU_T_REG); break;
+      case 0x02: case 0x12: case 0x32: case 0x34:                   // PAGE PROGRAM, bits can only go from 1 to 0
+        addr  = emu_flash_addr(f);
+        first = addr & ~(EMU_PAGE_SIZE - 1);
+        for (i = 0; i < (u32) f->data_in_cnt; i++) {
+          u32 a = first + ((addr + i) % EMU_PAGE_SIZE);
+          f->mem[a] = f->mem[a] | (byte) ~f->data_in[(addr + i) % EMU_PAGE_SIZE];
+        }
+        emu.n_program++;
+        emu_set_busy(f, EMU_T_PP);
+        break;
+      case 0x20: case 0x21: emu_flash_erase(f, 0x1000);  emu_set_busy(f, EMU_T_SSE);  break;
+      case 0x52: case 0x5C: emu_flash_erase(f, 0x8000);  emu_set_busy(f, EMU_T_SE32); break;
+      case 0xD8: case 0xDC: emu_flash_erase(f, 0x10000); emu_set_busy(f, EMU_T_SE);   break;
+      case 0xC4: emu_flash_erase(f, emu_die_size(f));                // DIE ERASE, of the die holding the address
+        emu_set_busy(f, EMU_T_DIE * ((double) emu_die_size(f) / 0x08000000));
+        break;
+      case 0xC7: case 0x60:                                         // BULK ERASE
+        memset(f->mem, 0x00, f->size);
+        emu.n_erase++;
+        emu_set_busy(f, EMU_T_DIE * ((double) f->size / 0x08000000));
+        break;
+      default:
+        return;
+    }
+  f->sr = f->sr & ~0x02;                     // WEL clears when the command is accepted
+  return;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+// Quad SPI core
+// --------------------------------------------------------------------------------------------------------
+static void emu_qspi_reset(void)
+{ emu.spicr   = 0x00000180;
+  emu.spissr  = 0xFFFFFFFF;
+  emu.ipisr   = 0;
+  emu.ipier   = 0;
+  emu.dgier   = 0;
+  emu.tx_head = emu.tx_cnt = 0;
+  emu.rx_head = emu.rx_cnt = 0;
+}
+
+static emu_flash *emu_qspi_target(void)     // FLASH part that should have chip select asserted now
+{ int spi_on = (emu.spicr & 0x106) == 0x006;  // SPE, Master, and Master Transaction Inhibit off
+  if (!spi_on) return NULL;
+  if ((emu.spissr & 0x3) == SPISSR_SEL_DEV1) return &emu.dev[0];
+  if ((emu.spissr & 0x3) == SPISSR_SEL_DEV2) return &emu.dev[1];
+  return NULL;
+}
+
+static void emu_qspi_run(void)              // Advance the SPI bus, called on every config access
+{ emu_flash *target = emu_qspi_target();
+  int budget = 4 * ((emu.spi_rate > 0) ? emu.spi_rate : EMU_FIFO_MAX);   // In quarter bytes of one lane
+  byte out;
+
+  if (target != emu.active) {
+    if (emu.active != NULL) emu_flash_deselect(emu.active);
+    if (target     != NULL) emu_flash_select(target);
+    emu.active = target;
+  }
+  while (emu.active != NULL && emu.tx_cnt > 0 && budget > 0) {
+    out = emu_flash_xfer(emu.active, emu.tx[emu.tx_head]);
+    emu.tx_head = (emu.tx_head + 1) % EMU_FIFO_MAX;
+    emu.tx_cnt--;
+    if (emu.rx_cnt < emu.fifo_depth) {
+      emu.rx[(emu.rx_head + emu.rx_cnt) % EMU_FIFO_MAX] = out;
+      emu.rx_cnt++;
+      if (emu.rx_cnt == emu.fifo_depth) emu.ipisr = emu.ipisr | 0x10;   // DRR Full
+    } else {
+      emu.ipisr = emu.ipisr | 0x20;                                     // DRR Overrun
+    }
+    if (emu.tx_cnt == 0) emu.ipisr = emu.ipisr | 0x04;                  // DTR Empty
+    emu.n_spi_bytes++;
+    emu.n_spi_clocks += 8 / emu.active->lanes;
+    budget -= 4 / emu.active->lanes;
+  }
+  return;
+}
+
+static int emu_qspi_write(u32 addr, u32 wdata, int exp_on, int dir3210)   // Returns AXI write response
+{ int i, n;
+  byte b;
+
+  switch (addr)
+    { case FA_QSPI_SRR:
+        if (wdata == 0x0000000A) {
+          if (emu.active != NULL) emu_flash_deselect(emu.active);
+          emu.active = NULL;
+          emu_qspi_reset();
+        }
+        return FA_WR_RESP_OK;
+      case FA_QSPI_SPICR:
+        if (wdata & 0x20) emu.tx_head = emu.tx_cnt = 0;   // TX FIFO reset, self clearing
+        if (wdata & 0x40) emu.rx_head = emu.rx_cnt = 0;   // RX FIFO reset, self clearing
+        emu.spicr = wdata & 0x3FF & ~0x60;
+        return FA_WR_RESP_OK;
+      case FA_QSPI_SPISSR: emu.spissr = wdata;                 return FA_WR_RESP_OK;
+      case FA_QSPI_DGIER : emu.dgier  = wdata & 0x80000000;    return FA_WR_RESP_OK;
+      case FA_QSPI_IPIER : emu.ipier  = wdata & 0x3FFF;        return FA_WR_RESP_OK;
+      case FA_QSPI_IPISR : emu.ipisr  = emu.ipisr ^ (wdata & 0x3FFF); return FA_WR_RESP_OK;   // Toggle on write
+      case FA_QSPI_SPIDTR:
+        n = exp_on ? 4 : 1;
+        if (emu.tx_cnt + n > emu.fifo_depth) {
+          emu.n_slverr++;
+          return FA_WR_RESP_SLVERR;
+        }
+        for (i = 0; i < n; i++) {
+          if (!exp_on)       b = (byte) (wdata & 0xFF);
+          else if (dir3210)  b = (byte) (wdata >> (24 - 8*i));
+          else               b = (byte) (wdata >> (8*i));
+          emu.tx[(emu.tx_head + emu.tx_cnt) % EMU_FIFO_MAX] = b;
+          emu.tx_cnt++;
+        }
+        return FA_WR_RESP_OK;
+      default:
+        return FA_WR_RESP_OK;
+    }
+}
+
+static u32 emu_qspi_read(u32 addr, int exp_on, int dir3210, int *resp)
+{ u32 rdata = 0;
+  int i, n;
+  byte b;
+
+  *resp = FA_RD_RESP_OK;
+  switch (addr)
+    { case FA_QSPI_SPICR : return emu.spicr;
+      case FA_QSPI_SPISSR: return emu.spissr;
+      case FA_QSPI_DGIER : return emu.dgier;
+      case FA_QSPI_IPIER : return emu.ipier;
+      case FA_QSPI_IPISR : return emu.ipisr;
+      case FA_QSPI_TXFIFO: return (emu.tx_cnt > 0) ? emu.tx_cnt - 1 : 0;   // Occupancy minus one
+      case FA_QSPI_RDFIFO: return (emu.rx_cnt > 0) ? emu.rx_cnt - 1 : 0;
+      case FA_QSPI_SPISR :
+        return ((emu.rx_cnt == 0)               ? 0x01 : 0) |
+               ((emu.rx_cnt == emu.fifo_depth)  ? 0x02 : 0) |
+               ((emu.tx_cnt == 0)               ? 0x04 : 0) |
+               ((emu.tx_cnt == emu.fifo_depth)  ? 0x08 : 0);
+      case FA_QSPI_SPIDRR:
+        n = exp_on ? 4 : 1;
+        if (emu.rx_cnt < n) {
+          emu.n_slverr++;
+          *resp = FA_RD_RESP_SLVERR;
+          return 0;
+        }
+        for (i = 0; i < n; i++) {
+          b = emu.rx[emu.rx_head];
+          emu.rx_head = (emu.rx_head + 1) % EMU_FIFO_MAX;
+          emu.rx_cnt--;
+          if (!exp_on)       rdata = b;
+          else if (dir3210)  rdata = rdata | ((u32) b << (24 - 8*i));
+          else               rdata = rdata | ((u32) b << (8*i));
+        }
+        return rdata;
+      default:
+        return 0;
+    }
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+// HWICAP core (always shows ICAPEn and EOS, drops bitstream words when CR starts the write) and 250SOC mailbox
+// --------------------------------------------------------------------------------------------------------
+static int emu_icap_write(u32 addr, u32 wdata)
+{ switch (addr)
+    { case FA_ICAP_CR:
+        if (wdata & 0x08) emu.icap_rfo = 0;             // Reset
+        if (wdata & 0x02) emu.icap_rfo = emu.icap_sz;   // Read: FPGA IDCODE words appear in the read FIFO
+        if (wdata & 0x09) emu.icap_wf_cnt = 0;          // Write (or reset) empties the write FIFO
+        emu.icap_cr = 0;                                // Write / read complete at once
+        break;
+      case FA_ICAP_SZ: emu.icap_sz = wdata; break;
+      case FA_ICAP_WF:
+        if (emu.icap_wf_cnt == EMU_ICAP_WF_DEPTH) {
+          emu.n_slverr++;
+          return FA_WR_RESP_SLVERR;
+        }
+        emu.icap_wf_cnt++;
+        break;
+      default:         break;
+    }
+  return FA_WR_RESP_OK;
+}
+
+static u32 emu_icap_read(u32 addr)
+{ switch (addr)
+    { case FA_ICAP_SR : return 0x00000005;              // ICAPEn, EOS
+      case FA_ICAP_CR : return emu.icap_cr;
+      case FA_ICAP_WFV: return EMU_ICAP_WF_DEPTH - emu.icap_wf_cnt;
+      case FA_ICAP_RFO: return emu.icap_rfo;
+      case FA_ICAP_RF : if (emu.icap_rfo > 0) emu.icap_rfo--; return 0x14b79093;   // VU37P
+      default:          return 0;
+    }
+}
+
+static u32 emu_mailbox(u32 addr, u32 wdata, int wr)   // 250SOC: host writes a page to the ZynqMP through a mailbox
+{ u32 *p = &emu.mailbox[(addr / 4) % 2048];
+  if (!wr) return *p;
+  *p = wdata;
+  if (addr == 0x1000 && wdata == 0x00000001) *p = 0;  // Firmware takes the page at once
+  return 0;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+// AXI4-Lite bridge behind CFG_FLASH_ADDR / CFG_FLASH_DATA
+// --------------------------------------------------------------------------------------------------------
+static u32 emu_devstat(void)   // Device status signals, read live into CFG_FLASH_ADDR[27:24]
+{ u32 status = DEVSTAT_EOS;
+  if ((emu.dgier & 0x80000000) && (emu.ipisr & emu.ipier)) status = status | DEVSTAT_QSPI_INTERRUPT;
+  return status;
+}
+
+static void emu_axi(u32 fa)
+{ u32 devsel  = fa & 0x0000C000;
+  u32 addr    = fa & 0x00003FFF;
+  int exp_on  = (fa & FA_EXP_ON)   != 0;
+  int dir3210 = (fa & FA_EXP_3210) != 0;
+  int resp    = 0;
+
+  if (fa & FA_WR) {
+    emu.n_axi_wr++;
+    if (emu.n_axi_wr == emu.wr_fail) {
+      emu.n_slverr++;
+      resp = FA_WR_RESP_SLVERR;
+    }
+    else if (emu.subsys == 0x066A && devsel == FA_QSPI) resp = emu_mailbox(addr, emu.cfg[CFG_FLASH_DATA/4], 1);
+    else if (devsel == FA_QSPI) resp = emu_qspi_write(addr, emu.cfg[CFG_FLASH_DATA/4], exp_on, dir3210);
+    else                        resp = emu_icap_write(addr, emu.cfg[CFG_FLASH_DATA/4]);
+  } else if (fa & FA_RD) {
+    emu.n_axi_rd++;
+    if (emu.subsys == 0x066A && devsel == FA_QSPI) emu.cfg[CFG_FLASH_DATA/4] = emu_mailbox(addr, 0, 0);
+    else if (devsel == FA_QSPI) emu.cfg[CFG_FLASH_DATA/4] = emu_qspi_read(addr, exp_on, dir3210, &resp);
+    else                        emu.cfg[CFG_FLASH_DATA/4] = emu_icap_read(addr);
+  }
+
+  emu.cfg[CFG_FLASH_ADDR/4] = (fa & 0x000FFFFF & ~(FA_WR | FA_RD)) | resp;
+  emu.strobe_pending = emu.axi_busy;
+  emu.strobe = fa & (FA_WR | FA_RD);
+  return;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+// Backend functions
+// --------------------------------------------------------------------------------------------------------
+static int emu_open(char *cfgbdf, char *args)
+{ char path[1024], path2[1100];
+  char val[64];
+  (void) cfgbdf;                                                   // There is no card to find
+
+  memset(&emu, 0, sizeof(emu));
+  emu.subsys     = cfg_backend_arg_num(args, "subsys", 0x0666);
+  emu.fifo_depth = cfg_backend_arg_num(args, "fifo", 16);
+  emu.flash_size = cfg_backend_arg_num(args, "size", 128 << 20);
+  emu.spi_rate   = cfg_backend_arg_num(args, "spi", 0);
+  emu.quad       = cfg_backend_arg(args, "quad", val, sizeof(val));
+  emu.nosfdp     = cfg_backend_arg(args, "nosfdp", val, sizeof(val));
+  emu.axi_busy   = cfg_backend_arg_num(args, "axi_busy", 0);
+  emu.wr_fail    = cfg_backend_arg_num(args, "wr_fail", 0);
+  emu.stats      = cfg_backend_arg(args, "stats", val, sizeof(val));
+  emu.tscale     = cfg_backend_arg(args, "tscale", val, sizeof(val)) ? atof(val) : 1.0;
+
+  if (emu.fifo_depth != 16 && emu.fifo_depth != 256) {
+    printf("emu: fifo must be 16 or 256\n");
+    return -1;
+  }
+  if (emu.flash_size < 0x10000 || (emu.flash_size & (emu.flash_size - 1)) != 0) {
+    printf("emu: size must be a power of 2, 64K or more\n");
+    return -1;
+  }
+  if (cfg_backend_arg(args, "flash", path, sizeof(path))) {
+    snprintf(path2, sizeof(path2), "%s.dev2", path);
+    if (emu_flash_open(&emu.dev[0], path) != 0 || emu_flash_open(&emu.dev[1], path2) != 0) return -1;
+  } else {
+    if (emu_flash_open(&emu.dev[0], NULL) != 0 || emu_flash_open(&emu.dev[1], NULL) != 0) return -1;
+  }
+
+  emu.cfg[CFG_DEVID/4]  = 0x062B1014;
+  emu.cfg[CFG_SUBSYS/4] = (emu.subsys << 16) | 0x1014;
+  emu.cfg[CFG_FLASH_ADDR/4] = DEVSTAT_EOS;
+  emu_qspi_reset();
+  return 0;
+}
+
+static int emu_read32(u32 addr, u32 *rdata, char *s)
+{ (void) s;
+  emu.n_cfg_rd++;
+  emu_qspi_run();
+  if (addr >= sizeof(emu.cfg) || (addr & 3) != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  *rdata = emu.cfg[addr/4];
+  if (addr == CFG_FLASH_ADDR)
+    *rdata = *rdata | emu_devstat();
+  if (addr == CFG_FLASH_ADDR && emu.strobe_pending > 0) {
+    emu.strobe_pending--;
+    *rdata = *rdata | emu.strobe;                                  // Still busy
+  }
+  if (addr == CFG_FLASH_DATA && emu.strobe_pending > 0)
+    *rdata = 0xDEADBEEF;                                           // Data not valid until the strobe drops
+  return 0;
+}
+
+static int emu_write(u32 addr, u32 wdata, int num_bytes, char *s)
+{ u32 mask = (num_bytes == 4) ? 0xFFFFFFFF : (1u << (8 * num_bytes)) - 1;
+  int shift = 8 * (addr & 3);
+  (void) s;
+
+  emu.n_cfg_wr++;
+  emu_qspi_run();
+  if (addr >= sizeof(emu.cfg) || (addr & 3) + num_bytes > 4) {
+    errno = EINVAL;
+    return -1;
+  }
+  emu.cfg[addr/4] = (emu.cfg[addr/4] & ~(mask << shift)) | ((wdata & mask) << shift);
+  if (addr == CFG_FLASH_ADDR && (wdata & (FA_WR | FA_RD)))
+    emu_axi(emu.cfg[addr/4]);
+  return 0;
+}
+
+static int emu_batch(cfg_batch_op *ops, int num_ops, char *s)
+{ int i;
+  for (i = 0; i < num_ops; i++) {
+    if (ops[i].op == CFG_OP_WR) {
+      if (emu_write(ops[i].addr, ops[i].wdata, ops[i].num_bytes, s) != 0) return -1;
+    } else {
+      if (emu_read32(ops[i].addr, &ops[i].rdata[0], s) != 0) return -1;
+      if (ops[i].num_bytes == 8 && emu_read32(ops[i].addr + 4, &ops[i].rdata[1], s) != 0) return -1;
+    }
+  }
+  return 0;
+}
+
+static void emu_close(void)
+{ if (emu.active != NULL) emu_flash_deselect(emu.active);
+  if (emu.stats) {
+    printf("emu: config reads %ld, config writes %ld, AXI reads %ld, AXI writes %ld, AXI slave errors %ld\n",
+           emu.n_cfg_rd, emu.n_cfg_wr, emu.n_axi_rd, emu.n_axi_wr, emu.n_slverr);
+    printf("emu: SPI bytes %ld (%ld clocks), FLASH transactions %ld, page programs %ld, erases %ld\n",
+           emu.n_spi_bytes, emu.n_spi_clocks, emu.n_xact, emu.n_program, emu.n_erase);
+  }
+  emu_flash_close(&emu.dev[0]);
+  emu_flash_close(&emu.dev[1]);
+  return;
+}
+
+cfg_backend CFG_BACKEND_EMU = {
+  "emu", "In-process card emulator [subsys=,fifo=,size=,flash=<file>,spi=,quad,nosfdp,axi_busy=,tscale=,stats]",
+  emu_open, emu_read32, emu_write, emu_batch, emu_close, 1
+};
+
+
+#endif
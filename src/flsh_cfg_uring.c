@@ -0,0 +1,270 @@
+#ifndef FLSH_CFG_URING_C_
+#define FLSH_CFG_URING_C_
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// --------------------------------------------------------------------------------------------------------
+// uring backend: sysfs config space file, with batches submitted through io_uring
+// - Each config_batch() becomes a chain of linked READ / WRITE SQEs (IOSQE_IO_LINK), so the kernel performs
+//   them in order, and the chain is submitted and reaped with a single io_uring_enter() system call.
+//   An axi_write (FLASH_DATA write, FLASH_ADDR write, FLASH_ADDR read) or a queued DTR FIFO fill then costs
+//   one system call instead of one per config access.
+// - Single reads and writes gain nothing from the ring and use pread / pwrite.
+// - Uses the system calls directly (no liburing). If the kernel or headers lack io_uring, or the kernel
+//   does not support IORING_OP_READ / IORING_OP_WRITE (before 5.6), batches fall back to pread / pwrite.
+// - Options (--backend uring:<key>=<value>,...):
+//     path=<file>     Use <file> instead of /sys/bus/pci/devices/<bdf>/config, e.g. a regular file
+//     entries=<n>     Ring size (default 256, enough for a 256 byte DTR FIFO fill)
+//     stats           Print submission counts when the backend is closed
+// --------------------------------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+  #if __has_include(<linux/io_uring.h>)
+    #include <linux/io_uring.h>
+    #define URING_AVAILABLE 1
+  #endif
+#endif
+
+#include "flsh_common_defs.h"
+#include "flsh_global_vars.h"
+#include "flsh_cfg_backend.h"
+
+static struct {
+  int    fd;                    // Config space file
+  int    ring_fd;               // -1 when batches use pread / pwrite
+  u32    entries;
+  long   n_enter;               // io_uring_enter() calls
+  long   n_sqe;                 // SQEs submitted
+  long   n_fallback;            // Batches done with pread / pwrite
+  int    stats;
+#ifdef URING_AVAILABLE
+  // Submission queue
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  struct io_uring_sqe *sqes;
+  // Completion queue
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+  // Mappings, for close
+  void  *sq_ptr, *cq_ptr;
+  size_t sq_len, cq_len, sqes_len;
+#endif
+} UR;
+
+
+// --------------------------------------------------------------------------------------------------------
+static int ur_batch_pio(cfg_batch_op *ops, int num_ops)   // Batch with one pread / pwrite per access
+{ int i;
+  UR.n_fallback++;
+  for (i = 0; i < num_ops; i++) {
+    if (ops[i].op == CFG_OP_WR) {
+      if (pwrite(UR.fd, &ops[i].wdata, ops[i].num_bytes, ops[i].addr) != ops[i].num_bytes) return -1;
+    } else {
+      if (pread(UR.fd, ops[i].rdata, ops[i].num_bytes, ops[i].addr) != ops[i].num_bytes) return -1;
+    }
+  }
+  return 0;
+}
+
+
+#ifdef URING_AVAILABLE
+// --------------------------------------------------------------------------------------------------------
+static int ur_setup(u32 entries)   // Create the ring and map its queues, returns -1 if io_uring can not be used
+{ struct io_uring_params p;
+
+  memset(&p, 0, sizeof(p));
+  UR.ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (UR.ring_fd < 0) return -1;
+
+  UR.sq_len   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  UR.cq_len   = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+  UR.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (UR.cq_len > UR.sq_len) UR.sq_len = UR.cq_len;
+    UR.cq_len = UR.sq_len;
+  }
+  UR.sq_ptr = mmap(NULL, UR.sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, UR.ring_fd, IORING_OFF_SQ_RING);
+  if (UR.sq_ptr == MAP_FAILED) goto fail;
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    UR.cq_ptr = UR.sq_ptr;
+  else
+    UR.cq_ptr = mmap(NULL, UR.cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, UR.ring_fd, IORING_OFF_CQ_RING);
+  if (UR.cq_ptr == MAP_FAILED) goto fail;
+  UR.sqes = mmap(NULL, UR.sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, UR.ring_fd, IORING_OFF_SQES);
+  if (UR.sqes == MAP_FAILED) goto fail;
+
+  UR.sq_head  = (unsigned *) ((char *) UR.sq_ptr + p.sq_off.head);
+  UR.sq_tail  = (unsigned *) ((char *) UR.sq_ptr + p.sq_off.tail);
+  UR.sq_mask  = (unsigned *) ((char *) UR.sq_ptr + p.sq_off.ring_mask);
+  UR.sq_array = (unsigned *) ((char *) UR.sq_ptr + p.sq_off.array);
+  UR.cq_head  = (unsigned *) ((char *) UR.cq_ptr + p.cq_off.head);
+  UR.cq_tail  = (unsigned *) ((char *) UR.cq_ptr + p.cq_off.tail);
+  UR.cq_mask  = (unsigned *) ((char *) UR.cq_ptr + p.cq_off.ring_mask);
+  UR.cqes     = (struct io_uring_cqe *) ((char *) UR.cq_ptr + p.cq_off.cqes);
+  UR.entries  = p.sq_entries;
+  return 0;
+
+fail:
+  close(UR.ring_fd);
+  UR.ring_fd = -1;
+  return -1;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+static int ur_submit_chain(cfg_batch_op *ops, int num_ops)   // Submit ops as one linked chain and wait for all completions
+{ unsigned tail, head;
+  struct io_uring_sqe *sqe;
+  struct io_uring_cqe *cqe;
+  int i, rc = 0, unsupported = 0, done;
+
+  tail = *UR.sq_tail;
+  for (i = 0; i < num_ops; i++) {
+    sqe = &UR.sqes[tail & *UR.sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = (ops[i].op == CFG_OP_WR) ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd        = UR.fd;
+    sqe->off       = ops[i].addr;
+    sqe->addr      = (unsigned long) ((ops[i].op == CFG_OP_WR) ? &ops[i].wdata : ops[i].rdata);
+    sqe->len       = ops[i].num_bytes;
+    sqe->flags     = (i < num_ops - 1) ? IOSQE_IO_LINK : 0;   // Each access starts only after the previous one completed
+    sqe->user_data = i;
+    UR.sq_array[tail & *UR.sq_mask] = tail & *UR.sq_mask;
+    tail++;
+  }
+  __atomic_store_n(UR.sq_tail, tail, __ATOMIC_RELEASE);
+
+  if (syscall(__NR_io_uring_enter, UR.ring_fd, num_ops, num_ops, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+    if (errno != EINTR) return -1;
+  }
+  UR.n_enter++;
+  UR.n_sqe += num_ops;
+
+  // Reap: every SQE of the chain posts a completion, the ones after a failure complete with -ECANCELED
+  done = 0;
+  while (done < num_ops) {
+    head = *UR.cq_head;
+    if (head == __atomic_load_n(UR.cq_tail, __ATOMIC_ACQUIRE)) {
+      if (syscall(__NR_io_uring_enter, UR.ring_fd, 0, num_ops - done, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+        return -1;
+      continue;
+    }
+    cqe = &UR.cqes[head & *UR.cq_mask];
+    i   = (int) cqe->user_data;
+    if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) unsupported = 1;
+    if (cqe->res != ops[i].num_bytes && rc == 0) {
+      errno = (cqe->res < 0) ? -cqe->res : EIO;
+      rc = -1;
+    }
+    __atomic_store_n(UR.cq_head, head + 1, __ATOMIC_RELEASE);
+    done++;
+  }
+  return unsupported ? -2 : rc;
+}
+#endif
+
+
+// --------------------------------------------------------------------------------------------------------
+static int ur_open(char *cfgbdf, char *args)
+{ char cfg_file[1024], val[16];
+
+  if (!cfg_backend_arg(args, "path", cfg_file, sizeof(cfg_file)))
+    snprintf(cfg_file, sizeof(cfg_file), "/sys/bus/pci/devices/%s/config", cfgbdf);
+  if ((UR.fd = open(cfg_file, O_RDWR)) < 0) {
+    printf("Can not open %s\n", cfg_file);
+    return -1;
+  }
+  CFG_FD   = UR.fd;
+  UR.stats = cfg_backend_arg(args, "stats", val, sizeof(val));
+  UR.ring_fd = -1;
+#ifdef URING_AVAILABLE
+  if (ur_setup(cfg_backend_arg_num(args, "entries", 256)) != 0)
+    printf("uring: io_uring not available (%s), using pread/pwrite\n", strerror(errno));
+#else
+  printf("uring: built without io_uring support, using pread/pwrite\n");
+#endif
+  return 0;
+}
+
+static int ur_read32(u32 addr, u32 *rdata, char *s)
+{ (void) s;
+  return (pread(UR.fd, rdata, 4, addr) == 4) ? 0 : -1;
+}
+
+static int ur_write(u32 addr, u32 wdata, int num_bytes, char *s)
+{ (void) s;
+  return (pwrite(UR.fd, &wdata, num_bytes, addr) == num_bytes) ? 0 : -1;
+}
+
+static int ur_batch(cfg_batch_op *ops, int num_ops, char *s)
+{ (void) s;
+#ifdef URING_AVAILABLE
+  int n, rc;
+  if (UR.ring_fd >= 0 && num_ops > 1) {
+    while (num_ops > 0) {
+      n  = (num_ops > (int) UR.entries) ? (int) UR.entries : num_ops;
+      rc = ur_submit_chain(ops, n);
+      if (rc == -2) {
+        // Kernel has io_uring but not READ / WRITE, nothing of this chain was done. Stop using the ring.
+        printf("uring: kernel does not support IORING_OP_READ/WRITE, using pread/pwrite\n");
+        close(UR.ring_fd);
+        UR.ring_fd = -1;
+        return ur_batch_pio(ops, num_ops);
+      }
+      if (rc != 0) return -1;
+      ops     = ops + n;
+      num_ops = num_ops - n;
+    }
+    return 0;
+  }
+#endif
+  return ur_batch_pio(ops, num_ops);
+}
+
+static void ur_close(void)
+{
+#ifdef URING_AVAILABLE
+  if (UR.ring_fd >= 0) {
+    munmap(UR.sqes, UR.sqes_len);
+    if (UR.cq_ptr != UR.sq_ptr) munmap(UR.cq_ptr, UR.cq_len);
+    munmap(UR.sq_ptr, UR.sq_len);
+    close(UR.ring_fd);
+  }
+#endif
+  if (UR.stats)
+    printf("uring: %ld io_uring_enter calls for %ld SQEs, %ld batches with pread/pwrite\n", UR.n_enter, UR.n_sqe, UR.n_fallback);
+  close(UR.fd);
+  return;
+}
+
+cfg_backend CFG_BACKEND_URING = {
+  "uring", "sysfs config space, batches as linked io_uring chains [path=<file>,entries=,stats]",
+  ur_open, ur_read32, ur_write, ur_batch, ur_close, 1
+};
+
+
+#endif
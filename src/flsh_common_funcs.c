@@ -21,26 +21,63 @@
 #include <string.h>
 #include <stdlib.h>
 
-// For lseek, read, write
 #include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
 
 #include "flsh_common_defs.h"
 #include "flsh_global_vars.h"
+#include "flsh_cfg_backend.h"
+#include "flsh_poll.h"
+#include "flsh_sfdp.h"
 #include "flsh_common_funcs.h"
+#include "flsh_trace.h"
 
 // Provide cross references to System Verilog tasks for Incisive simulation of C code
 #ifdef USE_SIM_TO_TEST
   #include "svdpi.h"
-  extern void CFG_WR_C(unsigned int, unsigned int, unsigned int, const char*);
-  extern void CFG_RD_C(unsigned int, unsigned int*, const char*);
   extern void WORKAROUND_FORCE_DQ(unsigned int);
   extern void WORKAROUND_RELEASE_DQ(unsigned int);
 #endif
 
 static int GlobalEOS = 0;
 
+// Device status in CFG_FLASH_ADDR[27:24], see axi_wait_devstat()
+static u32 DEVSTAT_MASK = U32_ZERO;     // Status bits used as completion signals rather than errors (QSPI interrupt while DTR Empty is enabled)
+static u32 DEVSTAT_LAST = U32_ZERO;     // FLASH_ADDR as seen by the last AXI operation or device status poll
+
+// Posted AXI writes, see axi_write_post()
+#define AXI_PW_MAX 1024                 // Longest run between fences: an ICAP write FIFO burst, or a DTR FIFO fill of single bytes
+static struct {
+  int          num;                     // Number of writes posted since the last fence
+  u32          devsel[AXI_PW_MAX], addr[AXI_PW_MAX], exp_enab[AXI_PW_MAX], exp_dir[AXI_PW_MAX], wdata[AXI_PW_MAX];
+  char        *s[AXI_PW_MAX];           // Comment of each write, for error messages
+  int          readback[AXI_PW_MAX];    // 1 if FLASH_ADDR is read right after the write, in runs the fill level can't check
+  u32          read_FA[AXI_PW_MAX];     // FLASH_ADDR read back after the write (when 'readback')
+  cfg_batch_op ops[3*AXI_PW_MAX+1];     // Config accesses of the run (batching backends), plus the FLASH_ADDR read of the fence
+  int          num_ops;                 // Entries used in 'ops'
+  u32          icap_wf_depth;           // Vacancy of the empty ICAP write FIFO, 0 until learned
+  int          dtr_counted;             // 1 while flash_cmd() counts the SPIDTR writes of a refill in the DRR, see there
+} AXI_PW;
+
+// Shadow of the QSPI and ICAP control registers, see axi_write()
+typedef struct {
+  u32          devsel, addr;
+  u32          selfclr;                 // Bits that act when written with 1 and clear themselves, never held in the shadow
+  u32          reset;                   // Value after a core reset (SRR for QSPI)
+  u32          value;                   // Register contents, when valid
+  int          valid;                   // 0 = contents unknown, the next write goes to the core
+} axi_shadow_reg;
+
+static axi_shadow_reg AXI_SHADOW[] = {
+  { FA_QSPI, FA_QSPI_SPICR , 0x00000060, 0x00000180, 0, 0 },   // [6:5] RX/TX FIFO reset are cleared one clock after the write
+  { FA_QSPI, FA_QSPI_SPISSR, 0x00000000, 0xFFFFFFFF, 0, 0 },
+  { FA_QSPI, FA_QSPI_DGIER , 0x00000000, 0x00000000, 0, 0 },
+  { FA_QSPI, FA_QSPI_IPIER , 0x00000000, 0x00000000, 0, 0 },
+  { FA_ICAP, FA_ICAP_SZ    , 0x00000000, 0x00000000, 0, 0 },
+};
+#define AXI_SHADOW_NUM ((int) (sizeof(AXI_SHADOW) / sizeof(AXI_SHADOW[0])))
+
 // --------------------------------------------------------------------------------------------------------
 // Configuration register operations
 // - String is used to describe the purpose of the operation when tracing is enabled. Fill with NULL if unused.
@@ -51,8 +88,7 @@ void config_write(                    // Host issues 'config_write' instruction
                  , char *s)           //   String to add to trace print message, identifying more about this instance of invocation. Set to NULL if unused.
 { int rc;
 
-  if (TRC_CONFIG == TRC_ON)
-    printf("trace      config_write  addr h%8x, wdata h%8x, num_bytes %1d, <%s>\n", addr, wdata, num_bytes, s);
+  trace_record(TRC_EV_CONFIG_WR, 0, addr, wdata, num_bytes, s);
 
   if (!(num_bytes == 1 || num_bytes == 2 || num_bytes == 4)) {
     printf("*** ERROR in config_write(), num_bytes must be 1, 2, or 4 ***: addr h%8x, wdata h%8x, num_bytes %d, <%s>\n", addr, wdata, num_bytes, s);
@@ -61,74 +97,14 @@ void config_write(                    // Host issues 'config_write' instruction
     return;  // Abort operation
   };
 
-#ifdef USE_SIM_TO_TEST
-  // For simulation
-  CFG_WR_C( addr, wdata, num_bytes, s);
-
-  // To prevent warnings, assign and use 'rc'
-  rc = 0;
-  if (rc == 1) printf("WARNING: config_read rc=1, shouldn't happen\n");
-#elif defined USE_CRONUS_ACCESS
-  char command1[1024];
-  char command2[1024];
-  char writedatastr[64] = "";
-  char writedatastr2[64] = "";
-  strcpy(command1, "putmemproc -ci 60302016E0000 80000");
-
-  strcat(command1, addr);
-  strcat(command1, "00000000");
-  strcpy(command2, "putmemproc -ci 60302016E0080 ");
-  //printf("%s\n",command1);
-  system(command1);
-  if(num_bytes == 1) {
-    sprintf(writedatastr, "%08x", wdata);
-    writedatastr2[0] = writedatastr[6];
-    writedatastr2[1] = writedatastr[7];
-    strcat(command2, writedatastr2);
-    //printf("%s\n",command2);
-    system(command2);
-  }
-  else if(num_bytes == 2) {
-    sprintf(writedatastr, "%08x", wdata);
-    writedatastr2[0] = writedatastr[6];
-    writedatastr2[1] = writedatastr[7];
-    writedatastr2[2] = writedatastr[4];
-    writedatastr2[3] = writedatastr[5];
-    strcat(command2, writedatastr2);
-    //printf("%s\n",command2);
-    system(command2);
-  }
-  else {
-    sprintf(writedatastr, "%08x", wdata);
-    //Swap endianness
-    writedatastr2[0] = writedatastr[6];
-    writedatastr2[1] = writedatastr[7];
-    writedatastr2[2] = writedatastr[4];
-    writedatastr2[3] = writedatastr[5];
-    writedatastr2[4] = writedatastr[2];
-    writedatastr2[5] = writedatastr[3];
-    writedatastr2[6] = writedatastr[0];
-    writedatastr2[7] = writedatastr[1];
-    strcat(command2, writedatastr2);
-    //printf("%s\n",command2);
-    system(command2);
-  }
-#else
-  // For Linux running on real FPGA card
-  rc = lseek(CFG_FD, addr, SEEK_SET);   // Find register in config space
-  if (rc == -1) {
-    printf("*** ERROR in config_write(), lseek() ***: addr h%8x, wdata h%8x, num_bytes %1d, <%s>\n", addr, wdata, num_bytes, s);
+  // Hand off to the config space backend selected with --backend (sysfs file, Cronus, simulation, emulator)
+  rc = CFG_BACKEND->write(addr, wdata, num_bytes, s);
+  CONFIG_OP_COUNT++;
+  if (rc != 0) {
+    printf("*** ERROR in config_write(), backend %s ***: addr h%8x, wdata h%8x, num_bytes %1d, <%s>\n", CFG_BACKEND->name, addr, wdata, num_bytes, s);
     perror("  ");   // Print meaning of the error placed in errno
     ERRORS_DETECTED++;
   };
-  write(CFG_FD, &wdata, num_bytes);     // Write bytes
-  if (rc != num_bytes) {
-    //printf("*** ERROR in config_write(), write() ***: addr h%8x, wdata h%8x, num_bytes %1d, <%s>\n", addr, wdata, num_bytes, s);
-    //printf("  number of bytes written, which should be %1d, = %d\n", num_bytes, rc);
-    //perror("  errno (if it exists) = ");   // Print meaning of the error placed in errno
-    //ERRORS_DETECTED++;
-  };
-#endif
 
   return;
 }
@@ -140,79 +116,85 @@ u32  config_read(                     // Host issues 'config_read' instruction o
                   u32 addr            //   Always reads 4 bytes
                 , char *s)            //   String to add to trace print message, identifying more about this instance of invocation. Set to NULL if unused.
 { int rc;
-  u32 rdata;
+  u32 rdata = 0;
 
-#ifdef USE_SIM_TO_TEST
-  // For simulation
-  CFG_RD_C(addr, &rdata, s);
-
-  // To prevent warnings, assign and use 'rc'
-  rc = 0;
-  if (rc == 1) printf("WARNING: config_read rc=1, shouldn't happen\n");
-#elif defined USE_CRONUS_ACCESS
-  char  addr_offset_string[3];
-  char buf[3];
-  char command1[1024];
-  char command2[1024];
-  char outputjunkbuffer[1024];
-  char readdatastr[1024] = "";
-  char readdatastr2[1024] = "";
-  strcpy(command1, "putmemproc -ci 60302016E0000 80000");
-
-  strcat(command1, addr);
-  strcat(command1, "00000000");
-  strcpy(command2, "getmemproc -ci 60302016E0080 4");
-  //printf("%s\n",command1);
-  system(command1);
-  //printf("%s\n",command2);
-  FILE *memprocout = popen(command2,"r");
-  if (!memprocout) {
-    exit(-1);
-  }
-  char *getmemline = fgets(outputjunkbuffer,sizeof(outputjunkbuffer),memprocout);
-  //toss out first line. relevant cronus output on second line from console.
-  fgets(outputjunkbuffer,sizeof(outputjunkbuffer),memprocout);
-  //grab portion of string that is relevant
-  memcpy(readdatastr,&outputjunkbuffer[18],8);
-  pclose(memprocout);
-  //Swap endianness
-  readdatastr2[0] = readdatastr[6];
-  readdatastr2[1] = readdatastr[7];
-  readdatastr2[2] = readdatastr[4];
-  readdatastr2[3] = readdatastr[5];
-  readdatastr2[4] = readdatastr[2];
-  readdatastr2[5] = readdatastr[3];
-  readdatastr2[6] = readdatastr[0];
-  readdatastr2[7] = readdatastr[1];
-  //printf("I got %s as config read data!\n", readdatastr);
-  char *nextptr;
-  rdata = strtoul(readdatastr2,&nextptr,16);
-  //printf("I got %08x as config read data!\n", rdata);
-#else
-  // For Linux running on real FPGA card
-  rc = lseek(CFG_FD, addr, SEEK_SET);   // Find register in config space
-  if (rc == -1) {
-    printf("*** ERROR in config_read(), lseek() ***: addr h%8x, <%s>\n", addr, s);
+  // Hand off to the config space backend selected with --backend (sysfs file, Cronus, simulation, emulator)
+  rc = CFG_BACKEND->read32(addr, &rdata, s);
+  CONFIG_OP_COUNT++;
+  if (rc != 0) {
+    printf("*** ERROR in config_read(), backend %s ***: addr h%8x, <%s>\n", CFG_BACKEND->name, addr, s);
     perror("  ");   // Print meaning of the error placed in errno
     ERRORS_DETECTED++;
   };
-  read(CFG_FD, &rdata, 4);              // Always read 4 bytes
-  if (rc != 4) {
-    //printf("*** ERROR in config_read(), read() ***: addr h%8x, rdata h%8x, <%s>\n", addr, rdata, s);
-    //printf("  number of bytes read, which should be 4, = %d\n", rc);
-    //perror("  errno (if it exists) = ");   // Print meaning of the error placed in errno
-    //ERRORS_DETECTED++;
-  };
-#endif
 
-  if (TRC_CONFIG == TRC_ON)
-    printf("trace      config_read   addr h%8x, rdata h%8x,              <%s>\n", addr, rdata, s);
+  trace_record(TRC_EV_CONFIG_RD, 0, addr, rdata, 0, s);
 
   return (rdata);
 }
 
 
 
+// --------------------------------------------------------------------------------------------------------
+void config_batch(                    // Perform a list of config reads and writes in order, as one backend call when the backend supports it
+                   cfg_batch_op *ops  //   Accesses to perform. Read data is returned through each entry's 'rdata' pointer.
+                 , int num_ops        //   Number of entries in 'ops'
+                 , char *s)           //   String to add to trace print message, identifying more about this instance of invocation. Set to NULL if unused.
+{ int rc, i;
+
+  if (CFG_BACKEND->batch == NULL) {
+    // Backend has no batching, fall back to single accesses (8 byte reads become two 4 byte reads)
+    for (i = 0; i < num_ops; i++) {
+      if (ops[i].op == CFG_OP_WR) {
+        config_write(ops[i].addr, ops[i].wdata, ops[i].num_bytes, s);
+      } else {
+        ops[i].rdata[0] = config_read(ops[i].addr, s);
+        if (ops[i].num_bytes == 8) ops[i].rdata[1] = config_read(ops[i].addr + 4, s);
+      }
+    }
+    return;
+  }
+
+  rc = CFG_BACKEND->batch(ops, num_ops, s);
+  CONFIG_OP_COUNT += num_ops;
+  if (rc != 0) {
+    printf("*** ERROR in config_batch(), backend %s ***: %d ops starting at addr h%8x, <%s>\n", CFG_BACKEND->name, num_ops, ops[0].addr, s);
+    perror("  ");   // Print meaning of the error placed in errno
+    ERRORS_DETECTED++;
+  };
+
+  for (i = 0; i < num_ops; i++) {
+    if (ops[i].op == CFG_OP_WR)
+      trace_record(TRC_EV_CONFIG_WR , 0, ops[i].addr, ops[i].wdata, ops[i].num_bytes, s);
+    else if (ops[i].num_bytes == 8)
+      trace_record(TRC_EV_CONFIG_RD2, 0, ops[i].addr, ops[i].rdata[0], ops[i].rdata[1], s);
+    else
+      trace_record(TRC_EV_CONFIG_RD , 0, ops[i].addr, ops[i].rdata[0], 0, s);
+  }
+  return;
+}
+
+
+
+// --------------------------------------------------------------------------------------------------------
+void config_read_pair(                  // Read two adjacent 4 byte config registers (addr, addr+4) in one access where possible
+                       u32 addr         //   Configuration register address of the first register
+                     , u32 *rdata_lo    //   Returns contents of register at addr
+                     , u32 *rdata_hi    //   Returns contents of register at addr+4
+                     , char *s)         //   String to add to trace print message, identifying more about this instance of invocation. Set to NULL if unused.
+{ u32 rdata[2] = { 0, 0 };
+  cfg_batch_op op = { CFG_OP_RD, addr, 0, 8, rdata };
+
+  // On sysfs this is one 8 byte positional read. The kernel splits it into aligned dword config reads in
+  // ascending address order, so the register at 'addr' is sampled before the register at 'addr+4'.
+  config_batch(&op, 1, s);
+
+  *rdata_lo = rdata[0];
+  *rdata_hi = rdata[1];
+  return;
+}
+
+
+
 // --------------------------------------------------------------------------------------------------------
 // Combine values to create the value to load into the CFG_FLASH_ADDR field
 u32  form_FLASH_ADDR(                 // Assemble fields into value to load into CFG_FLASH_ADDR register
@@ -343,6 +325,66 @@ char* axi_addr_as_str(                   // Convert slave address to register na
 }
 
 
+// --------------------------------------------------------------------------------------------------------
+// Describe an AXI operation for error messages. Formatting is left to the error path, the good path only records a trace event.
+static char* axi_call_args(                  // Returns 'call_args'
+                            char *call_args  //   Buffer to fill
+                          , int len          //   Size of the buffer
+                          , int rd           //   1 for axi_read (no write data)
+                          , u32 axi_devsel, u32 axi_addr, u32 exp_enab, u32 exp_dir, u32 axi_wdata
+                          , const char *s)
+{ if (rd)
+    snprintf(call_args, len, "devsel %s, addr %s (h%8.8X),                  exp_enab %s, exp_dir %s, <%s>",
+             axi_devsel_as_str(axi_devsel), axi_addr_as_str(axi_devsel,axi_addr), axi_addr, exp_enab_as_str(exp_enab), exp_dir_as_str(exp_dir), s);
+  else
+    snprintf(call_args, len, "devsel %s, addr %s (h%8.8X), wdata h%8.8x, exp_enab %s, exp_dir %s, <%s>",
+             axi_devsel_as_str(axi_devsel), axi_addr_as_str(axi_devsel,axi_addr), axi_addr, axi_wdata, exp_enab_as_str(exp_enab), exp_dir_as_str(exp_dir), s);
+  return call_args;
+}
+
+// Device status as check_axi_status(rdata, DEVSTAT_MASK, ...) accepts it without a message
+#define AXI_STATUS_CLEAN(rdata)  (((rdata) & ~DEVSTAT_MASK & (DEVSTAT_QSPI_INTERRUPT | DEVSTAT_ICAP_INTERRUPT | DEVSTAT_PREQ)) == U32_ZERO && \
+                                  (((rdata) & DEVSTAT_EOS) == DEVSTAT_EOS || GlobalEOS != 0))
+
+
+
+// --------------------------------------------------------------------------------------------------------
+// Control register shadow
+// - axi_write() keeps a copy of what it wrote to the registers in AXI_SHADOW (axi_read() refreshes it) and drops a
+//   write that would store the value the register already holds, like SPICR=h106 right after SPICR=h166 whose FIFO
+//   reset bits have already cleared themselves. Writes with self clearing bits set always go to the core.
+// - The shadow of a core is invalidated when the core is reset behind axi_write()'s back (QSPI_setup, reset_ICAP),
+//   and an entry when a write to it fails or is posted. A QSPI SRR write loads the documented reset values.
+// --------------------------------------------------------------------------------------------------------
+static axi_shadow_reg *axi_shadow_find(u32 axi_devsel, u32 axi_addr)
+{ int i;
+  for (i = 0; i < AXI_SHADOW_NUM; i++)
+    if (AXI_SHADOW[i].devsel == axi_devsel && AXI_SHADOW[i].addr == axi_addr) return &AXI_SHADOW[i];
+  return NULL;
+}
+
+void axi_shadow_invalidate(u32 axi_devsel)   // Forget the shadowed registers of one core (FA_QSPI or FA_ICAP)
+{ int i;
+  for (i = 0; i < AXI_SHADOW_NUM; i++)
+    if (AXI_SHADOW[i].devsel == axi_devsel) AXI_SHADOW[i].valid = 0;
+}
+
+static void axi_shadow_load_reset(u32 axi_devsel)
+{ int i;
+  for (i = 0; i < AXI_SHADOW_NUM; i++)
+    if (AXI_SHADOW[i].devsel == axi_devsel) {
+      AXI_SHADOW[i].value = AXI_SHADOW[i].reset;
+      AXI_SHADOW[i].valid = 1;
+    }
+}
+
+static int axi_spi_inhibit(void)   // 1 while SPICR[8] (master transaction inhibit) is known to be set, the DTR FIFO is not drained
+{ axi_shadow_reg *r = axi_shadow_find(FA_QSPI, FA_QSPI_SPICR);
+  return r->valid && (r->value & 0x00000100) != 0;
+}
+
+
+
 // --------------------------------------------------------------------------------------------------------
 // This write is used for the reload once the specific sequence has been written and before a reset. No more read can then be done.
 void axi_write_no_check(                     // Initiate a write operation on the AXI4-Lite bus
@@ -354,19 +396,13 @@ void axi_write_no_check(                     // Initiate a write operation on th
               , char *s             //   Comment to be printed in trace message
               )
 {
-  char call_args[1024];
-  u32 read_FA;
-  u32 resp;
-  int saved_TRC_CONFIG;
-  char s_err[1024];
-  char s_devstat[1044];
- //int cnt ;
-  snprintf(call_args, sizeof(call_args),
-           "devsel %s, addr %s (h%8.8X), wdata h%8.8x, exp_enab %s, exp_dir %s, <%s>",
-           axi_devsel_as_str(axi_devsel), axi_addr_as_str(axi_devsel,axi_addr), axi_addr, axi_wdata, exp_enab_as_str(exp_enab), exp_dir_as_str(exp_dir), s);
+  axi_shadow_reg *r;
+
+  if (AXI_PW.num > 0) axi_fence("fence before the next AXI operation");   // Keep AXI operations in program order
+  if ((r = axi_shadow_find(axi_devsel, axi_addr)) != NULL) r->valid = 0;   // Not known to have landed
 
-  if (TRC_AXI == TRC_ON) printf("trace    axi_write     %s\n", call_args);
-  //printf("trace    axi_write     %s\n", call_args);
+  trace_record(TRC_EV_AXI_WR, axi_devsel, axi_addr, axi_wdata, exp_enab | exp_dir, s);
+  AXI_OP_COUNT++;
 
   // Step 1: config_write to FLASH_DATA, then FLASH_ADDR initiating AXI write
   config_write(CFG_FLASH_DATA, axi_wdata, 4, "axi_write - step 1a: store write data into FLASH_DATA register");
@@ -375,6 +411,67 @@ void axi_write_no_check(                     // Initiate a write operation on th
   return;
 }
 
+// --------------------------------------------------------------------------------------------------------
+void axi_write_check(               // Check response and device status of a completed AXI write (FLASH_ADDR read back after the Write Strobe dropped)
+                      u32 read_FA     //   FLASH_ADDR contents
+                    , u32 axi_devsel  //   AXI4-Lite slave that was the target of the write
+                    , u32 axi_addr    //   Target register within the selected core
+                    , u32 exp_enab    //   Byte expander enable and direction of the write, for error messages
+                    , u32 exp_dir
+                    , u32 axi_wdata   //   Data written, for error messages
+                    , char *s         //   Comment of the axi_write, for error messages
+                    )
+{
+  u32 resp;
+  char call_args[1024];
+  char s_err[1024];
+  char s_devstat[1044];
+
+  // Step 3: Check Write Response and Device Specific Status
+  resp = (read_FA & FA_WR_RESP_FIELD);
+  if (resp != FA_WR_RESP_OK) {
+    ERRORS_DETECTED++;
+    switch (resp)
+    { case FA_WR_RESP_OK     : sprintf(s_err,"SUCCESSFUL    "); break;
+      case FA_WR_RESP_RSVD   : sprintf(s_err,"RESERVED      "); break;
+      case FA_WR_RESP_SLVERR : sprintf(s_err,"SLAVE_ERROR   "); break;
+      case FA_WR_RESP_INVLD  : sprintf(s_err,"INVALID SELECT"); break;
+      default                : sprintf(s_err,"<UNKNOWN>     ");
+    }
+    printf("(axi_write): %s:  *** ERROR - detected bad response on axi_write of %s (h%8x) ***\n",
+           axi_call_args(call_args, sizeof(call_args), 0, axi_devsel, axi_addr, exp_enab, exp_dir, axi_wdata, s), s_err, resp);
+  }
+
+  // Check device status signals
+  // set GlobalEOS to 1 with Partial Reconfiguration to remove "eos bit unset" error message
+  if((axi_devsel == FA_ICAP ) && (axi_addr == FA_ICAP_CR)) GlobalEOS = 1;
+
+  if (!AXI_STATUS_CLEAN(read_FA)) {
+    snprintf(s_devstat, sizeof(s_devstat), "(axi_write): %s ",
+             axi_call_args(call_args, sizeof(call_args), 0, axi_devsel, axi_addr, exp_enab, exp_dir, axi_wdata, s));
+    check_axi_status(read_FA, DEVSTAT_MASK, s_devstat);
+  }
+
+  return;
+}
+
+
+
+// --------------------------------------------------------------------------------------------------------
+static void axi_strobe_timeout(     // A strobe in FLASH_ADDR that never drops means the card stopped responding: give up at once
+                                poll_wait *w
+                              , u32 read_FA
+                              , char *s
+                              )
+{
+  ERRORS_DETECTED++;
+  printf("\n(axi_strobe_timeout): <%s>:  *** ERROR - card not responding, FLASH_ADDR strobe still set after %ld us and %d polls (FLASH_ADDR h%8x) ***\n",
+         s, poll_elapsed_us(w), w->polls, read_FA);
+  Check_Accumulated_Errors();
+  exit(-1);
+}
+
+
 // --------------------------------------------------------------------------------------------------------
 void axi_write(                     // Initiate a write operation on the AXI4-Lite bus
                 u32 axi_devsel      //   Select AXI4-Lite slave that is target of operation
@@ -385,52 +482,322 @@ void axi_write(                     // Initiate a write operation on the AXI4-Li
               , char *s             //   Comment to be printed in trace message
               )
 {
-  char call_args[1024];
   u32 read_FA;
-  u32 resp;
   int saved_TRC_CONFIG;
-  char s_err[1024];
-  char s_devstat[1044];
-  snprintf(call_args, sizeof(call_args),
-	   "devsel %s, addr %s (h%8.8X), wdata h%8.8x, exp_enab %s, exp_dir %s, <%s>",
-	   axi_devsel_as_str(axi_devsel), axi_addr_as_str(axi_devsel,axi_addr), axi_addr, axi_wdata, exp_enab_as_str(exp_enab), exp_dir_as_str(exp_dir), s);
+  poll_wait w;
+  int errors_before;
+  cfg_batch_op chain[3];
+  axi_shadow_reg *r;
+
+  // Skip a write that leaves the register as it is
+  r = axi_shadow_find(axi_devsel, axi_addr);
+  if (r != NULL && r->valid && AXI_SHADOW_REGS == SHD_ON && (axi_wdata & r->selfclr) == 0 && axi_wdata == r->value) {
+    AXI_WRITES_SKIPPED++;
+    return;
+  }
 
-  if (TRC_AXI == TRC_ON) printf("trace    axi_write     %s\n", call_args);
+  if (AXI_PW.num > 0) axi_fence("fence before the next AXI operation");   // Keep AXI operations in program order
 
-  // Step 1: config_write to FLASH_DATA, then FLASH_ADDR initiating AXI write
-  config_write(CFG_FLASH_DATA, axi_wdata, 4, "axi_write - step 1a: store write data into FLASH_DATA register");
-  config_write(CFG_FLASH_ADDR, form_FLASH_ADDR(axi_devsel, axi_addr, FA_WR, exp_enab, exp_dir), 4, "axi_write - step 1b: write to FLASH_ADDR initiates");
+  trace_record(TRC_EV_AXI_WR, axi_devsel, axi_addr, axi_wdata, exp_enab | exp_dir, s);
+  AXI_OP_COUNT++;
+
+  // Step 1: config_write to FLASH_DATA, then FLASH_ADDR initiating AXI write, and the first poll of step 2.
+  //         The three accesses always go together, so they are handed to the backend as one chain (one system call with 'uring').
+  axi_write_chain(chain, axi_devsel, axi_addr, exp_enab, exp_dir, axi_wdata, &read_FA);
+  config_batch(chain, 3, "axi_write - step 1-2: store write data into FLASH_DATA, write FLASH_ADDR to initiate, read FLASH_ADDR");
 
   // Step 2: config_read's to poll on Write Strobe to see when it is finished. Print trace msg on only the first one to avoid cluttering output
   saved_TRC_CONFIG = TRC_CONFIG;
-  do
-  { read_FA = config_read(CFG_FLASH_ADDR, "axi_write - step  2: wait for Write Strobe to become 0 indicating AXI write is complete");
-    TRC_CONFIG = 0;  // After 1st poll, stop printing lower level msgs. Reduces clutter, plus doesn't multi-count config_read ops when timing isn't real
-  } while ((read_FA & FA_WR) == FA_WR);    // Continue while Write Strobe is 1
+  TRC_CONFIG = 0;  // The first poll was traced with the chain. Reduces clutter, plus doesn't multi-count config_read ops when timing isn't real
+  poll_start(&w, &POLL_AXI_STROBE);
+  while ((read_FA & FA_WR) == FA_WR) {     // Continue while Write Strobe is 1
+    if (poll_again(&w) != 0) axi_strobe_timeout(&w, read_FA, s);
+    read_FA = config_read(CFG_FLASH_ADDR, "axi_write - step  2: wait for Write Strobe to become 0 indicating AXI write is complete");
+  }
+  poll_end(&w);
   TRC_CONFIG = saved_TRC_CONFIG;   // Restore trace setting
+  DEVSTAT_LAST = read_FA;
 
-   // Step 3: Check Write Response and Device Specific Status
-  resp = (read_FA & FA_WR_RESP_FIELD);
-  if (resp != FA_WR_RESP_OK) {
+  errors_before = ERRORS_DETECTED;
+  axi_write_check(read_FA, axi_devsel, axi_addr, exp_enab, exp_dir, axi_wdata, s);
+
+  // Update the shadow. It also tells whether the DTR FIFO can drain, for the fill check of posted SPIDTR writes.
+  if (r != NULL) {
+    r->value = axi_wdata & ~r->selfclr;
+    r->valid = ((read_FA & FA_WR_RESP_FIELD) == FA_WR_RESP_OK && ERRORS_DETECTED == errors_before);
+  }
+  if (axi_devsel == FA_QSPI && axi_addr == FA_QSPI_SRR) {
+    axi_shadow_load_reset(FA_QSPI);
+    DEVSTAT_MASK = DEVSTAT_MASK & ~DEVSTAT_QSPI_INTERRUPT;   // Reset clears IPIER, DGIER
+  }
+  if (axi_devsel == FA_ICAP && axi_addr == FA_ICAP_CR && (axi_wdata & 0x00000008)) axi_shadow_invalidate(FA_ICAP);
+  return;
+}
+
+
+
+// --------------------------------------------------------------------------------------------------------
+// Posted AXI writes
+// - A run of writes to a keyhole register whose completion nobody waits on, like the SPIDTR writes of a DTR FIFO fill
+//   or the ICAP WF writes of a bitstream burst, is posted with axi_write_post(): FLASH_DATA and FLASH_ADDR are written,
+//   but FLASH_ADDR is not read back. On backends where a batch costs a single round trip (cfg_backend.chains) the
+//   accesses are collected and go to the card as one batch at the fence.
+// - axi_fence() completes the run: it reads FLASH_ADDR once, waits for the Write Strobe of the last write and checks its
+//   response and device status. axi_write(), axi_read() and axi_write_no_check() fence first, so posted writes are never
+//   reordered with other AXI operations, but code should fence explicitly where the run is meant to end.
+// - FLASH_ADDR only holds the response of the last write. For a run of more than one write the fence also reads the fill
+//   level of the keyhole FIFO, which tells how many of the posted writes arrived, and reports the first one that did not.
+//   This assumes the run started on an empty FIFO that is not drained while it is filled: SPIDTR while the SPI master is
+//   inhibited, ICAP WF before the CR write. When writes went missing, the FIFO is emptied and the run written again
+//   with checked writes, so a write that keeps failing is named exactly and a one-off failure is repaired.
+// - A DTR FIFO fill made while the SPI master runs can't be checked this way, so each of its writes is followed by a
+//   FLASH_ADDR read (in the same batch), which the fence uses to name a failed write. It is not written again: the
+//   FIFO has moved on, and the SPI transfer is short by the lost bytes.
+// --------------------------------------------------------------------------------------------------------
+void axi_write_chain(               // Fill in the 3 config accesses of one AXI write: FLASH_DATA write, FLASH_ADDR write, FLASH_ADDR read back
+                      cfg_batch_op *chain   //   3 entries
+                    , u32 axi_devsel        //   Select AXI4-Lite slave that is target of operation
+                    , u32 axi_addr          //   Select target register within the selected core
+                    , u32 exp_enab          //   Choose whether to use data expander
+                    , u32 exp_dir           //   Determine expander direction
+                    , u32 axi_wdata         //   Data written to AXI4-Lite slave
+                    , u32 *read_FA          //   Receives FLASH_ADDR read back after the write was started
+                    )
+{
+  chain[0].op = CFG_OP_WR;  chain[0].addr = CFG_FLASH_DATA;  chain[0].wdata = axi_wdata;  chain[0].num_bytes = 4;  chain[0].rdata = NULL;
+  chain[1].op = CFG_OP_WR;  chain[1].addr = CFG_FLASH_ADDR;  chain[1].wdata = form_FLASH_ADDR(axi_devsel, axi_addr, FA_WR, exp_enab, exp_dir);
+                            chain[1].num_bytes = 4;  chain[1].rdata = NULL;
+  chain[2].op = CFG_OP_RD;  chain[2].addr = CFG_FLASH_ADDR;  chain[2].wdata = 0;          chain[2].num_bytes = 4;  chain[2].rdata = read_FA;
+  return;
+}
+
+void axi_write_post(                // Start an AXI write without waiting for it, completion is checked by the next axi_fence()
+                     u32 axi_devsel      //   Select AXI4-Lite slave that is target of operation
+                   , u32 axi_addr        //   Select target register within the selected core
+                   , u32 exp_enab        //   Choose whether to use data expander
+                   , u32 exp_dir         //   Determine expander direction
+                   , u32 axi_wdata       //   Data written to AXI4-Lite slave
+                   , char *s             //   Comment to be printed in trace message
+                   )
+{
+  int n, fill_checked;
+  cfg_batch_op *op;
+  axi_shadow_reg *r;
+
+  if (AXI_PW.num == AXI_PW_MAX) axi_fence("axi_write_post: run is longer than the posted write log");
+
+  // Learn the ICAP write FIFO depth from the first run, while the FIFO is still empty (used to locate a failed write)
+  if (AXI_PW.num == 0 && axi_devsel == FA_ICAP && axi_addr == FA_ICAP_WF && AXI_PW.icap_wf_depth == 0)
+    AXI_PW.icap_wf_depth = axi_read(FA_ICAP, FA_ICAP_WFV, FA_EXP_OFF, FA_EXP_0123, "axi_write_post: read WFV    (depth of the empty write FIFO)");
+
+  if ((r = axi_shadow_find(axi_devsel, axi_addr)) != NULL) r->valid = 0;   // Landing is only known at the fence
+
+  trace_record(TRC_EV_AXI_WR, axi_devsel, axi_addr, axi_wdata, exp_enab | exp_dir, s);
+  AXI_OP_COUNT++;
+
+  n = AXI_PW.num++;
+  AXI_PW.devsel[n]   = axi_devsel;
+  AXI_PW.addr[n]     = axi_addr;
+  AXI_PW.exp_enab[n] = exp_enab;
+  AXI_PW.exp_dir[n]  = exp_dir;
+  AXI_PW.wdata[n]    = axi_wdata;
+  AXI_PW.s[n]        = s;
+
+  // Keyhole FIFOs that are not drained while filled are checked by their fill level at the fence, other writes read back.
+  // DTR refills with the master running are checked by the caller instead when it counts what comes out in the DRR.
+  fill_checked = (axi_devsel == FA_QSPI && axi_addr == FA_QSPI_SPIDTR && (axi_spi_inhibit() || AXI_PW.dtr_counted)) ||
+                 (axi_devsel == FA_ICAP && axi_addr == FA_ICAP_WF);
+  AXI_PW.readback[n] = !fill_checked;
+  AXI_PW.read_FA[n]  = FA_WR;              // Not known
+
+  if (CFG_BACKEND->chains) {               // Collect the accesses, the fence hands them to the backend as one batch
+    op = &AXI_PW.ops[AXI_PW.num_ops];
+    if (AXI_PW.readback[n]) {
+      axi_write_chain(op, axi_devsel, axi_addr, exp_enab, exp_dir, axi_wdata, &AXI_PW.read_FA[n]);
+      AXI_PW.num_ops += 3;
+    } else {
+      op[0].op = CFG_OP_WR;  op[0].addr = CFG_FLASH_DATA;  op[0].wdata = axi_wdata;  op[0].num_bytes = 4;  op[0].rdata = NULL;
+      op[1].op = CFG_OP_WR;  op[1].addr = CFG_FLASH_ADDR;  op[1].wdata = form_FLASH_ADDR(axi_devsel, axi_addr, FA_WR, exp_enab, exp_dir);
+                             op[1].num_bytes = 4;  op[1].rdata = NULL;
+      AXI_PW.num_ops += 2;
+    }
+  } else {
+    config_write(CFG_FLASH_DATA, axi_wdata, 4, "axi_write_post - step 1a: store write data into FLASH_DATA register");
+    config_write(CFG_FLASH_ADDR, form_FLASH_ADDR(axi_devsel, axi_addr, FA_WR, exp_enab, exp_dir), 4, "axi_write_post - step 1b: write to FLASH_ADDR initiates");
+    if (AXI_PW.readback[n])
+      AXI_PW.read_FA[n] = config_read(CFG_FLASH_ADDR, "axi_write_post - step 2: read FLASH_ADDR (response of this write)");
+  }
+  return;
+}
+
+static int axi_fence_landed(int num)   // Number of posted writes that reached the keyhole FIFO, -1 if the slave can't tell
+{ u32 fill, bytes;
+  int i;
+
+  for (i = 1; i < num; i++)
+    if (AXI_PW.devsel[i] != AXI_PW.devsel[0] || AXI_PW.addr[i] != AXI_PW.addr[0]) return -1;
+
+  if (AXI_PW.devsel[0] == FA_QSPI && AXI_PW.addr[0] == FA_QSPI_SPIDTR && axi_spi_inhibit()) {
+    for (i = 0, bytes = 0; i < num; i++) bytes += (AXI_PW.exp_enab[i] == FA_EXP_ON) ? 4 : 1;
+    fill = axi_read(FA_QSPI, FA_QSPI_TXFIFO, FA_EXP_OFF, FA_EXP_0123, "axi_fence: read  TXFIFO (DTR FIFO occupancy - 1)") + 1;
+    if (fill == bytes) return num;
+    if (fill == 1 && (axi_read(FA_QSPI, FA_QSPI_SPISR, FA_EXP_OFF, FA_EXP_0123, "axi_fence: read  SPISR  (is the DTR FIFO empty, [2]=1)") & 0x00000004))
+      fill = 0;
+    for (i = 0, bytes = 0; i < num; i++) {   // Writes that fit in 'fill', as if the missing ones were the last
+      bytes += (AXI_PW.exp_enab[i] == FA_EXP_ON) ? 4 : 1;
+      if (bytes > fill) return i;
+    }
+    return num;
+  }
+
+  if (AXI_PW.devsel[0] == FA_ICAP && AXI_PW.addr[0] == FA_ICAP_WF && AXI_PW.icap_wf_depth != 0) {
+    fill = AXI_PW.icap_wf_depth - axi_read(FA_ICAP, FA_ICAP_WFV, FA_EXP_OFF, FA_EXP_0123, "axi_fence: read  WFV    (write FIFO vacancy)");
+    return (fill < (u32) num) ? (int) fill : num;
+  }
+  return -1;
+}
+
+int axi_fence(char *s)              // Complete all posted AXI writes and check them. Returns the number of errors found.
+{
+  int num, k, landed, named;
+  int errors_before = ERRORS_DETECTED;
+  u32 read_FA = 0;
+  int saved_TRC_CONFIG;
+  poll_wait w;
+
+  num = AXI_PW.num;
+  if (num == 0) return 0;
+  AXI_PW.num = 0;
+
+  // Posted accesses (if collected) and the single FLASH_ADDR read of the fence go out as one batch
+  k = CFG_BACKEND->chains ? AXI_PW.num_ops : 0;
+  AXI_PW.num_ops = 0;
+  AXI_PW.ops[k].op = CFG_OP_RD;  AXI_PW.ops[k].addr = CFG_FLASH_ADDR;  AXI_PW.ops[k].wdata = 0;
+  AXI_PW.ops[k].num_bytes = 4;   AXI_PW.ops[k].rdata = &read_FA;
+  config_batch(AXI_PW.ops, k + 1, s);
+
+  saved_TRC_CONFIG = TRC_CONFIG;
+  TRC_CONFIG = 0;
+  poll_start(&w, &POLL_AXI_STROBE);
+  while ((read_FA & FA_WR) == FA_WR) {     // Wait for the last posted write as axi_write() does
+    if (poll_again(&w) != 0) axi_strobe_timeout(&w, read_FA, s);
+    read_FA = config_read(CFG_FLASH_ADDR, "axi_fence: wait for Write Strobe to become 0 indicating the last posted AXI write is complete");
+  }
+  poll_end(&w);
+  TRC_CONFIG = saved_TRC_CONFIG;
+  DEVSTAT_LAST = read_FA;
+
+  // Writes read back one by one answer for themselves. A read back that still saw the Write Strobe tells nothing.
+  for (k = 0, named = 0; k < num - 1; k++)
+    if (AXI_PW.readback[k] && (AXI_PW.read_FA[k] & FA_WR) == 0 && (AXI_PW.read_FA[k] & FA_WR_RESP_FIELD) != FA_WR_RESP_OK) {
+      axi_write_check(AXI_PW.read_FA[k], AXI_PW.devsel[k], AXI_PW.addr[k], AXI_PW.exp_enab[k], AXI_PW.exp_dir[k], AXI_PW.wdata[k], AXI_PW.s[k]);
+      named++;
+    }
+
+  // FLASH_ADDR answers for the last write only, the FIFO fill level for the ones before it
+  landed = (num > 1) ? axi_fence_landed(num) : -1;
+  if ((read_FA & FA_WR_RESP_FIELD) == FA_WR_RESP_OK && AXI_STATUS_CLEAN(read_FA) && (landed < 0 || landed == num))
+    return ERRORS_DETECTED - errors_before;
+
+  if (landed >= 0 && landed < num) {
+    // Writes went missing. Empty the FIFO and write the run again one checked write at a time: a write that fails
+    // again is named by axi_write(), a one-off failure leaves the FIFO filled correctly.
     ERRORS_DETECTED++;
-    switch (resp)
-    { case FA_WR_RESP_OK     : sprintf(s_err,"SUCCESSFUL    "); break;
-      case FA_WR_RESP_RSVD   : sprintf(s_err,"RESERVED      "); break;
-      case FA_WR_RESP_SLVERR : sprintf(s_err,"SLAVE_ERROR   "); break;
-      case FA_WR_RESP_INVLD  : sprintf(s_err,"INVALID SELECT"); break;
-      default                : sprintf(s_err,"<UNKNOWN>     ");
+    printf("(axi_fence): <%s>:  *** ERROR - %d of %d posted writes to %s reached the FIFO (FLASH_ADDR h%8x), writing them again one by one ***\n",
+           s, landed, num, axi_addr_as_str(AXI_PW.devsel[0], AXI_PW.addr[0]), read_FA);
+    if (AXI_PW.devsel[0] == FA_QSPI) {
+      axi_write(FA_QSPI, FA_QSPI_SPICR, FA_EXP_OFF, FA_EXP_0123, 0x00000126, "axi_fence: write SPICR  (Reset TX FIFO)");
+      axi_write(FA_QSPI, FA_QSPI_SPICR, FA_EXP_OFF, FA_EXP_0123, 0x00000106, "axi_fence: write SPICR  (Remove reset from TX FIFO)");
+    } else {
+      axi_write(FA_ICAP, FA_ICAP_CR, FA_EXP_OFF, FA_EXP_0123, 0x00000008, "axi_fence: write CR     (Reset ICAP FIFOs)");
+      axi_write(FA_ICAP, FA_ICAP_CR, FA_EXP_OFF, FA_EXP_0123, 0x00000000, "axi_fence: write CR     (Remove reset)");
     }
-    printf("(axi_write): %s:  *** ERROR - detected bad response on axi_write of %s (h%8x) ***\n", call_args, s_err, resp);
+    for (k = 0; k < num; k++)
+      axi_write(AXI_PW.devsel[k], AXI_PW.addr[k], AXI_PW.exp_enab[k], AXI_PW.exp_dir[k], AXI_PW.wdata[k], AXI_PW.s[k]);
+  } else {
+    // All writes arrived or the slave can't tell: the response and status belong to the last write
+    if (num > 1 && landed < 0 && named == 0)
+      printf("(axi_fence): <%s>: error seen after %d posted writes, reported against the last one\n", s, num);
+    k = num - 1;
+    axi_write_check(read_FA, AXI_PW.devsel[k], AXI_PW.addr[k], AXI_PW.exp_enab[k], AXI_PW.exp_dir[k], AXI_PW.wdata[k], AXI_PW.s[k]);
   }
+  return ERRORS_DETECTED - errors_before;
+}
 
-  // Check device status signals
-  // set GlobalEOS to 1 with Partial Reconfiguration to remove "eos bit unset" error message
-  if((axi_devsel == FA_ICAP ) && (axi_addr == FA_ICAP_CR)) GlobalEOS = 1;
 
-  snprintf(s_devstat, sizeof(s_devstat), "(axi_write): %s ", call_args);
-  check_axi_status(read_FA, U32_ZERO, s_devstat);
 
-  return;
+// --------------------------------------------------------------------------------------------------------
+// Device status waits
+// - The QSPI interrupt, ICAP interrupt, PREQ and EOS signals show in CFG_FLASH_ADDR[27:24] whenever FLASH_ADDR is read,
+//   so every strobe poll of an AXI operation also samples them. A wait for one of them first looks at the status of the
+//   last AXI operation, and only if the signal is not there yet polls FLASH_ADDR: one config read per poll, where an
+//   axi_read() of IPISR or SR costs a config write plus a FLASH_ADDR/FLASH_DATA read.
+// - QSPI_setup() enables the DTR Empty interrupt (IPIER[2], DGIER[31]) when DEVSTAT_WAIT is on, which turns the QSPI
+//   interrupt signal into the DTR Empty flag. check_axi_status() then masks it, as it is expected and not an error.
+// --------------------------------------------------------------------------------------------------------
+int axi_wait_devstat(                  // Wait for device status bits to be set. Returns the number of FLASH_ADDR polls it took, -1 on timeout.
+                      u32 bits         //   DEVSTAT_* bits that must all be 1
+                    , poll_site *site  //   Spin, backoff and deadline of the wait
+                    , char *s          //   Comment to be printed in trace message
+                    )
+{
+  int saved_TRC_CONFIG;
+  poll_wait w;
+
+  if (AXI_PW.num > 0) axi_fence("fence before waiting on device status");   // The status must be seen after the posted writes
+
+  saved_TRC_CONFIG = TRC_CONFIG;
+  poll_start(&w, site);
+  while ((DEVSTAT_LAST & bits) != bits) {
+    if (poll_again(&w) != 0) {
+      poll_end(&w);
+      TRC_CONFIG = saved_TRC_CONFIG;
+      return -1;
+    }
+    DEVSTAT_LAST = config_read(CFG_FLASH_ADDR, s);
+    TRC_CONFIG = 0;  // After 1st poll, stop printing lower level msgs
+  }
+  poll_end(&w);
+  TRC_CONFIG = saved_TRC_CONFIG;
+  return w.polls;
+}
+
+int axi_devstat_in_use(u32 bits)    // 1 if the device status bits are set up as completion signals (see QSPI_setup)
+{ return (DEVSTAT_MASK & bits) == bits;
+}
+
+u32 axi_poll(                      // Read an AXI register until (rdata & mask) == value, or the deadline of the poll site passes. Returns the last read data.
+               u32 axi_devsel      //   Select AXI4-Lite slave that is target of operation
+             , u32 axi_addr        //   Select target register within the selected core
+             , u32 mask            //   Bits compared
+             , u32 value           //   Value they must have
+             , poll_site *site     //   Spin, backoff and deadline of the wait
+             , char *s             //   Comment to be printed in trace and error messages
+             )
+{
+  u32 rdata;
+  int saved_TRC_AXI;
+  int saved_TRC_CONFIG;
+  poll_wait w;
+
+  saved_TRC_AXI    = TRC_AXI;
+  saved_TRC_CONFIG = TRC_CONFIG;
+  poll_start(&w, site);
+  do {
+    rdata = axi_read(axi_devsel, axi_addr, FA_EXP_OFF, FA_EXP_0123, s);
+    TRC_AXI    = 0;  // Only the first poll is traced
+    TRC_CONFIG = 0;
+  } while ((rdata & mask) != value && poll_again(&w) == 0);
+  poll_end(&w);
+  TRC_AXI    = saved_TRC_AXI;
+  TRC_CONFIG = saved_TRC_CONFIG;
+
+  if (w.timed_out) {
+    ERRORS_DETECTED++;
+    printf("(axi_poll): <%s>:  *** ERROR - %s still h%8x (expected h%8x under mask h%8x) after %d polls (%ld ms) ***\n",
+           s, axi_addr_as_str(axi_devsel, axi_addr), rdata, value, mask, w.polls, site->timeout_us / 1000);
+  }
+  return rdata;
 }
 
 
@@ -449,25 +816,32 @@ u32 axi_read(                      // Initiate a read operation on the AXI4-Lite
   u32 resp;
   u32 rdata;
   int saved_TRC_CONFIG;
+  poll_wait w;
   char s_err[1024];
   char s_devstat[1044];
+  axi_shadow_reg *r;
 
-  snprintf(call_args, sizeof(call_args),
-	   "devsel %s, addr %s (h%8.8X),                  exp_enab %s, exp_dir %s, <%s>",
-	   axi_devsel_as_str(axi_devsel), axi_addr_as_str(axi_devsel,axi_addr), axi_addr, exp_enab_as_str(exp_enab), exp_dir_as_str(exp_dir), s);
+  if (AXI_PW.num > 0) axi_fence("fence before the next AXI operation");   // Keep AXI operations in program order
 
-  if (TRC_AXI == TRC_ON) printf("trace    axi_read      %s\n", call_args);
+  trace_record(TRC_EV_AXI_RD, axi_devsel, axi_addr, 0, exp_enab | exp_dir, s);
+  AXI_OP_COUNT++;
 
   // Step 1: config_write to FLASH_ADDR initiating AXI read
   config_write(CFG_FLASH_ADDR, form_FLASH_ADDR(axi_devsel, axi_addr, FA_RD, exp_enab, exp_dir), 4, "axi_read  - step 1: write to FLASH_ADDR to initiate AXI read");
 
   // Step 2a: config_read's to poll on Read Strobe to see when it is finished. Print trace msg on only the first one to avoid cluttering output
+  //          Each poll reads FLASH_ADDR and FLASH_DATA together, so the poll that sees the Read Strobe drop also returns the read data.
+  //          FLASH_DATA is only used from the poll where FLASH_ADDR (sampled first) shows the AXI read is complete.
   saved_TRC_CONFIG = TRC_CONFIG;
+  poll_start(&w, &POLL_AXI_STROBE);
   do
-  { read_FA = config_read(CFG_FLASH_ADDR, "axi_read  - step 2: wait for Read Strobe to become 0 indicating AXI read is complete");
+  { config_read_pair(CFG_FLASH_ADDR, &read_FA, &rdata, "axi_read  - step 2: wait for Read Strobe to become 0 indicating AXI read is complete, fetch FLASH_DATA");
     TRC_CONFIG = 0;  // After 1st poll, stop printing lower level msgs. Reduces clutter, plus doesn't multi-count config_read ops when timing isn't real
-  } while ((read_FA & FA_RD) == FA_RD);    // Continue while Read Strobe is 1
+  } while ((read_FA & FA_RD) == FA_RD && poll_again(&w) == 0);    // Continue while Read Strobe is 1, up to the deadline
+  if ((read_FA & FA_RD) == FA_RD) axi_strobe_timeout(&w, read_FA, s);
+  poll_end(&w);
   TRC_CONFIG = saved_TRC_CONFIG;           // Restore trace setting
+  DEVSTAT_LAST = read_FA;
 
   // Step 2b: Check Read Response and Device Specific Status
   resp = (read_FA & FA_RD_RESP_FIELD);
@@ -480,20 +854,28 @@ u32 axi_read(                      // Initiate a read operation on the AXI4-Lite
       case FA_RD_RESP_INVLD  : sprintf(s_err,"INVALID SELECT"); break;
       default                : sprintf(s_err,"<UNKNOWN>     ");
     }
-    printf("(axi_read): %s:  *** ERROR - detected bad response on axi_read of %s (h%8x) ***\n", call_args, s_err, resp);
+    printf("(axi_read): %s:  *** ERROR - detected bad response on axi_read of %s (h%8x) ***\n",
+           axi_call_args(call_args, sizeof(call_args), 1, axi_devsel, axi_addr, exp_enab, exp_dir, 0, s), s_err, resp);
   }
 
   // Check device status signals
   // set GlobalEOS to 1 with Partial Reconfiguration to remove "eos bit unset" error message
   if((axi_devsel == FA_ICAP ) && (axi_addr == FA_ICAP_CR)) GlobalEOS = 1;
 
-  snprintf(s_devstat, sizeof(s_devstat), "(axi_read): %s ", call_args);
-  check_axi_status(read_FA, U32_ZERO, s_devstat);
+  if (!AXI_STATUS_CLEAN(read_FA)) {
+    snprintf(s_devstat, sizeof(s_devstat), "(axi_read): %s ",
+             axi_call_args(call_args, sizeof(call_args), 1, axi_devsel, axi_addr, exp_enab, exp_dir, 0, s));
+    check_axi_status(read_FA, DEVSTAT_MASK, s_devstat);
+  }
 
-  // Step 4: Read returned data
-  rdata = config_read(CFG_FLASH_DATA, "axi_read  - step 3: retrieve data from FLASH_DATA register");
+  // Step 3: Read data was already returned with the final poll of FLASH_ADDR
 
-  if (TRC_AXI == TRC_ON) printf("trace    axi_read completion   (rdata h%8x)\n", rdata);
+  if ((r = axi_shadow_find(axi_devsel, axi_addr)) != NULL) {
+    r->value = rdata & ~r->selfclr;
+    r->valid = (resp == FA_RD_RESP_OK);
+  }
+
+  trace_record(TRC_EV_AXI_RD_DONE, axi_devsel, axi_addr, rdata, exp_enab | exp_dir, s);
 
   return rdata;
 }
@@ -511,13 +893,11 @@ void axi_write_zynq(                     // Initiate a write operation on the AX
   u32 read_FA;
   u32 resp;
   int saved_TRC_CONFIG;
+  poll_wait w;
   char s_err[1024];
-  char s_devstat[1044];
-  
-  sprintf(call_args,"devsel %s, addr %s (h%8.8X), wdata h%8.8x, exp_enab %s, exp_dir %s, <%s>",
-    axi_devsel_as_str(axi_devsel), axi_addr_as_str(axi_devsel,axi_addr), axi_addr, axi_wdata, exp_enab_as_str(exp_enab), exp_dir_as_str(exp_dir), s); 
 
-  if (TRC_AXI == TRC_ON) printf("trace    axi_write     %s\n", call_args); 
+  trace_record(TRC_EV_AXI_WR, axi_devsel, axi_addr, axi_wdata, exp_enab | exp_dir, s);
+  AXI_OP_COUNT++;
 
   // Step 1: config_write to FLASH_DATA, then FLASH_ADDR initiating AXI write
   config_write(CFG_FLASH_DATA, axi_wdata, 4, "axi_write - step 1a: store write data into FLASH_DATA register");
@@ -525,10 +905,13 @@ void axi_write_zynq(                     // Initiate a write operation on the AX
 
   // Step 2: config_read's to poll on Write Strobe to see when it is finished. Print trace msg on only the first one to avoid cluttering output
   saved_TRC_CONFIG = TRC_CONFIG;
+  poll_start(&w, &POLL_AXI_STROBE);
   do  
   { read_FA = config_read(CFG_FLASH_ADDR, "axi_write - step  2: wait for Write Strobe to become 0 indicating AXI write is complete");
     TRC_CONFIG = 0;  // After 1st poll, stop printing lower level msgs. Reduces clutter, plus doesn't multi-count config_read ops when timing isn't real
-  } while ((read_FA & FA_WR) == FA_WR);    // Continue while Write Strobe is 1
+  } while ((read_FA & FA_WR) == FA_WR && poll_again(&w) == 0);    // Continue while Write Strobe is 1, up to the deadline
+  if ((read_FA & FA_WR) == FA_WR) axi_strobe_timeout(&w, read_FA, s);
+  poll_end(&w);
   TRC_CONFIG = saved_TRC_CONFIG;   // Restore trace setting
 
    // Step 3: Check Write Response and Device Specific Status
@@ -542,10 +925,9 @@ void axi_write_zynq(                     // Initiate a write operation on the AX
       case FA_WR_RESP_INVLD  : sprintf(s_err,"INVALID SELECT"); break;
       default                : sprintf(s_err,"<UNKNOWN>     "); 
     }
-    printf("(axi_write): %s:  *** ERROR - detected bad response on axi_write of %s (h%8x) ***\n", call_args, s_err, resp);
+    printf("(axi_write): %s:  *** ERROR - detected bad response on axi_write of %s (h%8x) ***\n",
+           axi_call_args(call_args, sizeof(call_args), 0, axi_devsel, axi_addr, exp_enab, exp_dir, axi_wdata, s), s_err, resp);
   }    
-  //sprintf(s_devstat,"(axi_write): %s ", call_args);
-  snprintf(s_devstat, sizeof(s_devstat), "(axi_write): %s ", call_args);
 
   return;
 }
@@ -566,23 +948,24 @@ u32 axi_read_zynq(                      // Initiate a read operation on the AXI4
   u32 resp;
   u32 rdata;
   int saved_TRC_CONFIG;
+  poll_wait w;
   char s_err[1024];
-  char s_devstat[1044];
- 
-  sprintf(call_args,"devsel %s, addr %s (h%8.8X),                  exp_enab %s, exp_dir %s, <%s>",
-    axi_devsel_as_str(axi_devsel), axi_addr_as_str(axi_devsel,axi_addr), axi_addr, exp_enab_as_str(exp_enab), exp_dir_as_str(exp_dir), s); 
 
-  if (TRC_AXI == TRC_ON) printf("trace    axi_read      %s\n", call_args); 
+  trace_record(TRC_EV_AXI_RD, axi_devsel, axi_addr, 0, exp_enab | exp_dir, s);
+  AXI_OP_COUNT++;
 
   // Step 1: config_write to FLASH_ADDR initiating AXI read
   config_write(CFG_FLASH_ADDR, form_FLASH_ADDR(axi_devsel, axi_addr, FA_RD, exp_enab, exp_dir), 4, "axi_read  - step 1: write to FLASH_ADDR to initiate AXI read");
 
   // Step 2a: config_read's to poll on Read Strobe to see when it is finished. Print trace msg on only the first one to avoid cluttering output
   saved_TRC_CONFIG = TRC_CONFIG;
+  poll_start(&w, &POLL_AXI_STROBE);
   do  
   { read_FA = config_read(CFG_FLASH_ADDR, "axi_read  - step 2: wait for Read Strobe to become 0 indicating AXI read is complete");
     TRC_CONFIG = 0;  // After 1st poll, stop printing lower level msgs. Reduces clutter, plus doesn't multi-count config_read ops when timing isn't real
-  } while ((read_FA & FA_RD) == FA_RD);    // Continue while Read Strobe is 1
+  } while ((read_FA & FA_RD) == FA_RD && poll_again(&w) == 0);    // Continue while Read Strobe is 1, up to the deadline
+  if ((read_FA & FA_RD) == FA_RD) axi_strobe_timeout(&w, read_FA, s);
+  poll_end(&w);
   TRC_CONFIG = saved_TRC_CONFIG;           // Restore trace setting
 
   // Step 2b: Check Read Response and Device Specific Status
@@ -596,15 +979,14 @@ u32 axi_read_zynq(                      // Initiate a read operation on the AXI4
       case FA_RD_RESP_INVLD  : sprintf(s_err,"INVALID SELECT"); break;
       default                : sprintf(s_err,"<UNKNOWN>     "); 
     }
-    printf("(axi_read): %s:  *** ERROR - detected bad response on axi_read of %s (h%8x) ***\n", call_args, s_err, resp);
+    printf("(axi_read): %s:  *** ERROR - detected bad response on axi_read of %s (h%8x) ***\n",
+           axi_call_args(call_args, sizeof(call_args), 1, axi_devsel, axi_addr, exp_enab, exp_dir, 0, s), s_err, resp);
   }
-  //sprintf(s_devstat,"(axi_read): %s ", call_args);
-  snprintf(s_devstat, sizeof(s_devstat), "(axi_read): %s ", call_args);
 
   // Step 4: Read returned data
   rdata = config_read(CFG_FLASH_DATA, "axi_read  - step 3: retrieve data from FLASH_DATA register");
 
-  if (TRC_AXI == TRC_ON) printf("trace    axi_read completion   (rdata h%8x)\n", rdata); 
+  trace_record(TRC_EV_AXI_RD_DONE, axi_devsel, axi_addr, rdata, exp_enab | exp_dir, s);
 
   return rdata;
 }
@@ -627,6 +1009,7 @@ void write_ICAP_reg(u32 reg_addr, u32 wdata)
 
 void reset_ICAP()
 {
+  axi_shadow_invalidate(FA_ICAP);
   write_ICAP_reg(FA_ICAP_CR, 0x00000008);
   write_ICAP_reg(FA_ICAP_CR, 0x00000000);
   return;
@@ -652,6 +1035,22 @@ u32 wait_ICAP_write_done()
 
 }
 
+// Once CR reads back 0 the write is done, so SR = h5 only needs EOS. With DEVSTAT_WAIT on, EOS is taken from the
+// CFG_FLASH_ADDR status of the CR polls and SR is read only if EOS isn't there.
+// The first wait always reads SR, and tells from the FLASH_ADDR status of that read whether the image shows EOS there.
+void wait_ICAP_EOS(char *s)
+{
+  static int eos_in_devstat = -1;   // -1 = not known yet, 0 = not shown in FLASH_ADDR, 1 = shown
+  const u32 SR_ICAPEn_EOS = 5;
+  u32 rdata;
+
+  if (DEVSTAT_WAIT == DSW_ON && eos_in_devstat == 1 && axi_wait_devstat(DEVSTAT_EOS, &POLL_ICAP_EOS, s) >= 0)
+    return;
+  rdata = axi_poll(FA_ICAP, FA_ICAP_SR, 0xFFFFFFFF, SR_ICAPEn_EOS, &POLL_ICAP_EOS, s);
+  if (eos_in_devstat == -1 && rdata == SR_ICAPEn_EOS) eos_in_devstat = ((DEVSTAT_LAST & DEVSTAT_EOS) != 0);
+  return;
+}
+
 void write_ICAP_bitstream_word(u32 wdata)
 {
   write_ICAP_reg(FA_ICAP_SZ, 0x00000001);
@@ -723,11 +1122,7 @@ void read_FPGA_IDCODE()
 
   //printf("Read IDCODE from AXI_HWICAP                      \n");
 
-  rdata = 0;
-  while (rdata != SR_ICAPEn_EOS)  {
-     rdata = axi_read(FA_ICAP, FA_ICAP_SR  , FA_EXP_OFF, FA_EXP_0123, "ICAP: read SR (monitor ICAPEn)");
-     //printf("Waiting for ICAP SR = 5 \e[1A\n");
-  }
+  wait_ICAP_EOS("ICAP: read SR (monitor ICAPEn)");
   wdata = 0xFFFFFFFF;
   axi_write(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
   wdata = 0x000000BB;
@@ -748,25 +1143,13 @@ void read_FPGA_IDCODE()
   axi_write(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
   // flush
   axi_write(FA_ICAP, FA_ICAP_CR, FA_EXP_OFF, FA_EXP_0123, CR_Write_cmd, "ICAP: write CR (initiate bitstream writing)");
-  rdata = 0;
-  while (rdata != 0x0000003F) {
-    rdata = axi_read(FA_ICAP, FA_ICAP_WFV  , FA_EXP_OFF, FA_EXP_0123, "ICAP: read WFV (monitor ICAPEn)");
-    //printf("waiting for WFV - h%x\t.", rdata);
-  }
+  axi_poll(FA_ICAP, FA_ICAP_WFV, 0xFFFFFFFF, 0x0000003F, &POLL_ICAP_CR, "ICAP: read WFV (monitor ICAPEn)");
 
   axi_write(FA_ICAP, FA_ICAP_SZ, FA_EXP_OFF, FA_EXP_0123, SZ_Read_One_Word, "ICAP: write SZ ");
-  rdata = 1;
-  while (rdata != CR_Write_clear) {
-     rdata = axi_read(FA_ICAP, FA_ICAP_CR  , FA_EXP_OFF, FA_EXP_0123, "ICAP: read CR (monitor ICAPEn)");
-     //printf("Waiting for ICAP CR = 0 (actual =  h%x)\e[1A\n", rdata);
-  }
+  axi_poll(FA_ICAP, FA_ICAP_CR, 0xFFFFFFFF, CR_Write_clear, &POLL_ICAP_CR, "ICAP: read CR (monitor ICAPEn)");
 
   axi_write(FA_ICAP, FA_ICAP_CR, FA_EXP_OFF, FA_EXP_0123, CR_Read_cmd, "ICAP: Read cmd ");
-  rdata = 0;
-  while (rdata != RFO_wait_rd_done) {
-     rdata = axi_read(FA_ICAP, FA_ICAP_RFO  , FA_EXP_OFF, FA_EXP_0123, "ICAP: poll RFO until read completed");
-     //printf("Waiting for ICAP RFO = 1 \e[1A           \n");
-  }
+  axi_poll(FA_ICAP, FA_ICAP_RFO, 0xFFFFFFFF, RFO_wait_rd_done, &POLL_ICAP_CR, "ICAP: poll RFO until read completed");
 
   rdata = axi_read(FA_ICAP, FA_ICAP_RF , FA_EXP_OFF, FA_EXP_0123, "ICAP: read FIFO");
 
@@ -832,6 +1215,34 @@ void read_QSPI_regs()    // Read and display all AXI readable registers in Quad
 
 
 
+// --------------------------------------------------------------------------------------------------------
+// The IP wizard builds the Quad SPI core with 16 or 256 byte DTR / DRR FIFOs (both the same), and no register tells
+// which. Right after reset the master is inhibited (SPICR[8] = 1), so bytes written to SPIDTR stay in the FIFO: after
+// 16 of them SPISR[3] (Tx_Full) is set only by a 16 byte FIFO. TXFIFO (occupancy - 1) confirms the 16 bytes arrived.
+static int QSPI_probe_FIFO_depth()   // Returns the DTR / DRR FIFO depth in bytes
+{ u32 axi_rdata;
+  int depth;
+  int i;
+
+  for (i = 0; i < 16; i = i + 4)
+    axi_write_post(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_ON, FA_EXP_3210, 0x00000000, "QSPI_probe_FIFO_depth: write SPIDTR  (4 bytes of probe fill)");
+  axi_fence("QSPI_probe_FIFO_depth: fence SPIDTR  (probe fill complete)");
+
+  axi_rdata = axi_read(FA_QSPI, FA_QSPI_TXFIFO, FA_EXP_OFF, FA_EXP_0123, "QSPI_probe_FIFO_depth: read  TXFIFO  (expect 16 bytes - 1)");
+  if (axi_rdata != 15) {
+    ERRORS_DETECTED++;
+    printf("(QSPI_probe_FIFO_depth):  *** ERROR - DTR FIFO holds %d bytes after writing 16, assuming a %d byte FIFO ***\n", axi_rdata + 1, FIFO_DEPTH);
+    depth = FIFO_DEPTH;
+  } else {
+    axi_rdata = axi_read(FA_QSPI, FA_QSPI_SPISR, FA_EXP_OFF, FA_EXP_0123, "QSPI_probe_FIFO_depth: read  SPISR   ([3] Tx_Full after 16 bytes)");
+    depth = (axi_rdata & 0x00000008) ? 16 : 256;
+  }
+
+  // Empty the FIFO again, SPICR otherwise keeps its reset value (master inhibited, manual slave select)
+  axi_write(FA_QSPI, FA_QSPI_SPICR, FA_EXP_OFF, FA_EXP_0123, 0x000001A0, "QSPI_probe_FIFO_depth: write SPICR  (Reset TX FIFO)");
+  return depth;
+}
+
 // --------------------------------------------------------------------------------------------------------
 // Setup QSPI registers for 9V3 board usage
 //   per Quad SPI spec (pg153-axi-quad-spi.pdf, section "Protocol Description", sub-section "Dual/Quad SPI Mode Transactions"
@@ -842,13 +1253,17 @@ void QSPI_setup()
 //  unsigned char wdata[];
 
   // SRR (Software Reset Register) [Write only]
-  // - Reset core to start
+  // - Reset core to start. Nothing is assumed about the registers before it, the SRR write loads their reset values.
+  axi_shadow_invalidate(FA_QSPI);
   axi_wdata = 0x0000000A;
   axi_write(FA_QSPI, FA_QSPI_SRR, FA_EXP_OFF, FA_EXP_0123, axi_wdata, "QSPI_setup: write SRR (reset core to start)");
 
   // Issue axi_read to any register to provide delay for reset (need 16 cycles minimum for reset to take effect, assume this takes more time than that)
   axi_rdata = axi_read(FA_QSPI, FA_QSPI_IPISR, FA_EXP_OFF, FA_EXP_0123, "QSPI_setup: axi_read provides delay, allowing QSPI core to reset");
 
+  // Size flash_op() bursts from the FIFOs the core was built with
+  FIFO_DEPTH = QSPI_probe_FIFO_depth();
+
   // DGIER (Device Global Interrupt Enable Register)
   // -    [31] Global Interrupt Enable (0 = disabled)
   // - [30: 0] Reserved
@@ -884,6 +1299,13 @@ void QSPI_setup()
     printf("(QSPI_setup):  *** ERROR - IPISR is remains non-zero after clearing procedure (h%8x) ***\n", axi_rdata);
   }
 
+  // Enable only the DTR Empty interrupt, so the QSPI interrupt in CFG_FLASH_ADDR tells when the DTR FIFO has drained
+  if (DEVSTAT_WAIT == DSW_ON) {
+    DEVSTAT_MASK = DEVSTAT_MASK | DEVSTAT_QSPI_INTERRUPT;
+    axi_write(FA_QSPI, FA_QSPI_IPIER, FA_EXP_OFF, FA_EXP_0123, 0x00000004, "QSPI_setup: write IPIER  (enable DTR Empty interrupt)");
+    axi_write(FA_QSPI, FA_QSPI_DGIER, FA_EXP_OFF, FA_EXP_0123, 0x80000000, "QSPI_setup: write DGIER  (enable global interrupt, DTR Empty shows in FLASH_ADDR)");
+  }
+
   return;
 }
 
@@ -916,36 +1338,46 @@ char* fo_dir_as_str(int dir)  // Convert flash_op direction value to string for
 // --------------------------------------------------------------------------------------------------------
 void fo_wait_for_DTR_FIFO_empty()  // Wait for IPISR[2] to become 1 indicating DTR FIFO has been emptied (all bytes sent to the FLASH)
 {
-  const int maxloops = 5;       // Timeout waiting for FLASH to respond to operation
-
   int  i;
   int  saved_TRC_AXI;
   int  saved_TRC_CONFIG;
   u32  axi_rdata;
   u32  axi_wdata;
   int  debug = 0;             // 0 = normal, 1 = add more print msgs
-  char ds[1024];
+  poll_wait w;                // Deadline and backoff, see POLL_DTR_EMPTY
+
+  // The QSPI interrupt is the DTR Empty flag, seen by the FLASH_ADDR polls without reading IPISR
+  if (axi_devstat_in_use(DEVSTAT_QSPI_INTERRUPT)) {
+    i = axi_wait_devstat(DEVSTAT_QSPI_INTERRUPT, &POLL_DTR_EMPTY, "flash_op-fo_wait_for_DTR_FIFO_empty: read  FLASH_ADDR (wait for QSPI interrupt meaning DTR FIFO is empty)");
+    if (i < 0) {
+      ERRORS_DETECTED++;
+      printf("(flash_op-fo_wait_for_DTR_FIFO_empty):  *** ERROR - Poll of FLASH_ADDR waiting for DTR Empty interrupt timed out (%ld ms) ***\n", POLL_DTR_EMPTY.timeout_us / 1000);
+      return;
+    }
+    if (debug == 1) printf("flash_op-fo_wait_for_DTR_FIFO_empty: DTR FIFO is empty after %d FLASH_ADDR polls, continue\n", i);
+    // Nothing waits on the clear, it is checked with the next AXI operation
+    axi_write_post(FA_QSPI, FA_QSPI_IPISR, FA_EXP_OFF, FA_EXP_0123, 0x00000004, "flash_op-fo_wait_for_DTR_FIFO_empty: write IPISR  (clear [2] to prepare for next write to DTR FIFO)");
+    return;
+  }
 
-  i = 0;
   saved_TRC_AXI    = TRC_AXI;
   saved_TRC_CONFIG = TRC_CONFIG;
+  poll_start(&w, &POLL_DTR_EMPTY);
   do {
-      i++;
-      sprintf(ds, "flash_op-fo_wait_for_DTR_FIFO_empty: read  IPISR  (wait for [2] to become 1 meaning DTR FIFO is empty - iteration %d", i);
-      axi_rdata = axi_read(FA_QSPI, FA_QSPI_IPISR, FA_EXP_OFF, FA_EXP_0123, ds);
+      axi_rdata = axi_read(FA_QSPI, FA_QSPI_IPISR, FA_EXP_OFF, FA_EXP_0123, "flash_op-fo_wait_for_DTR_FIFO_empty: read  IPISR  (wait for [2] to become 1 meaning DTR FIFO is empty)");
       TRC_AXI    = 0;  // Disable printing of subsequent iterations, want only one AXI_RD msg for this step
       TRC_CONFIG = 0;  // Disable printing of subsequent iterations, want only config msgs for one AXI_RD msg for this step
-  } while (i < maxloops && ((axi_rdata & 0x00000004) == 0x00000000) );  // iterate while [2] = 0
+  } while ((axi_rdata & 0x00000004) == 0x00000000 && poll_again(&w) == 0);  // iterate while [2] = 0, up to the deadline
+  poll_end(&w);
   TRC_AXI    = saved_TRC_AXI;
   TRC_CONFIG = saved_TRC_CONFIG;
-  if (i == maxloops) {
+  if (w.timed_out) {
     ERRORS_DETECTED++;
-    printf("(flash_op-fo_wait_for_DTR_FIFO_empty):  *** ERROR - Poll of IPISR[2] waiting for DTR Empty interrupt exceeded max loop iterations (%d) ***\n", maxloops);
+    printf("(flash_op-fo_wait_for_DTR_FIFO_empty):  *** ERROR - Poll of IPISR[2] waiting for DTR Empty interrupt timed out after %d polls (%ld ms) ***\n", w.polls, POLL_DTR_EMPTY.timeout_us / 1000);
   } else {
-    if (debug == 1) printf("flash_op-fo_wait_for_DTR_FIFO_empty: DTR FIFO is empty after iteration %d, continue\n", i);
-    sprintf(ds, "flash_op-fo_wait_for_DTR_FIFO_empty: write IPISR  (clear [2] to prepare for next write to DTR FIFO - after poll iteration %d", i);
+    if (debug == 1) printf("flash_op-fo_wait_for_DTR_FIFO_empty: DTR FIFO is empty after %d polls, continue\n", w.polls);
     axi_wdata = 0x00000004;  // Clear bit [2] from 1 to 0 by writing to toggle it
-    axi_write(FA_QSPI, FA_QSPI_IPISR, FA_EXP_OFF, FA_EXP_0123, axi_wdata, ds);
+    axi_write(FA_QSPI, FA_QSPI_IPISR, FA_EXP_OFF, FA_EXP_0123, axi_wdata, "flash_op-fo_wait_for_DTR_FIFO_empty: write IPISR  (clear [2] to prepare for next write to DTR FIFO)");
   }
   return;
 }
@@ -953,105 +1385,291 @@ void fo_wait_for_DTR_FIFO_empty()  // Wait for IPISR[2] to become 1 indicating D
 
 
 // --------------------------------------------------------------------------------------------------------
+// QSPI checks of the op in progress (FLASH_OP_CHECK)
+// - FO_CHK_ON checks every op: IPISR after the FIFO reset, SPISR around every DRR read, the DRR of write commands.
+// - FO_CHK_SAMPLED checks single ops, spaced at random by 1 to 2 * FLASH_OP_CHECK_EVERY - 1 ops so the samples don't lock
+//   on to one command of a repeating sequence (WRITE ENABLE, PAGE PROGRAM, READ STATUS ...). An op that raises
+//   ERRORS_DETECTED while sampling switches FLASH_OP_CHECK to FO_CHK_ON for the rest of the run.
+// --------------------------------------------------------------------------------------------------------
+static int FO_CHECK;                       // 1 if the op in progress is checked
+static int FO_CHECK_ERRORS;                // ERRORS_DETECTED when it started
+static int FO_CHECK_COUNTDOWN;             // Ops to the next sampled one
+static unsigned int FO_CHECK_SEED;
+
+static void fo_check_begin(void)
+{
+  FO_CHECK_ERRORS = ERRORS_DETECTED;
+  if (FLASH_OP_CHECK != FO_CHK_SAMPLED) {
+    FO_CHECK = (FLASH_OP_CHECK == FO_CHK_ON);
+    return;
+  }
+  if (FO_CHECK_SEED == 0) FO_CHECK_SEED = (unsigned int) poll_now_ns() | 1;
+  if (FO_CHECK_COUNTDOWN <= 0) {
+    FO_CHECK_SEED      = FO_CHECK_SEED * 1103515245 + 12345;
+    FO_CHECK_COUNTDOWN = 1 + (int) ((FO_CHECK_SEED >> 16) % (unsigned int) (2 * ((FLASH_OP_CHECK_EVERY > 1) ? FLASH_OP_CHECK_EVERY : 1) - 1));
+  }
+  FO_CHECK = (--FO_CHECK_COUNTDOWN == 0);
+  return;
+}
+
+static void fo_check_end(char *s)
+{
+  if (FLASH_OP_CHECK == FO_CHK_SAMPLED && ERRORS_DETECTED > FO_CHECK_ERRORS) {
+    FLASH_OP_CHECK = FO_CHK_ON;
+    printf("(flash_op):  QSPI anomaly during %s, checking every FLASH op from now on\n", (s != NULL) ? s : "a FLASH op");
+  }
+  FO_CHECK = 0;
+  return;
+}
+
+// Shifted out data is wanted: reads and exchanges, and writes when the op is checked (the DRR is counted)
+static inline int fo_wants_DRR(int dir)
+{ return (dir == FO_DIR_XCHG || dir == FO_DIR_RD) || (dir == FO_DIR_WR && FO_CHECK);
+}
+
+// Read 'load_bytes' from the DRR FIFO straight into the caller's buffer. They are the shifted out bytes 'rx_ptr' on of
+// the command: byte n lands in rdata[n - skip_bytes], the cmd, addr and dummy bytes before 'skip_bytes' are dropped, and
+// so is everything with a NULL rdata. Checks that the RX FIFO remains not empty for the correct number of data bytes, and
+// that it is empty after them when 'all' of the shifted out bytes are in (the SPI master is done).
+static void fo_unpack_DRR(byte *rdata, int rx_ptr, int skip_bytes, int load_bytes, int all)
+{
+  u32 axi_rdata;
+  int i, j, n, k;
+  int remaining_bytes;
+  int debug = 0;             // 0 = normal, 1 = add more print msgs
+
+  remaining_bytes = load_bytes;
+  i = 0;    // count of bytes read
+  while (remaining_bytes > 0) {
+
+    if (FO_CHECK) {
+      // Check RX FIFO remains not empty
+      axi_rdata = axi_read(FA_QSPI, FA_QSPI_SPISR, FA_EXP_OFF, FA_EXP_0123, "flash_op-fo_read_DRR: read  SPISR  (confirm RX FIFO still has a byte, [0] should be 0)");
+      if ((axi_rdata & 0x00000001) != 0x00000000) {   // bit [0] != 0
+        ERRORS_DETECTED++;
+        printf("(flash_op-fo_read_DRR):  *** ERROR - SPISR[0]=1 indicating RX FIFO Empty before reading data byte [%d] of [%d]\n", i, load_bytes-1);
+      }
+    }
+
+    if (remaining_bytes >= 4) {   // Read 4 bytes at a time using Byte Expander, first byte in [31:24]
+      axi_rdata = axi_read(FA_QSPI, FA_QSPI_SPIDRR, FA_EXP_ON, FA_EXP_3210, "flash_op-fo_read_DRR: read SPIDRR (get 4 bytes from RX FIFO)");
+      n = 4;
+    }
+    else {   // less than 4 bytes left, so read one byte at a time
+      axi_rdata = axi_read(FA_QSPI, FA_QSPI_SPIDRR, FA_EXP_OFF, FA_EXP_3210, "flash_op-fo_read_DRR: read SPIDRR (get 1 byte from RX FIFO)");    // Byte expander is off
+      n = 1;
+    }
+    if (debug == 1) printf("flash_op-fo_read_DRR: SPIDRR = h%8X, shifted out bytes [%3d to %3d]\n", axi_rdata, rx_ptr + i, rx_ptr + i + n - 1);
+    k = rx_ptr + i - skip_bytes;                  // Where the first byte of the read goes
+    if (rdata != NULL && n == 4 && k >= 0) {
+      rdata[k  ] = (byte) (axi_rdata >> 24);
+      rdata[k+1] = (byte) (axi_rdata >> 16);
+      rdata[k+2] = (byte) (axi_rdata >>  8);
+      rdata[k+3] = (byte) (axi_rdata      );
+    }
+    else if (rdata != NULL) {                     // A single byte, or a word across the end of the cmd, addr and dummy bytes
+      for (j = n - 1; j >= 0; j--, k++)
+        if (k >= 0) rdata[k] = (byte) (axi_rdata >> (8 * j));
+    }
+    remaining_bytes = remaining_bytes - n;        // Reduce count of bytes to read yet
+    i = i + n;
+  }   // while (remaining_bytes > 0)
+
+  if (FO_CHECK && all) {
+    // Check that RX FIFO is empty now
+    axi_rdata = axi_read(FA_QSPI, FA_QSPI_SPISR, FA_EXP_OFF, FA_EXP_0123, "flash_op-fo_read_DRR: read  SPISR  (confirm RX FIFO is empty after reading the expected number of data bytes)");
+    if ((axi_rdata & 0x00000001) != 0x00000001) {   // bit [0] != 1
+      ERRORS_DETECTED++;
+      printf("(flash_op-fo_read_DRR):  *** ERROR - SPISR[0]=0 indicating RX FIFO is not Empty after all %d bytes were read\n", load_bytes);
+    }
+  }
+  return;
+}
+
 void fo_read_DRR(                     // Obtain shifted out data. Check that RX FIFO remains not empty for the correct number of data bytes.
                   byte *drr_data      // Pointer to buffer that will hold DRR contents when function is complete
                 , int   load_bytes    // Number of bytes to read from DRR
                 , int   dir           // Skip some steps based on the direction of the FLASH operation (FO_DIR_XCHG, FO_DIR_RD, FO_DIR_WR)
                 )
 {
-  u32 axi_rdata;
-  int i;
-  int remaining_bytes;
-  int debug = 0;             // 0 = normal, 1 = add more print msgs
-  char ds[1024];
-
-  if ((dir == FO_DIR_XCHG || dir == FO_DIR_RD) || (dir == FO_DIR_WR && FLASH_OP_CHECK == FO_CHK_ON)) {
-    remaining_bytes = load_bytes;
-    i = 0;    // pointer into return data array
-    while (remaining_bytes > 0) {
-
-      if (FLASH_OP_CHECK == FO_CHK_ON) {
-        // Check RX FIFO remains not empty
-        axi_rdata = axi_read(FA_QSPI, FA_QSPI_SPISR, FA_EXP_OFF, FA_EXP_0123, "flash_op-fo_read_DRR: read  SPISR  (confirm RX FIFO still has a byte, [0] should be 0)");
-        if ((axi_rdata & 0x00000001) != 0x00000000) {   // bit [0] != 0
-          ERRORS_DETECTED++;
-          printf("(flash_op-fo_read_DRR):  *** ERROR - SPISR[0]=1 indicating RX FIFO Empty before reading data byte [%d] of [%d]\n", i, load_bytes-1);
-        }
-      }
+  if (fo_wants_DRR(dir))
+    fo_unpack_DRR(drr_data, 0, 0, load_bytes, 1);
+  else
+    memset(drr_data, 0x00, load_bytes);   // On an unchecked FLASH write, the shifted out data is ignored: skip the DRR FIFO, return h00 in all bytes
+  return;
+}
 
-      if (remaining_bytes >= 4) {   // Read 4 bytes at a time using Byte Expander
-        sprintf(ds, "flash_op-fo_read_DRR: read SPIDRR (get byte %3d to %3d from RX FIFO)", i, i+3);
-        axi_rdata = axi_read(FA_QSPI, FA_QSPI_SPIDRR, FA_EXP_ON, FA_EXP_3210, ds);
-        *(drr_data+i  ) = (byte) ((axi_rdata & 0xFF000000) >> 24);
-        *(drr_data+i+1) = (byte) ((axi_rdata & 0x00FF0000) >> 16);
-        *(drr_data+i+2) = (byte) ((axi_rdata & 0x0000FF00) >>  8);
-        *(drr_data+i+3) = (byte) ((axi_rdata & 0x000000FF)      );
-        if (debug == 1) printf("flash_op-fo_read_DRR: SPIDRR = h%8X, drr_data[%3d to %3d] = h%2X %2X %2X %2X\n",  axi_rdata, i, i+3,
-          *(drr_data+i), *(drr_data+i+1), *(drr_data+i+2), *(drr_data+i+3) );
-        remaining_bytes = remaining_bytes - 4;      // Reduce count of bytes to read yet
-        i = i + 4;                                  // Point to next free byte location in drr_data
-      }
-      else {   // less than 4 bytes left, so read one byte at a time
-        sprintf(ds, "flash_op-fo_read_DRR: read SPIDRR (get byte %3d from RX FIFO)", i);
-        axi_rdata = axi_read(FA_QSPI, FA_QSPI_SPIDRR, FA_EXP_OFF, FA_EXP_3210, ds);    // Byte expander is off
-        *(drr_data+i) = (byte) (axi_rdata & 0x000000FF);
-        if (debug == 1) printf("flash_op-fo_read_DRR: SPIDRR = h%8X, drr_data[%3d] = h%2X\n",  axi_rdata, i, *(drr_data+i));
-        remaining_bytes = remaining_bytes - 1;      // Reduce count of bytes to read yet
-        i = i + 1;                                  // Point to next free byte location in drr_data
-      }
-    }   // while (remaining_bytes > 0)
 
-    if (FLASH_OP_CHECK == FO_CHK_ON) {
-      // Check that RX FIFO is empty now
-      axi_rdata = axi_read(FA_QSPI, FA_QSPI_SPISR, FA_EXP_OFF, FA_EXP_0123, "flash_op-fo_read_DRR: read  SPISR  (confirm RX FIFO is empty after reading the expected number of data bytes)");
-      if ((axi_rdata & 0x00000001) != 0x00000001) {   // bit [0] != 1
+
+// --------------------------------------------------------------------------------------------------------
+// Write data of a FLASH command: a NULL wdata sends zeros (reads, which only need the SPI clock)
+static inline byte fo_wbyte(byte *wdata, int i)
+{ return (wdata != NULL) ? wdata[i] : 0x00;
+}
+
+static inline u32 fo_wword(byte *wdata, int i)   // 4 bytes from wdata[i], first byte in [31:24] for FA_EXP_3210
+{ return (wdata != NULL) ? (u32) ((wdata[i] << 24) | (wdata[i+1] << 16) | (wdata[i+2] << 8) | wdata[i+3]) : 0x00000000;
+}
+
+
+
+// --------------------------------------------------------------------------------------------------------
+// Streaming FLASH transfer (FLASH_OP_ENGINE = FOE_STREAM)
+// - flash_op() fills the DTR FIFO and starts the SPI master as usual. From there, rather than waiting for the DTR to run
+//   dry before refilling it, the FIFO levels are read back (RDFIFO / TXFIFO hold occupancy - 1) and the DTR is topped up
+//   while the master is still shifting, so the SPI clock keeps running across host round trips.
+// - When the shifted out data is wanted (same rule as fo_read_DRR), every byte in flight must fit in the DRR, so the DTR is
+//   only topped up by what has been drained from the DRR. An occupancy register reading 0 may mean 0 or 1 bytes, so it
+//   is taken as 0 for the DRR and as 1 for the DTR.
+// - Once all bytes are in the DTR, SPISR[2] (Tx_Empty, a level rather than the IPISR edge) ends the transfer.
+// --------------------------------------------------------------------------------------------------------
+static void fo_stream(
+                       byte *wdata                  // Data bytes to write, from wdata_ptr on ...
+                     , int   wdata_ptr
+                     , int   remaining_total_bytes  //   ... this many
+                     , byte *rdata                  // Receives the shifted out data after the first skip_bytes (NULL: discard)
+                     , int   in_flight              // Bytes already written to the DTR (the first fill)
+                     , int   skip_bytes             // Shifted out bytes of the cmd, addr and dummy cycles
+                     , int   dir                    // FO_DIR_XCHG, FO_DIR_RD, FO_DIR_WR
+                     )
+{
+  u32  axi_wdata, axi_rdata;
+  int  drain;                // 1 if the DRR contents are read
+  int  rx_ptr;               // Shifted out bytes read from the DRR so far
+  int  level, free, n;
+  poll_wait w;
+
+  drain  = fo_wants_DRR(dir);
+  rx_ptr = 0;
+
+  poll_start(&w, &POLL_SPI_STREAM);
+  while (remaining_total_bytes > 0) {
+    if (drain) {
+      level = axi_read(FA_QSPI, FA_QSPI_RDFIFO, FA_EXP_OFF, FA_EXP_0123, "flash_op-fo_stream: read  RDFIFO (DRR occupancy - 1)");
+      level = (level == 0) ? 0 : level + 1;
+      n     = level & ~0x3;                        // Whole words, the Byte Expander reads 4 bytes at a time
+      if (n > 0) {
+        fo_unpack_DRR(rdata, rx_ptr, skip_bytes, n, 0);      // The master is still shifting
+        rx_ptr    = rx_ptr + n;
+        in_flight = in_flight - n;
+      }
+      free = FIFO_DEPTH - in_flight;
+    } else {
+      level = axi_read(FA_QSPI, FA_QSPI_TXFIFO, FA_EXP_OFF, FA_EXP_0123, "flash_op-fo_stream: read  TXFIFO (DTR occupancy - 1)") + 1;
+      free  = FIFO_DEPTH - level;
+    }
+    if (remaining_total_bytes >= 4) free = free & ~0x3;   // Top up in whole words, single bytes only for the tail
+    if (free < 4 && free < remaining_total_bytes) {   // Not worth a top up yet
+      if (poll_again(&w) != 0) {
         ERRORS_DETECTED++;
-        printf("(flash_op-fo_read_DRR):  *** ERROR - SPISR[0]=0 indicating RX FIFO is not Empty after all %d bytes were read\n", load_bytes);
+        printf("(flash_op-fo_stream):  *** ERROR - QSPI FIFOs did not move for %ld ms with %d bytes left to send ***\n", POLL_SPI_STREAM.timeout_us / 1000, remaining_total_bytes);
+        return;
       }
+      continue;
     }
-
-  }  // ((dir == FO_DIR_XCHG || dir == FO_DIR_RD) || (dir == FO_DIR_WR && FLASH_OP_CHECK == FO_CHK_ON))
-  else {
-    // On an unchecked FLASH write, the shifted out data is ignored. Therefore skip reading DRR FIFO and fill in return array with h00.
-    if (debug == 1) printf("flash_op-fo_read_DRR: Skipping read of DRR FIFO, returning h00 in all bytes\n");
-    for (i=0; i < load_bytes; i++) {
-       *(drr_data+i) = 0x00;
+    poll_end(&w);
+
+    while (remaining_total_bytes > 0 && free > 0) {   // Top up the DTR
+      if (remaining_total_bytes >= 4 && free >= 4) {
+        axi_wdata = fo_wword(wdata, wdata_ptr);
+        axi_write_post(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_ON, FA_EXP_3210, axi_wdata, "flash_op-fo_stream: write SPIDTR  (4 bytes of wdata)");
+        n = 4;
+      } else {
+        axi_wdata = 0x00000000 | fo_wbyte(wdata, wdata_ptr);
+        axi_write_post(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_OFF, FA_EXP_3210, axi_wdata, "flash_op-fo_stream: write SPIDTR  (1 byte of wdata)");
+        n = 1;
+      }
+      wdata_ptr             = wdata_ptr + n;
+      remaining_total_bytes = remaining_total_bytes - n;
+      free                  = free - n;
+      in_flight             = in_flight + n;
     }
+    axi_fence("flash_op-fo_stream: fence SPIDTR  (top up complete)");
+    poll_start(&w, &POLL_SPI_STREAM);
   }
+  poll_end(&w);
+
+  // All bytes are in the DTR: wait for it to empty, then take what is left in the DRR
+  axi_rdata = axi_poll(FA_QSPI, FA_QSPI_SPISR, 0x00000004, 0x00000004, &POLL_DTR_EMPTY, "flash_op-fo_stream: read  SPISR  (wait for [2] Tx_Empty)");
+  if (drain && in_flight > 0) fo_unpack_DRR(rdata, rx_ptr, skip_bytes, in_flight, 1);
 
+  // The DTR may have run dry on the way, leaving IPISR[2] (DTR Empty) set. Clear it as fo_wait_for_DTR_FIFO_empty() would.
+  axi_rdata = axi_read(FA_QSPI, FA_QSPI_IPISR, FA_EXP_OFF, FA_EXP_0123, "flash_op-fo_stream: read  IPISR  (is [2] DTR Empty set)");
+  if (axi_rdata & 0x00000004)
+    axi_write_post(FA_QSPI, FA_QSPI_IPISR, FA_EXP_OFF, FA_EXP_0123, 0x00000004, "flash_op-fo_stream: write IPISR  (clear [2] to prepare for next write to DTR FIFO)");
   return;
 }
 
 
 
 // --------------------------------------------------------------------------------------------------------
-// FLASH OPeration
-void flash_op(                      // The SPI interface shifts data in while simultaneously shifting data out, thus "read" is the same as a "write".
-               u32  devsel          // Select FLASH device to target (use SPISSR_SEL_DEV1 or SPISSR_SEL_DEV2)
-             , byte cmd             // Command to sent to FLASH
-             , u32  addr            // 0-4 bytes of address to target in FLASH (1B addr in [7:0], 2B in [15:0], 3B in [23:0], 4B in [31:0])
-             , int  num_addr        // Number of address bytes (usually 0 or 3 depending on cmd, 3 max)
-             , int  num_dummy       // Number of dummy cycles (0 to 10 for Micron FLASH parts)
-             , int  num_bytes       // Number of data bytes, 0-N
-             , byte *wdata          // Reference to array of bytes to write to FLASH  (note: wdata and rdata arrays should be the same size)
-             , byte *rdata          // Reference to array of bytes to place data read from FLASH
-             , int  dir             // Skip some steps based on the direction of the FLASH operation (FO_DIR_XCHG, FO_DIR_RD, FO_DIR_WR)
-             , char *s              // Comment to be printed in trace string
-             )
+// FLASH sessions
+// - A command sequence on one FLASH (WRITE ENABLE, PAGE PROGRAM, READ STATUS REGISTER until ready) is bracketed by
+//   flash_session_begin() and flash_session_end(). The device is selected in SPISSR once, and flash_op() no longer
+//   writes SPISSR nor resets the FIFOs before each command: it only enables the master for the transfer and inhibits it
+//   again, resetting both FIFOs with the same SPICR write so the next command starts clean.
+// - The core runs with automatic slave select (SPICR[7]=0), so chip select is asserted only while the master is enabled:
+//   the master inhibit between commands is what ends one FLASH command and starts the next.
+// - flash_op() on another device than the session's goes through the full select / deselect, and leaves the session's
+//   device selected afterwards. With FLASH_SESSIONS = FSS_OFF, begin and end do nothing.
+// --------------------------------------------------------------------------------------------------------
+static u32 FO_SESSION = SPISSR_SEL_NONE;   // Device selected by the open session
+
+void flash_session_begin(u32 devsel)
+{
+  if (FLASH_SESSIONS == FSS_OFF) return;
+  if (FO_SESSION == devsel) return;                          // Selected already
+  if (TRC_FLASH_CMD == TRC_ON) printf("flash_session_begin: devsel %s\n", flash_devsel_as_str(devsel));
+  if (FO_SESSION != SPISSR_SEL_NONE) {   // The last command of the other device left the FIFOs reset, the master inhibited
+    axi_write(FA_QSPI, FA_QSPI_SPISSR, FA_EXP_OFF, FA_EXP_0123, devsel, "flash_session_begin: write SPISSR (move the session to another device)");
+    FO_SESSION = devsel;
+    return;
+  }
+
+  axi_write(FA_QSPI, FA_QSPI_SPISSR, FA_EXP_OFF, FA_EXP_0123, devsel, "flash_session_begin: write SPISSR (activate device select for the session)");
+  axi_write(FA_QSPI, FA_QSPI_SPICR, FA_EXP_OFF, FA_EXP_0123, 0x00000166, "flash_session_begin: write SPICR  (Reset RX & TX FIFOs, master inhibited)");
+  FO_SESSION = devsel;
+  return;
+}
+
+void flash_session_end(void)
+{
+  if (FO_SESSION == SPISSR_SEL_NONE) return;
+  if (TRC_FLASH_CMD == TRC_ON) printf("flash_session_end: devsel %s\n", flash_devsel_as_str(FO_SESSION));
+
+  FO_SESSION = SPISSR_SEL_NONE;
+  axi_write(FA_QSPI, FA_QSPI_SPISSR, FA_EXP_OFF, FA_EXP_0123, SPISSR_SEL_NONE, "flash_session_end: write SPISSR (disable all chip selects)");
+  return;
+}
+
+
+
+// --------------------------------------------------------------------------------------------------------
+// FLASH command from a template, see FO_TEMPLATE
+void flash_cmd(                     // The SPI interface shifts data in while simultaneously shifting data out, thus "read" is the same as a "write".
+                u32  devsel         // Select FLASH device to target (use SPISSR_SEL_DEV1 or SPISSR_SEL_DEV2)
+              , fo_template *t      // Command, address and dummy bytes, direction
+              , u32  addr           // Address, if the command has one (t->num_addr bytes of it are sent)
+              , int  num_bytes      // Number of data bytes, 0-N
+              , byte *wdata         // Reference to array of bytes to write to FLASH, NULL to send zeros (note: wdata and rdata arrays should be the same size)
+              , byte *rdata         // Reference to array of bytes to place data read from FLASH, NULL to discard. Not written by a write command
+              )                     //   unless the op is checked (FLASH_OP_CHECK).
 {
   int  debug = 0;                // Internal debug. 0=no debug msgs, 1=some debug msgs, 2=all debug msgs
 
   u32  axi_wdata, axi_rdata;
   int  i, j;
 
-  byte header_array[16];                  // 1 cmd + 3 addr + 10 dummy (max) + pad with first few data bytes
-                                          //   Why 16? It is the minimum DTR FIFO size in the Quad SPI core. Also it is a multiple of 4 which
-                                          //   allows config_write operations to use the Byte Expander to send 4 bytes at a time to the DTR FIFO.
+  byte header_array[16];                  // 1 cmd + 4 addr + 10 dummy (max) + pad with the first data bytes up to a multiple of 4
+                                          //   Why 16? It is the minimum DTR FIFO size in the Quad SPI core. The padding lets config_write
+                                          //   operations use the Byte Expander to send 4 bytes at a time to the DTR FIFO, the data after it
+                                          //   is packed into SPIDTR writes straight from wdata.
   int  header_bytes;                      // Number of bytes in header_array to send
   int  header_ptr;                        // Index into header_array
   int  remaining_header_bytes;            // Number of free bytes remaining in header array
 
-  int  wdata_ptr, rdata_ptr;              // Index into wdata/rdata arrays where next byte should be written
+  int  wdata_ptr;                         // Index into wdata array of the next byte to send
+  int  rx_ptr;                            // Shifted out bytes read from the DRR so far, see fo_unpack_DRR()
   int  remaining_total_bytes;             // Total number of bytes remaining to be sent to FLASH
   int  remaining_fifo_bytes;              // Number of bytes remaining to be sent in this iteration of loading/sending the DTR FIFO
 
@@ -1059,18 +1677,14 @@ void flash_op(                      // The SPI interface shifts data in while si
 
   char ds[4096], ds_elt[10];              // buffer for debug traces
 
-  byte drr_data[FIFO_DEPTH];              // Temporary storage for data captured by DRR FIFO after shift to FLASH
-  int  drr_ptr;                           // Pointer into 'drr_data'
   int  skip_bytes;                        // Number of bytes to skip over which contain shift out from cmd, addr, dummy cycles
+  int  in_session;                        // 1 if devsel is selected by the open FLASH session, see flash_session_begin()
+  int  drr_count;                         // 1 if the bytes of a refill are counted in the DRR instead of reading back each SPIDTR write
 
-  if (TRC_FLASH == TRC_ON) {
-    // Save arguments as a string for easier printing later
-    snprintf(ds, sizeof(ds),
-	     "devsel %s, cmd h%2X, addr h%8X, num_addr %2d, num_dummy %2d, num_bytes %d, dir %s <%s>",
-	     flash_devsel_as_str(devsel), cmd, addr, num_addr, num_dummy,
-	     num_bytes, fo_dir_as_str(dir), s);
-    printf("trace  flash_op        %s\n", ds);
-  }
+  int  dir = t->dir;                      // Skip some steps based on the direction of the FLASH operation
+  char *s  = t->name;
+
+  trace_record(TRC_EV_FLASH_OP, devsel, addr, t->cmd | (t->num_addr << 8) | (t->num_dummy << 16) | (dir << 24), num_bytes, s);
 
   if (TRC_FLASH == TRC_ON) {
     // Create printable string of write data (up to first 16 bytes)
@@ -1080,7 +1694,7 @@ void flash_op(                      // The SPI interface shifts data in while si
       j = 16;
     ds[0] = '\0';
     for (i = 0; i < j; i++) {
-      snprintf(ds_elt, sizeof(ds_elt), "%2.2X ", wdata[i]);
+      snprintf(ds_elt, sizeof(ds_elt), "%2.2X ", fo_wbyte(wdata, i));
       strcat(ds, ds_elt);
     }
     if (num_bytes > 16)
@@ -1088,37 +1702,32 @@ void flash_op(                      // The SPI interface shifts data in while si
     printf("trace  flash_op          (hex) wdata[] = %s\n", ds);
   }
 
-  // Check validity of arguements
-  if (num_addr > 4) {
-    ERRORS_DETECTED++;
-    printf("(flash_op):  *** ERROR - num_addr (%d) is not in the range 0,1,2,3,4 ***\n", num_addr);
-    return;   // ABORT
-  }
-  if (num_dummy > 10) {  // For Micron FLASH, largest number of dummy cycles is 10
-    ERRORS_DETECTED++;
-    printf("(flash_op):  *** ERROR - num_dummy (%d) is not in the range 0 through 10 inclusive ***\n", num_dummy);
-    return;   // ABORT
-  }
   if (num_bytes < 0) {
     ERRORS_DETECTED++;
     printf("(flash_op):  *** ERROR - num_bytes (%d) is less than 0 ***\n", num_bytes);
     return;   // ABORT
   }
 
-  // Activate device select for targeted device
-  axi_wdata = devsel;
-  axi_write(FA_QSPI, FA_QSPI_SPISSR, FA_EXP_OFF, FA_EXP_0123, axi_wdata, "flash_op: write SPISSR (activate device select for targeted device)");
+  fo_check_begin();
 
-  // SPICR (SPI Control Register) - default h180, [8]=disable master transactions, [6:5]=reset RX,TX FIFOs, [2]=master config, [1]=SPI enable
-  axi_wdata = 0x00000166;  // {22'b0,10'b01_0110_0110};
-  axi_write(FA_QSPI, FA_QSPI_SPICR, FA_EXP_OFF, FA_EXP_0123, axi_wdata, "flash_op: write SPICR  (Reset RX & TX FIFOs)");
+  // Inside a session the device is already selected, and the previous command left the FIFOs reset
+  in_session = (FO_SESSION != SPISSR_SEL_NONE && FO_SESSION == devsel);
+  if (!in_session) {
+    // Activate device select for targeted device
+    axi_wdata = devsel;
+    axi_write(FA_QSPI, FA_QSPI_SPISSR, FA_EXP_OFF, FA_EXP_0123, axi_wdata, "flash_op: write SPISSR (activate device select for targeted device)");
 
-  // SPICR (SPI Control Register) - [6:5]=unreset RX,TX FIFOs
-  axi_wdata = 0x00000106;  // {22'b0,10'b01_0000_0110};
-  axi_write(FA_QSPI, FA_QSPI_SPICR, FA_EXP_OFF, FA_EXP_0123, axi_wdata, "flash_op: write SPICR  (Remove reset from RX & TX FIFOs)");
+    // SPICR (SPI Control Register) - default h180, [8]=disable master transactions, [6:5]=reset RX,TX FIFOs, [2]=master config, [1]=SPI enable
+    axi_wdata = 0x00000166;  // {22'b0,10'b01_0110_0110};
+    axi_write(FA_QSPI, FA_QSPI_SPICR, FA_EXP_OFF, FA_EXP_0123, axi_wdata, "flash_op: write SPICR  (Reset RX & TX FIFOs)");
+
+    // SPICR (SPI Control Register) - [6:5]=unreset RX,TX FIFOs
+    axi_wdata = 0x00000106;  // {22'b0,10'b01_0000_0110};
+    axi_write(FA_QSPI, FA_QSPI_SPICR, FA_EXP_OFF, FA_EXP_0123, axi_wdata, "flash_op: write SPICR  (Remove reset from RX & TX FIFOs)");
+  }
 
   // If all works properly, IPISR[2] (DTR Empty) should be 0 after FIFO reset
-  if (FLASH_OP_CHECK == FO_CHK_ON) {
+  if (FO_CHECK) {
     axi_rdata = axi_read(FA_QSPI, FA_QSPI_IPISR, FA_EXP_OFF, FA_EXP_0123, "flash_op: read  IPISR  (check bit [2] (DTR Empty) is 0 after FIFO reset)");
     if ((axi_rdata & 0x00000004) != 0x00000000) {  // If [2] of [31:0] is not set
       ERRORS_DETECTED++;
@@ -1128,42 +1737,16 @@ void flash_op(                      // The SPI interface shifts data in while si
   }
 
   //printf("Flash op checkpoint 1\n");
-  // Assemble header array containing cmd, addr, dummy cycles, and data to pad it
-  header_array[0] = cmd;
-  switch (num_addr)
-    { case 0: header_ptr = 1;
-              break;
-      case 1: header_array[1] = (byte)  (addr & 0x000000FF);               // Cast to byte to reduce from 32 bits to 8 bits
-              header_ptr = 2;
-              break;
-      case 2: header_array[1] = (byte) ((addr & 0x0000FF00) >>  8);
-              header_array[2] = (byte)  (addr & 0x000000FF);
-              header_ptr = 3;
-              break;
-      case 3: header_array[1] = (byte) ((addr & 0x00FF0000) >> 16);
-              header_array[2] = (byte) ((addr & 0x0000FF00) >>  8);
-              header_array[3] = (byte)  (addr & 0x000000FF);
-              header_ptr = 4;
-              break;
-      case 4: header_array[1] = (byte) ((addr & 0xFF000000) >> 24);
-              header_array[2] = (byte) ((addr & 0x00FF0000) >> 16);
-              header_array[3] = (byte) ((addr & 0x0000FF00) >>  8);
-              header_array[4] = (byte)  (addr & 0x000000FF);
-              header_ptr = 5;
-              break;
-      default: ERRORS_DETECTED++;   // Shouldn't happen if argument check above is in place
-               printf("(flash_op):  *** ERROR - num_addr (%d) is not in the range 0,1,2,3,4 ***\n", num_addr);
-               return;   // ABORT
-    }
-  for (i = 0; i < num_dummy; i++) {   // Fill dummy cycles with pad bytes
-    header_array[header_ptr] = 0x00;
-    header_ptr++;
-  }
+  // Header array from the template (cmd, dummy cycles), with the address filled in and data to pad it
+  memcpy(header_array, t->header, t->header_bytes);
+  for (i = 1; i <= t->num_addr; i++)
+    header_array[i] = (byte) (addr >> (8 * (t->num_addr - i)));   // Most significant address byte first
+  header_ptr = t->header_bytes;
   wdata_ptr = 0;                                // Initialize data array pointers
-  remaining_header_bytes = 16 - header_ptr;     // Determine amount of space left in header
+  remaining_header_bytes = (4 - (header_ptr % 4)) % 4;   // Pad to a whole word
   if (num_bytes <= remaining_header_bytes) {    // There is room in the header for all data bytes (i.e. cmd has 1 byte of data)
     for (i=0; i < num_bytes; i++) {             // Copy all data into header array
-      header_array[header_ptr] = *(wdata + wdata_ptr);
+      header_array[header_ptr] = fo_wbyte(wdata, wdata_ptr);
       header_ptr++;
       wdata_ptr++;
     }
@@ -1173,7 +1756,7 @@ void flash_op(                      // The SPI interface shifts data in while si
   }
   else {                                                           // There is more data to send than remains in the header.
     for (i=0; i < remaining_header_bytes; i++) {                   // Fill up the remaining space in the header array with data.
-      header_array[header_ptr] = *(wdata + wdata_ptr);
+      header_array[header_ptr] = fo_wbyte(wdata, wdata_ptr);
       header_ptr++;
       wdata_ptr++;
     }
@@ -1193,33 +1776,30 @@ void flash_op(                      // The SPI interface shifts data in while si
   }
 
   // With Slave Select off, write first set of bytes, containing header and as many additional data as DTR FIFO can hold
+  // - The SPIDTR writes are posted, and checked together at the fence before the SPI master is enabled
   for (i=0; (i+3) < header_bytes; i=i+4) {  // Load groups of 4 bytes first from header array
     axi_wdata = (header_array[i] << 24) | (header_array[i+1] << 16) | (header_array[i+2] << 8) | header_array[i+3];
-    sprintf(ds,"flash_op: write SPIDTR  (header_array[%d:%d])", i, i+3);
-    axi_write(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_ON, FA_EXP_3210, axi_wdata, ds);
+    axi_write_post(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_ON, FA_EXP_3210, axi_wdata, "flash_op: write SPIDTR  (4 bytes of header_array)");
   }
   while (i < header_bytes) {                // Load individual bytes that may remain in header array
     axi_wdata = 0x00000000 | header_array[i];
-    sprintf(ds,"flash_op: write SPIDTR  (header_array[%d])", i);
-    axi_write(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_OFF, FA_EXP_3210, axi_wdata, ds);
+    axi_write_post(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_OFF, FA_EXP_3210, axi_wdata, "flash_op: write SPIDTR  (1 byte of header_array)");
     i++;
   }
   fifo_bytes = i;  // Note: max size of header_array = 16 which is smallest DTR FIFO allowed, so no risk of overrun when loading header
   if (debug >= 2) printf("flash_op (debug) - (at A) remaining_total_bytes = %d, remaining_fifo_bytes = %d\n", remaining_total_bytes, remaining_fifo_bytes);
   while (remaining_total_bytes > 0 && remaining_fifo_bytes > 0) {   // Fill FIFO with as much remaining data as possible
     if (remaining_total_bytes >= 4 && remaining_fifo_bytes >= 4) {
-      axi_wdata = (*(wdata+wdata_ptr) << 24) | (*(wdata+wdata_ptr+1) << 16) | (*(wdata+wdata_ptr+2) << 8) | *(wdata+wdata_ptr+3);
-      sprintf(ds,"flash_op: write SPIDTR  (wdata[%d:%d])", wdata_ptr, wdata_ptr+3);
-      axi_write(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_ON, FA_EXP_3210, axi_wdata, ds);
+      axi_wdata = fo_wword(wdata, wdata_ptr);
+      axi_write_post(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_ON, FA_EXP_3210, axi_wdata, "flash_op: write SPIDTR  (4 bytes of wdata)");
       wdata_ptr             = wdata_ptr + 4;
       remaining_total_bytes = remaining_total_bytes - 4;
       remaining_fifo_bytes  = remaining_fifo_bytes  - 4;
       fifo_bytes            = fifo_bytes + 4;
     }
     else {   // less than 4 bytes to send or less than 4 bytes in DTR FIFO
-      axi_wdata = 0x00000000 | wdata[wdata_ptr];
-      sprintf(ds,"flash_op: write SPIDTR  (wdata[%d])", wdata_ptr);
-      axi_write(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_OFF, FA_EXP_3210, axi_wdata, ds);
+      axi_wdata = 0x00000000 | fo_wbyte(wdata, wdata_ptr);
+      axi_write_post(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_OFF, FA_EXP_3210, axi_wdata, "flash_op: write SPIDTR  (1 byte of wdata)");
       wdata_ptr++;
       remaining_total_bytes--;
       remaining_fifo_bytes--;
@@ -1229,54 +1809,53 @@ void flash_op(                      // The SPI interface shifts data in while si
   }
 
   //printf("Flash op checkpoint 2\n");
-  // Instruct QSPI to send DTR contents to FLASH
-  // SPICR (SPI Control Register) - enable Master to drive SPI (starts CCLK and transfer) by disabling Master Transaction Inhibit (bit [8])
-  axi_wdata = 0x00000006;  // {22'b0,10'b00_0000_0110};
-  axi_write(FA_QSPI, FA_QSPI_SPICR, FA_EXP_OFF, FA_EXP_0123, axi_wdata, "flash_op: write SPICR  ([8]=0 to enable master to drive SPI)");
+  axi_fence("flash_op: fence SPIDTR  (DTR FIFO fill complete, before enabling the SPI master)");
 
-  // Wait for DTR contents to be transferred. When complete, DRR FIFO contains shifted out bytes.
-  fo_wait_for_DTR_FIFO_empty();
-
-  // Read specified number of bytes from DRR FIFO
-  fo_read_DRR(drr_data, fifo_bytes, dir);
-
-  // Transfer read bytes to return array, removing cmd, addr, and dummy bytes as needed
-  rdata_ptr  = 0;              // Initialize array pointer (once at first time reading DRR FIFO)
-  drr_ptr    = 0;              // Initialize array pointer (every time fo_read_DRR() is called)
-  skip_bytes = 1 + num_addr + (num_dummy/2);   // Ignore the first bytes returned if they are for (cmd, addr, dummy) cycles
-    // IMPORTANT: The assumption is dummy cycles only occur on bulk data movement which will use Quad mode on the SPI bus. This means
-    //            every dummy cycle captures 4 bits from the FLASH, so 2 cycles equal a byte. Furthermore it assumes num_dummy will
-    //            be an even number, which from the Micron spec appears to be true in all cases. If dummy cycles are used with non-Quad SPI
-    //            commands, then another solution needs to be found; like determining the number of dummy bytes from a look up table
-    //            based on the 'cmd' value (which is how the Quad SPI IP core does it).
-  drr_ptr    = skip_bytes;
-  for (i = skip_bytes; i < fifo_bytes; i++) {       // Starting with first real data byte, copy read byts into the return data array
-    *(rdata + rdata_ptr) = *(drr_data + drr_ptr);
-    if (debug >= 2) printf("flash_op (debug): DATA COPY (header) - rdata_ptr (%d) h%2X, drr_ptr (%d) h%2X\n",
-      rdata_ptr, *(rdata+rdata_ptr), drr_ptr, *(drr_data+drr_ptr) );
-    rdata_ptr++;
-    drr_ptr++;
+  // Instruct QSPI to send DTR contents to FLASH
+  // SPICR (SPI Control Register) - enable Master to drive SPI (starts CCLK and transfer) by disabling Master Transaction Inhibit (bit [8])
+  axi_wdata = 0x00000006;  // {22'b0,10'b00_0000_0110};
+  axi_write(FA_QSPI, FA_QSPI_SPICR, FA_EXP_OFF, FA_EXP_0123, axi_wdata, "flash_op: write SPICR  ([8]=0 to enable master to drive SPI)");
+
+  rx_ptr     = 0;
+  skip_bytes = t->skip_bytes;  // Ignore the first bytes returned if they are for (cmd, addr, dummy) cycles, see FO_TEMPLATE
+
+  // Streaming engine: the rest of the transfer overlaps DTR top ups and DRR reads with the SPI master running.
+  // Operations that fit in the first fill (status reads, WREN, ...) have nothing to overlap and stay lockstep.
+  if (FLASH_OP_ENGINE == FOE_STREAM && remaining_total_bytes > 0) {
+    fo_stream(wdata, wdata_ptr, remaining_total_bytes, rdata, fifo_bytes, skip_bytes, dir);
+    remaining_total_bytes = 0;
+    fifo_bytes            = 0;   // Nothing for the lockstep steps below
+  } else {
+    // Wait for DTR contents to be transferred. When complete, DRR FIFO contains shifted out bytes.
+    fo_wait_for_DTR_FIFO_empty();
   }
 
+  // Read specified number of bytes from DRR FIFO into the return array, removing cmd, addr, and dummy bytes as needed.
+  // An unchecked write leaves them in the DRR, the FIFO reset of the next command drops them.
+  if (fifo_bytes > 0 && fo_wants_DRR(dir)) fo_unpack_DRR(rdata, rx_ptr, skip_bytes, fifo_bytes, 1);
+  rx_ptr = rx_ptr + fifo_bytes;
+
   // while (remaining_total_bytes > 0),
   while (remaining_total_bytes > 0) {
     if (debug >= 2) printf("flash_op (debug) - (at C) remaining_total_bytes = %d, remaining_fifo_bytes = %d\n", remaining_total_bytes, remaining_fifo_bytes);
     remaining_fifo_bytes = FIFO_DEPTH;   // Clear counts relative to the FIFO
     fifo_bytes = 0;
+    // The master runs while the DTR is refilled, so the fill level can't check the posted writes. When the DRR is read
+    // anyway, one RDFIFO read after the drain counts the bytes that made it, in place of a read back per write.
+    drr_count = fo_wants_DRR(dir) && remaining_total_bytes >= 2;
+    AXI_PW.dtr_counted = drr_count;
     while (remaining_total_bytes > 0 && remaining_fifo_bytes > 0) {   // Fill FIFO with as much remaining data as possible
       if (remaining_total_bytes >= 4 && remaining_fifo_bytes >= 4) {
-        axi_wdata = (*(wdata+wdata_ptr) << 24) | (*(wdata+wdata_ptr+1) << 16) | (*(wdata+wdata_ptr+2) << 8) | *(wdata+wdata_ptr+3);
-        sprintf(ds,"flash_op: write SPIDTR  (wdata[%d:%d])", wdata_ptr, wdata_ptr+3);
-        axi_write(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_ON, FA_EXP_3210, axi_wdata, ds);
+        axi_wdata = fo_wword(wdata, wdata_ptr);
+        axi_write_post(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_ON, FA_EXP_3210, axi_wdata, "flash_op: write SPIDTR  (4 bytes of wdata)");
         wdata_ptr             = wdata_ptr + 4;
         remaining_total_bytes = remaining_total_bytes - 4;
         remaining_fifo_bytes  = remaining_fifo_bytes  - 4;
         fifo_bytes            = fifo_bytes + 4;
       }
       else {   // less than 4 bytes to send or less than 4 bytes in DTR FIFO
-        axi_wdata = 0x00000000 | wdata[wdata_ptr];
-        sprintf(ds,"flash_op: write SPIDTR  (wdata[%d])", wdata_ptr);
-        axi_write(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_OFF, FA_EXP_3210, axi_wdata, ds);
+        axi_wdata = 0x00000000 | fo_wbyte(wdata, wdata_ptr);
+        axi_write_post(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_OFF, FA_EXP_3210, axi_wdata, "flash_op: write SPIDTR  (1 byte of wdata)");
         wdata_ptr++;
         remaining_total_bytes--;
         remaining_fifo_bytes--;
@@ -1289,35 +1868,44 @@ void flash_op(                      // The SPI interface shifts data in while si
     // SPICR (SPI Control Register) - enable Master to drive SPI (starts CCLK and transfer) by disabling Master Transaction Inhibit (bit [8])
 
     // Wait for DTR contents to be transferred. When complete, DRR FIFO contains shifted out bytes.
+    axi_fence("flash_op: fence SPIDTR  (DTR FIFO fill complete, before waiting for it to drain)");
+    AXI_PW.dtr_counted = 0;
     fo_wait_for_DTR_FIFO_empty();
-
-    // Read specified number of bytes from DRR FIFO
-    fo_read_DRR(drr_data, fifo_bytes, dir);
-
-    // Transfer read bytes to return array, removing cmd, addr, and dummy bytes as needed
-    drr_ptr = 0;      // Initialize array pointer (every time fo_read_DRR() is called)
-    for (i = 0; i < fifo_bytes; i++) {       // Append read bytes into the return data array
-      *(rdata + rdata_ptr) = *(drr_data + drr_ptr);
-      if (debug >= 2) printf("flash_op (debug): DATA COPY (block data) - rdata_ptr (%d) h%2X, drr_ptr (%d) h%2X\n",
-        rdata_ptr, *(rdata+rdata_ptr), drr_ptr, *(drr_data+drr_ptr) );
-      rdata_ptr++;
-      drr_ptr++;
+    if (drr_count) {
+      axi_rdata = axi_read(FA_QSPI, FA_QSPI_RDFIFO, FA_EXP_OFF, FA_EXP_0123, "flash_op: read  RDFIFO (DRR occupancy - 1, bytes of the refill that reached the FLASH)") + 1;
+      if (axi_rdata != (u32) fifo_bytes) {
+        ERRORS_DETECTED++;
+        printf("(flash_op):  *** ERROR - %d of %d bytes written to the DTR FIFO reached the FLASH (%s, data byte %d of %d) ***\n",
+               (axi_rdata == 1) ? 0 : (int) axi_rdata, fifo_bytes, s, wdata_ptr - fifo_bytes, num_bytes);
+      }
     }
 
+    // Append the bytes of the refill from DRR FIFO to the return array
+    if (fo_wants_DRR(dir)) fo_unpack_DRR(rdata, rx_ptr, skip_bytes, fifo_bytes, 1);
+    rx_ptr = rx_ptr + fifo_bytes;
+
   } // while (remaining_total_bytes > 0) {
 
   //printf("Flash op checkpoint 3\n");
   // At this point, all data is transferred, return the QSPI core back to an inactive state, awaiting the next command
 
-  // SPICR (SPI Control Register) - disable master transactions
-  axi_wdata = 0x00000106;  // {22'b0,10'b01_0000_0110};
-  axi_write(FA_QSPI, FA_QSPI_SPICR, FA_EXP_OFF, FA_EXP_0123, axi_wdata, "flash_op: write SPICR  ([8]=1 to disable master transactions)");
+  if (in_session) {
+    // SPICR (SPI Control Register) - disable master transactions (ends the command), and reset the FIFOs for the next one.
+    // A write command leaves its shifted out bytes in the DRR unless the op is checked.
+    axi_wdata = 0x00000166;  // {22'b0,10'b01_0110_0110};
+    axi_write(FA_QSPI, FA_QSPI_SPICR, FA_EXP_OFF, FA_EXP_0123, axi_wdata, "flash_op: write SPICR  ([8]=1 to disable master transactions, reset RX & TX FIFOs)");
+  }
+  else {
+    // SPICR (SPI Control Register) - disable master transactions
+    axi_wdata = 0x00000106;  // {22'b0,10'b01_0000_0110};
+    axi_write(FA_QSPI, FA_QSPI_SPICR, FA_EXP_OFF, FA_EXP_0123, axi_wdata, "flash_op: write SPICR  ([8]=1 to disable master transactions)");
 
-  // When no more data to this device, disable chip select
-  axi_wdata = SPISSR_SEL_NONE;
-  axi_write(FA_QSPI, FA_QSPI_SPISSR, FA_EXP_OFF, FA_EXP_0123, axi_wdata, "flash_op: write SPISSR (disable all chip selects)");
+    // When no more data to this device, disable chip select (or go back to the device of an open session)
+    axi_wdata = FO_SESSION;
+    axi_write(FA_QSPI, FA_QSPI_SPISSR, FA_EXP_OFF, FA_EXP_0123, axi_wdata, "flash_op: write SPISSR (disable all chip selects)");
+  }
 
-  if (TRC_FLASH == TRC_ON) {
+  if (TRC_FLASH == TRC_ON && rdata != NULL) {
     // Create printable string of read data
     if (num_bytes <= 16)
       j = num_bytes;
@@ -1331,6 +1919,7 @@ void flash_op(                      // The SPI interface shifts data in while si
     printf("trace  flash_op        %s\n\n", ds);
   }
 
+  fo_check_end(s);
   FLASH_OP_COUNT++;    // Bump FLASH operation count
 
   //printf("Flash op checkpoint 4\n");
@@ -1338,6 +1927,42 @@ void flash_op(                      // The SPI interface shifts data in while si
 }
 
 
+// --------------------------------------------------------------------------------------------------------
+// FLASH OPeration
+void flash_op(                      // The SPI interface shifts data in while simultaneously shifting data out, thus "read" is the same as a "write".
+               u32  devsel          // Select FLASH device to target (use SPISSR_SEL_DEV1 or SPISSR_SEL_DEV2)
+             , byte cmd             // Command to sent to FLASH
+             , u32  addr            // 0-4 bytes of address to target in FLASH (1B addr in [7:0], 2B in [15:0], 3B in [23:0], 4B in [31:0])
+             , int  num_addr        // Number of address bytes (usually 0 or 3 depending on cmd, 3 max)
+             , int  num_dummy       // Number of dummy cycles (0 to 10 for Micron FLASH parts)
+             , int  num_bytes       // Number of data bytes, 0-N
+             , byte *wdata          // Reference to array of bytes to write to FLASH  (note: wdata and rdata arrays should be the same size)
+             , byte *rdata          // Reference to array of bytes to place data read from FLASH
+             , int  dir             // Skip some steps based on the direction of the FLASH operation (FO_DIR_XCHG, FO_DIR_RD, FO_DIR_WR)
+             , char *s              // Comment to be printed in trace string
+             )
+{
+  fo_template t;
+
+  // Check validity of arguements
+  if (num_addr > 4) {
+    ERRORS_DETECTED++;
+    printf("(flash_op):  *** ERROR - num_addr (%d) is not in the range 0,1,2,3,4 ***\n", num_addr);
+    return;   // ABORT
+  }
+  if (num_dummy > 10) {  // For Micron FLASH, largest number of dummy cycles is 10
+    ERRORS_DETECTED++;
+    printf("(flash_op):  *** ERROR - num_dummy (%d) is not in the range 0 through 10 inclusive ***\n", num_dummy);
+    return;   // ABORT
+  }
+
+  t = (fo_template) FO_TEMPLATE(cmd, num_addr, num_dummy, dir, s);
+  flash_cmd(devsel, &t, addr, num_bytes, wdata, rdata);
+  return;
+}
+
+
+
 // --------------------------------------------------------------------------------------------------------
 // FLASH OPeration
 void flash_op_verbose(                      // The SPI interface shifts data in while simultaneously shifting data out, thus "read" is the same as a "write".
@@ -1371,16 +1996,13 @@ void flash_op_verbose(                      // The SPI interface shifts data in
 
   int  fifo_bytes;                        // How many bytes have been written into the DTR FIFO
 
-  char call_args[1024];                   // Buffers for easier printing
-  char ds[4096], ds_elt[10];
+  char ds[4096], ds_elt[10];              // Buffers for easier printing
 
   byte drr_data[FIFO_DEPTH];              // Temporary storage for data captured by DRR FIFO after shift to FLASH
   int  drr_ptr;                           // Pointer into 'drr_data'
   int  skip_bytes;                        // Number of bytes to skip over which contain shift out from cmd, addr, dummy cycles
 
-  // Save arguments as a string for easier printing later
-  sprintf(call_args,"devsel %s, cmd h%2X, addr h%8X, num_addr %2d, num_dummy %2d, num_bytes %d, dir %s <%s>",
-    flash_devsel_as_str(devsel), cmd, addr, num_addr, num_dummy, num_bytes, fo_dir_as_str(dir), s);
+  trace_record(TRC_EV_FLASH_OP, devsel, addr, cmd | (num_addr << 8) | (num_dummy << 16) | (dir << 24), num_bytes, s);
 
   if (TRC_FLASH == TRC_ON) {
     // Create printable string of write data (up to first 16 bytes)
@@ -1415,6 +2037,7 @@ void flash_op_verbose(                      // The SPI interface shifts data in
     return;   // ABORT
   }
 
+  fo_check_begin();
   printf("Flash OP checkpoint 1: About to do FPGA axi ops\n");
   // Activate device select for targeted device
   axi_wdata = devsel;
@@ -1431,7 +2054,7 @@ void flash_op_verbose(                      // The SPI interface shifts data in
   printf("Flash OP checkpoint 2: Got through first axi writes OK\n");
 
   // If all works properly, IPISR[2] (DTR Empty) should be 0 after FIFO reset
-  if (FLASH_OP_CHECK == FO_CHK_ON) {
+  if (FO_CHECK) {
     axi_rdata = axi_read(FA_QSPI, FA_QSPI_IPISR, FA_EXP_OFF, FA_EXP_0123, "flash_op: read  IPISR  (check bit [2] (DTR Empty) is 0 after FIFO reset)");
     if ((axi_rdata & 0x00000004) != 0x00000000) {  // If [2] of [31:0] is not set
       ERRORS_DETECTED++;
@@ -1512,13 +2135,11 @@ void flash_op_verbose(                      // The SPI interface shifts data in
   // With Slave Select off, write first set of bytes, containing header and as many additional data as DTR FIFO can hold
   for (i=0; (i+3) < header_bytes; i=i+4) {  // Load groups of 4 bytes first from header array
     axi_wdata = (header_array[i] << 24) | (header_array[i+1] << 16) | (header_array[i+2] << 8) | header_array[i+3];
-    sprintf(ds,"flash_op: write SPIDTR  (header_array[%d:%d])", i, i+3);
-    axi_write(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_ON, FA_EXP_3210, axi_wdata, ds);
+    axi_write(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_ON, FA_EXP_3210, axi_wdata, "flash_op: write SPIDTR  (4 bytes of header_array)");
   }
   while (i < header_bytes) {                // Load individual bytes that may remain in header array
     axi_wdata = 0x00000000 | header_array[i];
-    sprintf(ds,"flash_op: write SPIDTR  (header_array[%d])", i);
-    axi_write(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_OFF, FA_EXP_3210, axi_wdata, ds);
+    axi_write(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_OFF, FA_EXP_3210, axi_wdata, "flash_op: write SPIDTR  (1 byte of header_array)");
     i++;
   }
   printf("Flash OP checkpoint 5: Loaded bytes into header array OK\n");
@@ -1527,8 +2148,7 @@ void flash_op_verbose(                      // The SPI interface shifts data in
   while (remaining_total_bytes > 0 && remaining_fifo_bytes > 0) {   // Fill FIFO with as much remaining data as possible
     if (remaining_total_bytes >= 4 && remaining_fifo_bytes >= 4) {
       axi_wdata = (*(wdata+wdata_ptr) << 24) | (*(wdata+wdata_ptr+1) << 16) | (*(wdata+wdata_ptr+2) << 8) | *(wdata+wdata_ptr+3);
-      sprintf(ds,"flash_op: write SPIDTR  (wdata[%d:%d])", wdata_ptr, wdata_ptr+3);
-      axi_write(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_ON, FA_EXP_3210, axi_wdata, ds);
+      axi_write(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_ON, FA_EXP_3210, axi_wdata, "flash_op: write SPIDTR  (4 bytes of wdata)");
       wdata_ptr             = wdata_ptr + 4;
       remaining_total_bytes = remaining_total_bytes - 4;
       remaining_fifo_bytes  = remaining_fifo_bytes  - 4;
@@ -1536,8 +2156,7 @@ void flash_op_verbose(                      // The SPI interface shifts data in
     }
     else {   // less than 4 bytes to send or less than 4 bytes in DTR FIFO
       axi_wdata = 0x00000000 | wdata[wdata_ptr];
-      sprintf(ds,"flash_op: write SPIDTR  (wdata[%d])", wdata_ptr);
-      axi_write(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_OFF, FA_EXP_3210, axi_wdata, ds);
+      axi_write(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_OFF, FA_EXP_3210, axi_wdata, "flash_op: write SPIDTR  (1 byte of wdata)");
       wdata_ptr++;
       remaining_total_bytes--;
       remaining_fifo_bytes--;
@@ -1587,8 +2206,7 @@ void flash_op_verbose(                      // The SPI interface shifts data in
     while (remaining_total_bytes > 0 && remaining_fifo_bytes > 0) {   // Fill FIFO with as much remaining data as possible
       if (remaining_total_bytes >= 4 && remaining_fifo_bytes >= 4) {
         axi_wdata = (*(wdata+wdata_ptr) << 24) | (*(wdata+wdata_ptr+1) << 16) | (*(wdata+wdata_ptr+2) << 8) | *(wdata+wdata_ptr+3);
-        sprintf(ds,"flash_op: write SPIDTR  (wdata[%d:%d])", wdata_ptr, wdata_ptr+3);
-        axi_write(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_ON, FA_EXP_3210, axi_wdata, ds);
+        axi_write(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_ON, FA_EXP_3210, axi_wdata, "flash_op: write SPIDTR  (4 bytes of wdata)");
         wdata_ptr             = wdata_ptr + 4;
         remaining_total_bytes = remaining_total_bytes - 4;
         remaining_fifo_bytes  = remaining_fifo_bytes  - 4;
@@ -1596,8 +2214,7 @@ void flash_op_verbose(                      // The SPI interface shifts data in
       }
       else {   // less than 4 bytes to send or less than 4 bytes in DTR FIFO
         axi_wdata = 0x00000000 | wdata[wdata_ptr];
-        sprintf(ds,"flash_op: write SPIDTR  (wdata[%d])", wdata_ptr);
-        axi_write(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_OFF, FA_EXP_3210, axi_wdata, ds);
+        axi_write(FA_QSPI, FA_QSPI_SPIDTR, FA_EXP_OFF, FA_EXP_3210, axi_wdata, "flash_op: write SPIDTR  (1 byte of wdata)");
         wdata_ptr++;
         remaining_total_bytes--;
         remaining_fifo_bytes--;
@@ -1656,6 +2273,7 @@ void flash_op_verbose(                      // The SPI interface shifts data in
     printf("trace  flash_op        %s\n\n", ds);
   }
   printf("Flash OP checkpoint 15: Finished debug\n");
+  fo_check_end(s);
   FLASH_OP_COUNT++;    // Bump FLASH operation count
   printf("Flash OP checkpoint 16: Finished op increment\n");
   //printf("Flash op checkpoint 4\n");
@@ -1677,6 +2295,7 @@ void flash_setup(u32 devsel)   // Setup selected FLASH for 9V3 board usage (pass
   // Reset FLASH by performing RESET ENABLE, followed by RESET MEMORY
   fw_Reset_Enable(devsel);
   fw_Reset_Memory(devsel);
+  flash_caps_identify(devsel);   // READ ID and SFDP, before the address mode changes (READ SFDP takes a 3 byte address)
   fw_Write_Enable(devsel); // Collin Nov 18th, add this for 9H3 card 4-byte addressing set
   fw_Enter_4B_Adress_Mode(devsel); //rblack must enter 4B address mode for any modern fpga/flash size.
 #ifdef USE_SIM_TO_TEST
@@ -1694,6 +2313,8 @@ void flash_setup(u32 devsel)   // Setup selected FLASH for 9V3 board usage (pass
     ERRORS_DETECTED++;
     printf("(flash_setup):  *** ERROR - Write of Enhanced Volatile Configuration Register bit [4] to 0 failed (%s) ***\n", call_args);
   }
+  flash_busy_identify(devsel);   // Program / erase times of this part
+  flash_quad_identify(devsel);   // Data lanes of reads and programs
 
 #ifdef USE_SIM_TO_TEST
   // Remove sim workaround
@@ -1708,14 +2329,472 @@ void flash_setup(u32 devsel)   // Setup selected FLASH for 9V3 board usage (pass
 
 
 // --------------------------------------------------------------------------------------------------------
-void fr_wait_for_WRITE_IN_PROGRESS_to_clear(u32 devsel)     // Wait for 'WRITE IN PROGRESS' status bit to return to not busy state
+// FLASH capabilities (see flsh_sfdp.h)
+// - flash_caps_identify() reads READ ID and the SFDP space of a FLASH, then builds the commands the facility functions
+//   send to it: read, fast read, quad read, program and erase opcodes and dummy cycles come from its capabilities, in
+//   their 4-byte variant with FLASH_4B_OPCODES when the part has one. Before that, and for parts without SFDP, they are
+//   the ones of the Micron MT25Q.
+// - The tools program 256 byte pages and erase 64KB sectors: a part with smaller pages, or without a 64KB erase, is an error.
+// --------------------------------------------------------------------------------------------------------
+typedef struct {
+  int         identified;           // Capabilities and commands are set (defaults until flash_caps_identify() runs)
+  flash_caps  caps;
+  fo_template read, fast_read, program, erase_4k, erase_32k, erase_64k;   // Built from 'caps', cmd 0 if the part has none
+  fo_template die_erase;
+  fo_template quad_read, quad_program;
+  int         quad;                 // Reads (and programs, if the part has a quad program) move their data on 4 lanes
+  const char *quad_why;             // What flash_quad_identify() found, see flash_quad_lanes()
+} flash_dev;
+
+static flash_dev FLASH_DEVS[2];     // DEV1, DEV2
+
+static void flash_dev_build(flash_dev *d)   // Commands of the facility functions from the capabilities
+{ flash_caps *c = &d->caps;
+  flash_erase_type *e4k  = sfdp_erase_type(c, 0x1000);
+  flash_erase_type *e32k = sfdp_erase_type(c, 0x8000);
+  flash_erase_type *e64k = sfdp_erase_type(c, 0x10000);
+  int  b4 = (FLASH_4B_OPCODES == F4B_ON);
+
+  // 4-byte opcodes where the part has them, the others take the 4 byte address of the 4B address mode
+  if (b4 && c->read_cmd_4b != 0)      d->read      = (fo_template) FO_TEMPLATE   (c->read_cmd_4b,      4, 0, FO_DIR_RD, "4-BYTE READ");
+  else                                d->read      = (fo_template) FO_TEMPLATE   (c->read_cmd,         4, 0, FO_DIR_RD, "READ");
+  if (b4 && c->fast_read_cmd_4b != 0) d->fast_read = (fo_template) FO_TEMPLATE_X1(c->fast_read_cmd_4b, 4, 8, FO_DIR_RD, "4-BYTE FAST READ");
+  else                                d->fast_read = (fo_template) FO_TEMPLATE_X1(c->fast_read_cmd,    4, 8, FO_DIR_RD, "FAST READ");
+  if (b4 && c->program_cmd_4b != 0)   d->program   = (fo_template) FO_TEMPLATE   (c->program_cmd_4b,   4, 0, FO_DIR_WR, "4-BYTE PAGE PROGRAM");
+  else                                d->program   = (fo_template) FO_TEMPLATE   (c->program_cmd,      4, 0, FO_DIR_WR, "PAGE PROGRAM");
+  d->erase_4k  = (fo_template) FO_TEMPLATE((e4k  == NULL) ? 0 : (b4 && e4k->cmd_4b  != 0) ? e4k->cmd_4b  : e4k->cmd,  4, 0, FO_DIR_WR, "4KB SUBSECTOR ERASE");
+  d->erase_32k = (fo_template) FO_TEMPLATE((e32k == NULL) ? 0 : (b4 && e32k->cmd_4b != 0) ? e32k->cmd_4b : e32k->cmd, 4, 0, FO_DIR_WR, "32KB SUBSECTOR ERASE");
+  d->erase_64k = (fo_template) FO_TEMPLATE((e64k == NULL) ? 0 : (b4 && e64k->cmd_4b != 0) ? e64k->cmd_4b : e64k->cmd, 4, 0, FO_DIR_WR, "64KB SECTOR ERASE");
+  if (c->die_cmd == 0xC4) d->die_erase = (fo_template) FO_TEMPLATE(0xC4, 4, 0, FO_DIR_WR, "DIE ERASE");   // Addresses the die
+  else                    d->die_erase = (fo_template) FO_TEMPLATE(c->die_cmd, 0, 0, FO_DIR_WR, "CHIP ERASE");
+
+  // Quad commands: an odd dummy cycle count doesn't fill whole DTR bytes on 4 lanes, such a part stays on one lane
+  d->quad_read    = (fo_template) FO_TEMPLATE_X4((b4 && c->quad_read_cmd_4b != 0) ? c->quad_read_cmd_4b : c->quad_read_cmd,
+                                                 4, c->quad_read_dummy, FO_DIR_RD, "QUAD OUTPUT FAST READ");
+  d->quad_program = (fo_template) FO_TEMPLATE_X4((b4 && c->quad_program_cmd_4b != 0) ? c->quad_program_cmd_4b : c->quad_program_cmd,
+                                                 4, 0, FO_DIR_WR, "QUAD INPUT FAST PROGRAM");
+  if ((c->quad_read_dummy % 2) != 0) d->quad_read.cmd = 0;
+  return;
+}
+
+static flash_dev *flash_dev_of(u32 devsel)
+{ flash_dev *d = &FLASH_DEVS[(devsel == SPISSR_SEL_DEV2) ? 1 : 0];
+
+  if (!d->identified) {             // Used before flash_setup(): the Micron MT25Q
+    sfdp_defaults(&d->caps);
+    flash_dev_build(d);
+    d->quad_why   = "x1 (not identified)";
+    d->identified = 1;
+  }
+  return d;
+}
+
+flash_caps *flash_caps_of(u32 devsel)
+{ return &flash_dev_of(devsel)->caps;
+}
+
+void flash_caps_identify(u32 devsel)
+{ flash_dev *d = flash_dev_of(devsel);
+  byte id[20];
+  static byte sfdp[SFDP_READ_BYTES];
+
+  sfdp_defaults(&d->caps);
+  fr_Device_ID_Register(devsel, id);
+  d->caps.id[0] = id[0];  d->caps.id[1] = id[1];  d->caps.id[2] = id[2];
+  fr_SFDP(devsel, 0x00000000, SFDP_READ_BYTES, sfdp);
+  sfdp_parse(&d->caps, sfdp, SFDP_READ_BYTES);   // Keeps the defaults if the part has no SFDP
+  if (d->caps.id[0] == 0x20 && d->caps.size > 0x4000000) {   // Micron parts stacked from 512Mb dies have no CHIP ERASE
+    d->caps.die_cmd  = 0xC4;
+    d->caps.die_size = 0x4000000;
+  }
+
+  if (d->caps.page_size < 256) {
+    ERRORS_DETECTED++;
+    printf("(flash_caps_identify):  *** ERROR - FLASH %s has %d byte pages, the tools program 256 byte pages ***\n", flash_devsel_as_str(devsel), d->caps.page_size);
+  }
+  if (sfdp_erase_type(&d->caps, 0x10000) == NULL) {
+    ERRORS_DETECTED++;
+    printf("(flash_caps_identify):  *** ERROR - FLASH %s has no 64KB erase ***\n", flash_devsel_as_str(devsel));
+  }
+  flash_dev_build(d);
+  d->quad_why = "x1 (not identified)";
+  d->quad     = 0;
+  if (TRC_FLASH_CMD == TRC_ON) sfdp_print(stdout, &d->caps);
+  return;
+}
+
+
+
+// --------------------------------------------------------------------------------------------------------
+// FLASH erase planner
+// - A range to erase is covered by the set of erases with the least total typical time: the 4KB, 32KB and 64KB erases
+//   of the part and its die / chip erase, each on an address aligned to its size. The range is rounded out to the
+//   smallest erase and nothing outside of it is erased, so a die / chip erase is only picked for a range covering it.
+// - Times are the typical ones of flash_caps_of(). An erase without one is costed like the MT25Q 64KB erase (150 ms per
+//   64KB) plus 1 ms per command, so a larger erase still wins.
+// --------------------------------------------------------------------------------------------------------
+#define FLASH_ERASE_KINDS 4         // 4KB, 32KB, 64KB, die / chip
+
+static int flash_erase_kinds(flash_caps *c, u32 *size, long *typ_us)   // Erases the planner can use, smallest first
+{ static const u32 sizes[3] = { 0x1000, 0x8000, 0x10000 };
+  flash_erase_type *e;
+  int  i, n = 0;
+
+  for (i = 0; i < 3; i++)
+    if ((e = sfdp_erase_type(c, sizes[i])) != NULL) {
+      size[n] = sizes[i];  typ_us[n] = e->typ_us;  n++;
+    }
+  if (c->die_cmd != 0 && c->die_size > 0x10000) {
+    size[n] = c->die_size;  typ_us[n] = c->die_typ_us;  n++;
+  }
+  return n;
+}
+
+u32 flash_erase_unit(u32 devsel)
+{ u32  size[FLASH_ERASE_KINDS];
+  long typ_us[FLASH_ERASE_KINDS];
+
+  return (flash_erase_kinds(flash_caps_of(devsel), size, typ_us) > 0) ? size[0] : 0;
+}
+
+int flash_erase_plan(u32 devsel, u32 addr, u32 len, flash_erase_step *steps, int max_steps)
+{ flash_caps *c = flash_caps_of(devsel);
+  u32  size[FLASH_ERASE_KINDS];
+  long typ_us[FLASH_ERASE_KINDS], cost_us[FLASH_ERASE_KINDS];
+  unsigned long long first, last, pos;
+  long long *cost, cand;
+  byte *pick;
+  int  num_kinds, num_units, num_steps = 0, i, k, unit;
+
+  num_kinds = flash_erase_kinds(c, size, typ_us);
+  if (num_kinds == 0 || len == 0) return 0;
+  for (k = 0; k < num_kinds; k++)
+    cost_us[k] = (typ_us[k] != 0) ? typ_us[k] : (long) ((unsigned long long) size[k] * 150000 / 0x10000) + 1000;
+  unit  = size[0];
+  first = addr & ~(unit - 1);
+  last  = ((unsigned long long) addr + len + unit - 1) & ~((unsigned long long) unit - 1);
+  num_units = (int) ((last - first) / unit);
+
+  // cost[i]: cheapest erase of the units from i on, pick[i]: the erase starting unit i in it
+  cost = malloc((num_units + 1) * sizeof(long long));
+  pick = malloc(num_units + 1);
+  if (cost == NULL || pick == NULL) {
+    ERRORS_DETECTED++;
+    printf("(flash_erase_plan):  *** ERROR - Can not allocate the plan of %d erase units ***\n", num_units);
+    free(cost);  free(pick);
+    return -1;
+  }
+  cost[num_units] = 0;
+  for (i = num_units - 1; i >= 0; i--) {
+    pos = first + (unsigned long long) i * unit;
+    cost[i] = -1;
+    for (k = 0; k < num_kinds; k++) {   // Larger erases come later and win a tie
+      if ((pos % size[k]) != 0 || pos + size[k] > last) continue;
+      cand = cost_us[k] + cost[i + size[k] / unit];
+      if (cost[i] < 0 || cand <= cost[i]) { cost[i] = cand;  pick[i] = (byte) k; }
+    }
+  }
+
+  for (i = 0; i < num_units; i += size[pick[i]] / unit) {
+    if (num_steps == max_steps) {
+      ERRORS_DETECTED++;
+      printf("(flash_erase_plan):  *** ERROR - More than %d erases to plan ***\n", max_steps);
+      num_steps = -1;
+      break;
+    }
+    steps[num_steps].addr   = (u32) (first + (unsigned long long) i * unit);
+    steps[num_steps].size   = size[pick[i]];
+    steps[num_steps].typ_us = typ_us[pick[i]];
+    num_steps++;
+  }
+  free(cost);
+  free(pick);
+  return num_steps;
+}
+
+void flash_erase_plan_print(u32 devsel, flash_erase_step *steps, int num_steps)
+{ flash_caps *c = flash_caps_of(devsel);
+  u32  size[FLASH_ERASE_KINDS];
+  long typ_us[FLASH_ERASE_KINDS];
+  int  count[FLASH_ERASE_KINDS] = { 0 };
+  long long est_us = 0;
+  int  num_kinds, i, k, unknown = 0;
+
+  num_kinds = flash_erase_kinds(c, size, typ_us);
+  for (i = 0; i < num_steps; i++) {
+    for (k = 0; k < num_kinds; k++)
+      if (steps[i].size == size[k]) count[k]++;
+    est_us += steps[i].typ_us;
+    if (steps[i].typ_us == 0) unknown = 1;
+  }
+  printf("Erase plan for FLASH %s: %d erases", flash_devsel_as_str(devsel), num_steps);
+  for (k = num_kinds - 1; k >= 0; k--) {
+    if (count[k] == 0) continue;
+    if (size[k] > 0x10000) printf(", %d x %s %uMB", count[k], (c->die_cmd == 0xC4) ? "die" : "chip", size[k] >> 20);
+    else                   printf(", %d x %uKB", count[k], size[k] >> 10);
+  }
+  printf(", estimated %lld.%lld s%s\n", est_us / 1000000, (est_us / 100000) % 10, unknown ? " (some erase times not known)" : "");
+  return;
+}
+
+void flash_erase_issue(u32 devsel, flash_erase_step *s)   // The erase of one step, after a WRITE ENABLE
 {
-  const int maxloops = 1000000;   // Number of iterations to try before timeout error
+  if (s->size == 0x1000)       fw_4KB_Subsector_Erase(devsel, s->addr);
+  else if (s->size == 0x8000)  fw_32KB_Subsector_Erase(devsel, s->addr);
+  else if (s->size == 0x10000) fw_64KB_Sector_Erase(devsel, s->addr);
+  else                         fw_Die_Erase(devsel, s->addr);
+  return;
+}
+
+
+
+// --------------------------------------------------------------------------------------------------------
+// FLASH busy model
+// - Program and erase times of a FLASH part are known from its datasheet (typical and max), so the wait for the end of
+//   one sleeps through most of it before it starts polling. fw_Page_Program() and the erases start the clock with
+//   flash_busy_issued(), fr_wait_for_WRITE_IN_PROGRESS_to_clear() sleeps and polls.
+// - The sleep calibrates itself: it is 3/4 of the typical time until an operation has completed once on that FLASH, and
+//   15/16 of the shortest completion measured after that. A sleep that ended too late shows up as a shorter completion,
+//   so it shrinks on its own; parts missing from the table start from their SFDP times, else from measurements only.
+// - The max time sets the wait's deadline (twice max, never below the flash_wip poll site timeout).
+// --------------------------------------------------------------------------------------------------------
+typedef struct {
+  const char *name;
+  byte  mfg_id, mem_type;           // READ ID bytes 0 and 1, mfg_id 0 matches any part
+  long  typ_us[BUSY_NUM_OPS];       // Indexed by BUSY_PP ...
+  long  max_us[BUSY_NUM_OPS];
+} flash_busy_part;
+
+static flash_busy_part FLASH_BUSY_PARTS[] = {
+  //                                        PAGE PROGRAM  4KB ERASE  32KB ERASE  64KB ERASE  DIE ERASE
+  { "Micron MT25QU (1.8V)", 0x20, 0xBB, {          120,     50000,     100000,     150000,  153000000 },
+                                        {         1800,    400000,    1000000,    1000000,  460000000 } },
+  { "Micron MT25QL (3V)"  , 0x20, 0xBA, {          120,     50000,     100000,     150000,  153000000 },
+                                        {         1800,    400000,    1000000,    1000000,  460000000 } },
+  { "unknown"             , 0x00, 0x00, {            0,         0,          0,          0,          0 },
+                                        {         1800,    400000,    1000000,    1000000,  460000000 } },
+};
+#define FLASH_BUSY_NUM_PARTS ((int) (sizeof(FLASH_BUSY_PARTS) / sizeof(FLASH_BUSY_PARTS[0])))
+
+static const char *FLASH_BUSY_OP_NAMES[BUSY_NUM_OPS] = { "page program", "4KB erase", "32KB erase", "64KB erase", "die erase" };
+
+typedef struct {
+  flash_busy_part *part;
+  int   op;                         // Operation in progress, BUSY_NONE if none
+  unsigned long long issued_ns;     // When it was sent, see poll_now_ns()
+  long  min_us[BUSY_NUM_OPS];       // Shortest completion measured (0 = none yet)
+  long  count[BUSY_NUM_OPS];
+  long long total_us[BUSY_NUM_OPS], slept_us[BUSY_NUM_OPS];
+  flash_busy_part sfdp;             // Times from the FLASH capabilities, for a part missing from the table or smaller than its die
+} flash_busy_dev;
+
+static flash_busy_dev FLASH_BUSY[2] = {                     // DEV1, DEV2
+  { &FLASH_BUSY_PARTS[FLASH_BUSY_NUM_PARTS - 1], BUSY_NONE, 0, { 0 }, { 0 }, { 0 }, { 0 }, { 0 } },
+  { &FLASH_BUSY_PARTS[FLASH_BUSY_NUM_PARTS - 1], BUSY_NONE, 0, { 0 }, { 0 }, { 0 }, { 0 }, { 0 } },
+};
+#define FLASH_BUSY_DEV(devsel) (&FLASH_BUSY[((devsel) == SPISSR_SEL_DEV2) ? 1 : 0])
+
+void flash_busy_identify(u32 devsel)
+{ flash_busy_dev *d = FLASH_BUSY_DEV(devsel);
+  flash_caps *c = flash_caps_of(devsel);
+  flash_erase_type *e;
+  int  i, op;
+  static const u32 erase_size[BUSY_NUM_OPS] = { 0, 0x1000, 0x8000, 0x10000, 0 };
+
+  for (i = 0; i < FLASH_BUSY_NUM_PARTS - 1; i++)
+    if (FLASH_BUSY_PARTS[i].mfg_id == c->id[0] && FLASH_BUSY_PARTS[i].mem_type == c->id[1]) break;
+  d->part = &FLASH_BUSY_PARTS[i];
+
+  // A part missing from the table starts from the typical times of its SFDP, where it has them
+  if (i == FLASH_BUSY_NUM_PARTS - 1 && c->sfdp_rev != 0) {
+    d->sfdp = FLASH_BUSY_PARTS[i];
+    d->sfdp.name = "SFDP";
+    for (op = 0; op < BUSY_NUM_OPS; op++) {
+      e = (erase_size[op] != 0) ? sfdp_erase_type(c, erase_size[op]) : NULL;
+      if (op == BUSY_PP  && c->pp_typ_us  != 0) { d->sfdp.typ_us[op] = c->pp_typ_us;  d->sfdp.max_us[op] = c->pp_max_us;  }
+      if (op == BUSY_DIE && c->die_typ_us != 0) { d->sfdp.typ_us[op] = c->die_typ_us; d->sfdp.max_us[op] = c->die_max_us; }
+      if (e != NULL && e->typ_us != 0)          { d->sfdp.typ_us[op] = e->typ_us;     d->sfdp.max_us[op] = e->max_us;     }
+    }
+    d->part = &d->sfdp;
+  }
+
+  // The die erase times of the table are those of a 512Mb die, a smaller part erases in proportion
+  if (i < FLASH_BUSY_NUM_PARTS - 1 && c->die_size != 0 && c->die_size < 0x4000000) {
+    d->sfdp = FLASH_BUSY_PARTS[i];
+    d->sfdp.typ_us[BUSY_DIE] = (long) ((long long) d->sfdp.typ_us[BUSY_DIE] * c->die_size / 0x4000000);
+    d->sfdp.max_us[BUSY_DIE] = (long) ((long long) d->sfdp.max_us[BUSY_DIE] * c->die_size / 0x4000000);
+    d->part = &d->sfdp;
+  }
+  if (TRC_FLASH_CMD == TRC_ON) printf("flash_busy_identify: devsel %s, ID %2.2X %2.2X %2.2X is %s\n", flash_devsel_as_str(devsel), c->id[0], c->id[1], c->id[2], d->part->name);
+  return;
+}
+
+void flash_busy_issued(u32 devsel, int op)
+{ flash_busy_dev *d = FLASH_BUSY_DEV(devsel);
+
+  d->op        = op;
+  d->issued_ns = poll_now_ns();
+  return;
+}
+
+static long flash_busy_left(flash_busy_dev *d)    // Expected busy time left of the operation in progress, in us
+{ long expect_us, elapsed_us;
+
+  if (d->op == BUSY_NONE) return 0;
+  expect_us  = (d->min_us[d->op] > 0) ? d->min_us[d->op] / 16 * 15 : d->part->typ_us[d->op] / 4 * 3;
+  elapsed_us = (long) ((poll_now_ns() - d->issued_ns) / 1000);
+  return (expect_us > elapsed_us) ? expect_us - elapsed_us : 0;
+}
+
+static long flash_busy_sleep(flash_busy_dev *d)   // Sleep through the expected busy time of the operation in progress. Returns its max time in us.
+{ long left_us = flash_busy_left(d);
+
+  if (d->op == BUSY_NONE) return 0;
+  if (FLASH_BUSY_MODEL == BSY_ON && left_us > 0) {
+    poll_sleep_ns(left_us * 1000L);
+    d->slept_us[d->op] += left_us;
+  }
+  return d->part->max_us[d->op];
+}
+
+long flash_busy_left_us(u32 devsel)
+{ return flash_busy_left(FLASH_BUSY_DEV(devsel));
+}
+
+void flash_busy_sleep_expected(u32 devsel)
+{ flash_busy_sleep(FLASH_BUSY_DEV(devsel));
+  return;
+}
+
+static void flash_busy_done(flash_busy_dev *d, int ok)   // The operation in progress completed (ok = 1) or the wait gave up
+{ long took_us;
+
+  if (d->op == BUSY_NONE) return;
+  if (ok) {
+    took_us = (long) ((poll_now_ns() - d->issued_ns) / 1000);
+    if (took_us < 1) took_us = 1;
+    if (d->min_us[d->op] == 0 || took_us < d->min_us[d->op]) d->min_us[d->op] = took_us;
+    d->count[d->op]++;
+    d->total_us[d->op] += took_us;
+  }
+  d->op = BUSY_NONE;
+  return;
+}
+
+void flash_busy_stats(FILE *f)
+{ flash_busy_dev *d;
+  int i, op;
+
+  for (i = 0; i < 2; i++) {
+    d = &FLASH_BUSY[i];
+    for (op = 0; op < BUSY_NUM_OPS; op++) {
+      if (d->count[op] == 0) continue;
+      fprintf(f, "FLASH busy %s %-12s (%s): %ld done, typ %ld us, measured min %ld / avg %lld us, slept %lld us per op\n",
+              (i == 0) ? "DEV1" : "DEV2", FLASH_BUSY_OP_NAMES[op], d->part->name, d->count[op], d->part->typ_us[op],
+              d->min_us[op], d->total_us[op] / d->count[op], d->slept_us[op] / d->count[op]);
+    }
+  }
+  return;
+}
+
+
+
+// --------------------------------------------------------------------------------------------------------
+// Quad data lanes (see FLASH_QUAD)
+// - QUAD OUTPUT FAST READ (0x6B / 0x6C on Micron parts) and QUAD INPUT FAST PROGRAM (0x32 / 0x34) send the command and
+//   address on one lane and move dummy cycles and data on DQ0-DQ3, 4 times the bandwidth of READ / PAGE PROGRAM. Their
+//   opcodes and dummy cycles come from the FLASH capabilities. A Micron FLASH takes them in extended SPI protocol
+//   (EVCR[7] = 1) once DQ3 is no longer HOLD / RESET# (EVCR[4] = 0, done by flash_setup), with the VCR dummy cycles
+//   left at their default.
+// - Whether the AXI Quad SPI core was built in quad mode is not in any register. A core built in standard mode clocks
+//   the same bytes on one lane and samples DQ1 only, so with FQ_AUTO the first bytes of the FLASH are read with FAST READ
+//   and with QUAD OUTPUT FAST READ and have to match. A blank FLASH reads the same either way and stays on one lane.
+// - The probe only reads. A program on 4 lanes that the core doesn't move right would corrupt the image, so programs
+//   stay on one lane unless FQ_ON says the core is built in quad mode.
+// --------------------------------------------------------------------------------------------------------
+#define FLASH_QUAD_PROBE_BYTES 64
+
+static void flash_quad_check(u32 devsel, flash_dev *d)
+{ byte evcr, vcr;
+  byte x1[FLASH_QUAD_PROBE_BYTES], x4[FLASH_QUAD_PROBE_BYTES];
+  int  i, blank;
+
+  d->quad = 0;
+  if (FLASH_QUAD == FQ_OFF) {
+    d->quad_why = "x1 (--quad off)";
+    return;
+  }
+  if (d->quad_read.cmd == 0) {
+    d->quad_why = "x1 (FLASH has no 1-1-4 fast read)";
+    return;
+  }
+  if (d->caps.id[0] == 0x20) {   // Micron
+    evcr = fr_Enhanced_Volatile_Configuration_Register(devsel);
+    vcr  = fr_Volatile_Configuration_Register(devsel);
+    if ((evcr & 0x80) == 0 || (evcr & 0x10) != 0) {
+      d->quad_why = "x1 (EVCR: FLASH not in extended SPI protocol, or DQ3 is HOLD / RESET#)";
+      return;
+    }
+    if ((vcr >> 4) != 0x0 && (vcr >> 4) != 0xF && (vcr >> 4) != d->caps.quad_read_dummy) {
+      d->quad_why = "x1 (VCR: dummy cycles are not the default)";
+      return;
+    }
+  }
+  if (FLASH_QUAD == FQ_AUTO) {
+    flash_cmd(devsel, &d->fast_read, 0x00000000, FLASH_QUAD_PROBE_BYTES, NULL, x1);
+    flash_cmd(devsel, &d->quad_read, 0x00000000, FLASH_QUAD_PROBE_BYTES, NULL, x4);
+    for (i = 1, blank = 1; i < FLASH_QUAD_PROBE_BYTES; i++)
+      if (x1[i] != x1[0]) blank = 0;
+    if (blank) {
+      d->quad_why = "x1 (probe: FLASH is blank at address 0, can't tell a quad mode core, use --quad on)";
+      return;
+    }
+    if (memcmp(x1, x4, FLASH_QUAD_PROBE_BYTES) != 0) {
+      d->quad_why = "x1 (probe: the Quad SPI core is built in standard mode)";
+      return;
+    }
+  }
+  d->quad     = 1;
+  d->quad_why = (d->quad_program.cmd == 0) ? "x4 reads, x1 programs (FLASH has no 1-1-4 program)" :
+                (FLASH_QUAD == FQ_ON)      ? "x4 (--quad on)" : "x4 reads, x1 programs (quad programs need --quad on)";
+  return;
+}
 
+void flash_quad_identify(u32 devsel)
+{ flash_dev *d = flash_dev_of(devsel);
+
+  flash_quad_check(devsel, d);
+  if (TRC_FLASH_CMD == TRC_ON) printf("flash_quad_identify: devsel %s, data lanes %s\n", flash_devsel_as_str(devsel), d->quad_why);
+  return;
+}
+
+const char *flash_quad_lanes(u32 devsel)
+{ return flash_dev_of(devsel)->quad_why;
+}
+
+
+
+// --------------------------------------------------------------------------------------------------------
+// Wait for the end of a program / erase (see FLASH_WIP_WAIT)
+// - The FLASH keeps shifting out the STATUS (or FLAG STATUS) register for as long as chip select stays asserted, so one
+//   READ can clock out FLASH_WIP_SAMPLES samples of it (up to FIFO_DEPTH - 1, a single DTR FIFO fill), spread over the
+//   SPI transfer time. The wait ends on the first sample that shows the FLASH ready.
+// - Every sample costs a DTR byte written and a DRR byte read through the config space keyhole, so bursts only pay
+//   when the SPI clock is slow next to an AXI round trip. One sample per poll is the default.
+// - WIPW_FSR samples FLAG STATUS[7] (Program or erase controller ready) and checks its error bits once ready: [5] erase,
+//   [4] program and [1] protection error. An error is counted and cleared with CLEAR FLAG STATUS REGISTER.
+void fr_wait_for_WRITE_IN_PROGRESS_to_clear(u32 devsel)     // Wait for 'WRITE IN PROGRESS' status bit to return to not busy state
+{
   int  debug = 0;              // 0=no iteration msgs, 1 = print msg on each iteration
   char call_args[1024];        // Buffers for easier printing
   byte rbyte;
-  int  i;
+  poll_wait w;                 // Deadline and backoff, see POLL_FLASH_WIP
+  byte wary[256], rary[256];   // Samples of one READ (STATUS or FLAG STATUS), FIFO_DEPTH - 1 at most
+  fo_template *t;
+  int  num_samples, i;
+  byte ready_mask, ready_value;
+  flash_busy_dev *busy = FLASH_BUSY_DEV(devsel);
+  long max_us;
 
   int  saved_TRC_FLASH_CMD;
   int  saved_TRC_FLASH;
@@ -1731,34 +2810,95 @@ void fr_wait_for_WRITE_IN_PROGRESS_to_clear(u32 devsel)     // Wait for 'WRITE I
   saved_TRC_FLASH     = TRC_FLASH;
   saved_TRC_AXI       = TRC_AXI;
   saved_TRC_CONFIG    = TRC_CONFIG;
-  rbyte = 0x01;
-  i = 0;
-  while (i++ < maxloops && ((rbyte & 0x01) == 0x01) ) {    // Wait for IPISR[0] to become 0 indicating write is not in progress
-    rbyte = fr_Status_Register(devsel);
+  num_samples = (FLASH_WIP_SAMPLES < FIFO_DEPTH - 1) ? FLASH_WIP_SAMPLES : FIFO_DEPTH - 1;
+  t           = (FLASH_WIP_WAIT == WIPW_FSR) ? &FOT_READ_FSR : &FOT_READ_SR;
+  ready_mask  = (FLASH_WIP_WAIT == WIPW_FSR) ? 0x80 : 0x01;   // FLAG STATUS[7] = 1 or STATUS[0] = 0 when ready
+  ready_value = (FLASH_WIP_WAIT == WIPW_FSR) ? 0x80 : 0x00;
+  memset(wary, 0x00, num_samples);
+
+  poll_start(&w, &POLL_FLASH_WIP);
+  max_us = flash_busy_sleep(busy);     // Sleep through most of a program / erase, see FLASH busy model
+  if (2 * max_us > POLL_FLASH_WIP.timeout_us && POLL_FLASH_WIP.timeout_us > 0) poll_set_timeout(&w, 2 * max_us);
+  do {                                 // Wait for STATUS[0] to become 0 indicating write is not in progress
+    flash_cmd(devsel, t, 0x00000000, num_samples, wary, rary);
+    for (i = 0; i < num_samples && (rary[i] & ready_mask) != ready_value; i++) ;
+    rbyte = rary[(i < num_samples) ? i : num_samples - 1];
     TRC_FLASH_CMD = TRC_OFF;           // Disable lower level tracing after first iteration
     TRC_FLASH     = TRC_OFF;
     TRC_AXI       = TRC_OFF;
     TRC_CONFIG    = TRC_OFF;
-    if (debug) printf("fr_wait_for_WRITE_IN_PROGRESS_to_clear: Poll loop iteration %d, rbyte = %2.2X\n", i, rbyte);
-  }
+    if (debug) printf("fr_wait_for_WRITE_IN_PROGRESS_to_clear: Poll %d, rbyte = %2.2X\n", w.polls, rbyte);
+  } while (i == num_samples && poll_again(&w) == 0);
+  poll_end(&w);
+  flash_busy_done(busy, !w.timed_out);
 
   TRC_FLASH_CMD = saved_TRC_FLASH_CMD; // Restore trace levels
   TRC_FLASH     = saved_TRC_FLASH;
   TRC_AXI       = saved_TRC_AXI;
   TRC_CONFIG    = saved_TRC_CONFIG;
 
-  if (i >= maxloops) {
+  if (w.timed_out) {
     ERRORS_DETECTED++;
-    printf("fr_wait_for_WRITE_IN_PROGRESS_to_clear:  *** ERROR - Timeout, maximum iteration loops (%d) executed on %s ***\n", i, call_args);
+    printf("fr_wait_for_WRITE_IN_PROGRESS_to_clear:  *** ERROR - Timeout, STATUS[0] still set after %d polls (%ld ms) on %s ***\n", w.polls, poll_elapsed_us(&w) / 1000, call_args);
   }
   else {
-    if (TRC_FLASH_CMD) printf("fr_wait_for_WRITE_IN_PROGRESS_to_clear: (done) Found STATUS[0]=0 (Write In Progress is READY) after %d iterations\n", i);
+    if (TRC_FLASH_CMD) printf("fr_wait_for_WRITE_IN_PROGRESS_to_clear: (done) Found STATUS[0]=0 (Write In Progress is READY) after %d polls\n", w.polls);
+    if (FLASH_WIP_WAIT == WIPW_FSR && (rbyte & 0x32) != 0x00) {
+      ERRORS_DETECTED++;
+      printf("fr_wait_for_WRITE_IN_PROGRESS_to_clear:  *** ERROR - FLAG STATUS h%2.2X shows a%s%s%s error on %s ***\n", rbyte,
+             (rbyte & 0x20) ? "n erase" : "", (rbyte & 0x10) ? " program" : "", (rbyte & 0x02) ? " protection" : "", call_args);
+      fw_Clear_Flag_Status_Register(devsel);
+    }
   }
 
   return;
 }
 
 
+// --------------------------------------------------------------------------------------------------------
+int fr_WRITE_IN_PROGRESS_cleared(u32 devsel)   // One poll of the wait above, for callers keeping two FLASH busy at once
+{ byte wary[256], rary[256];
+  fo_template *t;
+  int  num_samples, i;
+  byte ready_mask, ready_value, rbyte;
+  flash_busy_dev *busy = FLASH_BUSY_DEV(devsel);
+  long timeout_us, elapsed_us;
+
+  if (busy->op == BUSY_NONE) return 1;
+  num_samples = (FLASH_WIP_SAMPLES < FIFO_DEPTH - 1) ? FLASH_WIP_SAMPLES : FIFO_DEPTH - 1;
+  t           = (FLASH_WIP_WAIT == WIPW_FSR) ? &FOT_READ_FSR : &FOT_READ_SR;
+  ready_mask  = (FLASH_WIP_WAIT == WIPW_FSR) ? 0x80 : 0x01;
+  ready_value = (FLASH_WIP_WAIT == WIPW_FSR) ? 0x80 : 0x00;
+  memset(wary, 0x00, num_samples);
+
+  flash_cmd(devsel, t, 0x00000000, num_samples, wary, rary);
+  for (i = 0; i < num_samples && (rary[i] & ready_mask) != ready_value; i++) ;
+  if (i < num_samples) {
+    flash_busy_done(busy, 1);
+    rbyte = rary[i];
+    if (FLASH_WIP_WAIT == WIPW_FSR && (rbyte & 0x32) != 0x00) {
+      ERRORS_DETECTED++;
+      printf("fr_WRITE_IN_PROGRESS_cleared:  *** ERROR - FLAG STATUS h%2.2X shows a%s%s%s error on devsel %s ***\n", rbyte,
+             (rbyte & 0x20) ? "n erase" : "", (rbyte & 0x10) ? " program" : "", (rbyte & 0x02) ? " protection" : "", flash_devsel_as_str(devsel));
+      fw_Clear_Flag_Status_Register(devsel);
+    }
+    return 1;
+  }
+
+  // Same deadline as the wait: the POLL_FLASH_WIP timeout, or twice the max time of the operation if that is longer
+  timeout_us = POLL_FLASH_WIP.timeout_us;
+  if (2 * busy->part->max_us[busy->op] > timeout_us && timeout_us > 0) timeout_us = 2 * busy->part->max_us[busy->op];
+  elapsed_us = (long) ((poll_now_ns() - busy->issued_ns) / 1000);
+  if (timeout_us > 0 && elapsed_us > timeout_us) {
+    flash_busy_done(busy, 0);
+    ERRORS_DETECTED++;
+    printf("fr_WRITE_IN_PROGRESS_cleared:  *** ERROR - Timeout, STATUS[0] still set after %ld ms on devsel %s ***\n", elapsed_us / 1000, flash_devsel_as_str(devsel));
+    return 1;
+  }
+  return 0;
+}
+
+
 
 // --------------------------------------------------------------------------------------------------------
 void read_flash_regs(u32 devsel)    // Read all registers in the targeted FLASH (pass in SPISSR_SEL_DEV1 or SPISSR_SEL_DEV2)
@@ -1802,6 +2942,8 @@ void read_flash_regs(u32 devsel)    // Read all registers in the targeted FLASH
     strcat(ds, ds_elt);
   }
   printf("            DEVICE ID = %s\n", ds);
+  printf("            DATA LANES = %s\n", flash_quad_lanes(devsel));
+  sfdp_print(stdout, flash_caps_of(devsel));
 
   printf("----- (End read_flash_regs) -----\n\n");
 
@@ -1857,13 +2999,38 @@ int check_TRC_FLASH_CMD()               // Helper function for read Flash functi
 
 
 
+// --------------------------------------------------------------------------------------------------------
+// FLASH command templates of the facility functions below, replayed by flash_cmd()
+// - The *_4B commands take a 4 byte address whatever the address mode of the FLASH, selected with FLASH_4B_OPCODES
+// --------------------------------------------------------------------------------------------------------
+//                                                cmd   num_addr num_dummy  dir
+fo_template FOT_RESET_ENABLE        = FO_TEMPLATE(0x66, 0,       0,         FO_DIR_WR, "RESET ENABLE");
+fo_template FOT_RESET_MEMORY        = FO_TEMPLATE(0x99, 0,       0,         FO_DIR_WR, "RESET MEMORY");
+fo_template FOT_ENTER_4B_ADDR_MODE  = FO_TEMPLATE(0xB7, 0,       0,         FO_DIR_WR, "ENTER 4B ADDR MODE");
+fo_template FOT_WRITE_ENABLE        = FO_TEMPLATE(0x06, 0,       0,         FO_DIR_WR, "WRITE ENABLE");
+fo_template FOT_READ_EVCR           = FO_TEMPLATE(0x65, 0,       0,         FO_DIR_RD, "READ ENHANCED VOLATILE CONFIGURATION REGISTER");
+fo_template FOT_WRITE_EVCR          = FO_TEMPLATE(0x61, 0,       0,         FO_DIR_WR, "WRITE ENHANCED VOLATILE CONFIGURATION REGISTER");
+fo_template FOT_READ_EAR            = FO_TEMPLATE(0xC8, 0,       0,         FO_DIR_RD, "READ EXTENDED ADDRESS REGISTER");
+fo_template FOT_WRITE_EAR           = FO_TEMPLATE(0xC5, 0,       0,         FO_DIR_WR, "WRITE EXTENDED ADDRESS REGISTER");
+fo_template FOT_READ_SR             = FO_TEMPLATE(0x05, 0,       0,         FO_DIR_RD, "READ STATUS REGISTER");
+fo_template FOT_WRITE_SR            = FO_TEMPLATE(0x01, 0,       0,         FO_DIR_WR, "WRITE STATUS REGISTER");
+fo_template FOT_READ_FSR            = FO_TEMPLATE(0x70, 0,       0,         FO_DIR_RD, "READ FLAG STATUS REGISTER");
+fo_template FOT_CLEAR_FSR           = FO_TEMPLATE(0x50, 0,       0,         FO_DIR_WR, "CLEAR FLAG STATUS REGISTER");
+fo_template FOT_READ_NVCR           = FO_TEMPLATE(0xB5, 0,       0,         FO_DIR_RD, "READ NONVOLATILE CONFIGURATION REGISTER");
+fo_template FOT_WRITE_NVCR          = FO_TEMPLATE(0xB1, 0,       0,         FO_DIR_WR, "WRITE NONVOLATILE CONFIGURATION REGISTER");
+fo_template FOT_READ_VCR            = FO_TEMPLATE(0x85, 0,       0,         FO_DIR_RD, "READ VOLATILE CONFIGURATION REGISTER");
+fo_template FOT_WRITE_VCR           = FO_TEMPLATE(0x81, 0,       0,         FO_DIR_WR, "WRITE VOLATILE CONFIGURATION REGISTER");
+fo_template FOT_READ_ID             = FO_TEMPLATE(0x9E, 0,       0,         FO_DIR_RD, "READ DEVICE ID REGISTER");
+fo_template FOT_READ_SFDP           = FO_TEMPLATE_X1(0x5A, 3,    8,         FO_DIR_RD, "READ SERIAL FLASH DISCOVERY PARAMETER");
+
+
+
 // --------------------------------------------------------------------------------------------------------
 void fw_Reset_Enable(u32 devsel)
 { byte wary[1];
   byte rary[1];
   if (TRC_FLASH_CMD == TRC_ON) printf("fw_Reset_Enable: devsel %s\n", flash_devsel_as_str(devsel));
-  //       devsel  cmd   addr        num_addr, num_dummy, num_bytes, wdata[], rdata[], dir,
-  flash_op(devsel, 0x66, 0x00000000, 0       , 0        , 0        , wary   , rary   , FO_DIR_WR, "RESET ENABLE");
+  flash_cmd(devsel, &FOT_RESET_ENABLE, 0x00000000, 0, wary, rary);
   return;
 }
 
@@ -1874,8 +3041,7 @@ void fw_Reset_Memory(u32 devsel)
 { byte wary[1];
   byte rary[1];
   if (TRC_FLASH_CMD == TRC_ON) printf("fw_Reset_Memory: devsel %s\n", flash_devsel_as_str(devsel));
-  //       devsel  cmd   addr        num_addr, num_dummy, num_bytes, wdata[], rdata[], dir,
-  flash_op(devsel, 0x99, 0x00000000, 0       , 0        , 0        , wary   , rary   , FO_DIR_WR, "RESET MEMORY");
+  flash_cmd(devsel, &FOT_RESET_MEMORY, 0x00000000, 0, wary, rary);
   return;
 }
 
@@ -1883,8 +3049,7 @@ void fw_Enter_4B_Adress_Mode(u32 devsel)
 { byte wary[1];
   byte rary[1];
   if (TRC_FLASH_CMD == TRC_ON) printf("fw_Enter_4B_Address_Mode: devsel %s\n", flash_devsel_as_str(devsel));
-  //       devsel  cmd   addr        num_addr, num_dummy, num_bytes, wdata[], rdata[], dir,
-  flash_op(devsel, 0xB7, 0x00000000, 0       , 0        , 0        , wary   , rary   , FO_DIR_WR, "ENTER 4B ADDR MODE");
+  flash_cmd(devsel, &FOT_ENTER_4B_ADDR_MODE, 0x00000000, 0, wary, rary);
 return;
 }
 
@@ -1893,8 +3058,7 @@ void fw_Write_Enable(u32 devsel)
 { byte wary[1];
   byte rary[1];
   if (TRC_FLASH_CMD == TRC_ON) printf("fw_Write_Enable: devsel %s\n", flash_devsel_as_str(devsel));
-  //       devsel  cmd   addr        num_addr, num_dummy, num_bytes, wdata[], rdata[], dir,
-  flash_op(devsel, 0x06, 0x00000000, 0       , 0        , 0        , wary   , rary   , FO_DIR_WR, "WRITE ENABLE");
+  flash_cmd(devsel, &FOT_WRITE_ENABLE, 0x00000000, 0, wary, rary);
   return;
 }
 
@@ -1906,8 +3070,7 @@ byte fr_Enhanced_Volatile_Configuration_Register(u32 devsel)
   byte rary[1];
   wary[0] = 0x00;
   if (check_TRC_FLASH_CMD()) printf("fr_Enhanced_Volatile_Configuration_Register: devsel %s\n", flash_devsel_as_str(devsel));
-  //       devsel  cmd   addr        num_addr, num_dummy, num_bytes, wdata[], rdata[], dir,
-  flash_op(devsel, 0x65, 0x00000000, 0       , 0        , 1        , wary   , rary   , FO_DIR_RD, "READ ENHANCED VOLATILE CONFIGURATION REGISTER");
+  flash_cmd(devsel, &FOT_READ_EVCR, 0x00000000, 1, wary, rary);
   if (TRC_FLASH_CMD == TRC_ON) printf("fr_Enhanced_Volatile_Configuration_Register: (done) devsel %s, rdata %2.2X\n", flash_devsel_as_str(devsel), rary[0]);
   return rary[0];
 }
@@ -1917,8 +3080,7 @@ void fw_Enhanced_Volatile_Configuration_Register(u32 devsel, byte wdata)
   byte rary[1];
   wary[0] = wdata;
   if (TRC_FLASH_CMD == TRC_ON) printf("fw_Enhanced_Volatile_Configuration_Register: devsel %s, wdata %2X\n", flash_devsel_as_str(devsel), wdata);
-  //       devsel  cmd   addr        num_addr, num_dummy, num_bytes, wdata[], rdata[], dir,
-  flash_op(devsel, 0x61, 0x00000000, 0       , 0        , 1        , wary   , rary   , FO_DIR_WR, "WRITE ENHANCED VOLATILE CONFIGURATION REGISTER");
+  flash_cmd(devsel, &FOT_WRITE_EVCR, 0x00000000, 1, wary, rary);
   return;
 }
 
@@ -1930,8 +3092,7 @@ byte fr_Extended_Address_Register(u32 devsel)
   byte rary[1];
   wary[0] = 0x00;
   if (check_TRC_FLASH_CMD()) printf("fr_Extended_Address_Register: devsel %s\n", flash_devsel_as_str(devsel));
-  //       devsel  cmd   addr        num_addr, num_dummy, num_bytes, wdata[], rdata[], dir,
-  flash_op(devsel, 0xC8, 0x00000000, 0       , 0        , 1        , wary   , rary   , FO_DIR_RD, "READ EXTENDED ADDRESS REGISTER");
+  flash_cmd(devsel, &FOT_READ_EAR, 0x00000000, 1, wary, rary);
   if (TRC_FLASH_CMD == TRC_ON) printf("fr_Extended_Address_Register: (done) devsel %s, rdata %2.2X\n", flash_devsel_as_str(devsel), rary[0]);
   return rary[0];
 }
@@ -1941,8 +3102,7 @@ void fw_Extended_Address_Register(u32 devsel, byte wdata)
   byte rary[1];
   wary[0] = wdata;
   if (TRC_FLASH_CMD == TRC_ON) printf("fw_Extended_Address_Register: devsel %s, wdata %2X\n", flash_devsel_as_str(devsel), wdata);
-  //       devsel  cmd   addr        num_addr, num_dummy, num_bytes, wdata[], rdata[], dir,
-  flash_op(devsel, 0xC5, 0x00000000, 0       , 0        , 1        , wary   , rary   , FO_DIR_WR, "WRITE EXTENDED ADDRESS REGISTER");
+  flash_cmd(devsel, &FOT_WRITE_EAR, 0x00000000, 1, wary, rary);
   return;
 }
 
@@ -1954,8 +3114,7 @@ byte fr_Status_Register(u32 devsel)
   byte rary[1];
   wary[0] = 0x00;
   if (check_TRC_FLASH_CMD()) printf("fr_Status_Register: devsel %s\n", flash_devsel_as_str(devsel));
-  //       devsel  cmd   addr        num_addr, num_dummy, num_bytes, wdata[], rdata[], dir,
-  flash_op(devsel, 0x05, 0x00000000, 0       , 0        , 1        , wary   , rary   , FO_DIR_RD, "READ STATUS REGISTER");
+  flash_cmd(devsel, &FOT_READ_SR, 0x00000000, 1, wary, rary);
   if (TRC_FLASH_CMD == TRC_ON) printf("fr_Status_Register: (done) devsel %s, rdata %2.2X\n", flash_devsel_as_str(devsel), rary[0]);
   return rary[0];
 }
@@ -1965,8 +3124,7 @@ void fw_Status_Register(u32 devsel, byte wdata)
   byte rary[1];
   wary[0] = wdata;
   if (TRC_FLASH_CMD == TRC_ON) printf("fw_Status_Register: devsel %s, wdata %2X\n", flash_devsel_as_str(devsel), wdata);
-  //       devsel  cmd   addr        num_addr, num_dummy, num_bytes, wdata[], rdata[], dir,
-  flash_op(devsel, 0x01, 0x00000000, 0       , 0        , 1        , wary   , rary   , FO_DIR_WR, "WRITE STATUS REGISTER");
+  flash_cmd(devsel, &FOT_WRITE_SR, 0x00000000, 1, wary, rary);
   return;
 }
 
@@ -1978,8 +3136,7 @@ byte fr_Flag_Status_Register(u32 devsel)
   byte rary[1];
   wary[0] = 0x00;
   if (check_TRC_FLASH_CMD()) printf("fr_Flag_Status_Register: devsel %s\n", flash_devsel_as_str(devsel));
-  //       devsel  cmd   addr        num_addr, num_dummy, num_bytes, wdata[], rdata[], dir,
-  flash_op(devsel, 0x70, 0x00000000, 0       , 0        , 1        , wary   , rary   , FO_DIR_RD, "READ FLAG STATUS REGISTER");
+  flash_cmd(devsel, &FOT_READ_FSR, 0x00000000, 1, wary, rary);
   if (TRC_FLASH_CMD == TRC_ON) printf("fr_Flag_Status_Register: (done) devsel %s, rdata %2.2X\n", flash_devsel_as_str(devsel), rary[0]);
   return rary[0];
 }
@@ -1988,8 +3145,7 @@ void fw_Clear_Flag_Status_Register(u32 devsel)
 { byte wary[1];
   byte rary[1];
   if (TRC_FLASH_CMD == TRC_ON) printf("fw_Clear_Flag_Status_Register: devsel %s\n", flash_devsel_as_str(devsel));
-  //       devsel  cmd   addr        num_addr, num_dummy, num_bytes, wdata[], rdata[], dir,
-  flash_op(devsel, 0x50, 0x00000000, 0       , 0        , 0        , wary   , rary   , FO_DIR_WR, "CLEAR FLAG STATUS REGISTER");
+  flash_cmd(devsel, &FOT_CLEAR_FSR, 0x00000000, 0, wary, rary);
   return;
 }
 
@@ -2003,8 +3159,7 @@ u32 fr_Nonvolatile_Configuration_Register(u32 devsel)
   wary[0] = 0x00;
   wary[1] = 0x00;
   if (check_TRC_FLASH_CMD()) printf("fr_Nonvolatile_Configuration_Register: devsel %s\n", flash_devsel_as_str(devsel));
-  //       devsel  cmd   addr        num_addr, num_dummy, num_bytes, wdata[], rdata[], dir,
-  flash_op(devsel, 0xB5, 0x00000000, 0       , 0        , 2        , wary   , rary   , FO_DIR_RD, "READ NONVOLATILE CONFIGURATION REGISTER");
+  flash_cmd(devsel, &FOT_READ_NVCR, 0x00000000, 2, wary, rary);
   if (TRC_FLASH_CMD == TRC_ON) printf("fr_Nonvolatile_Configuration_Register: (done) devsel %s, rdata %2.2X %2.2X\n", flash_devsel_as_str(devsel), rary[0], rary[1]);
   retval = 0x00000000 | (rary[0] << 8) | rary[1] ;
   return retval;
@@ -2016,8 +3171,7 @@ void fw_Nonvolatile_Configuration_Register(u32 devsel, u32 wdata)
   wary[0] = u32tobyte( ((wdata & 0x0000FF00) >> 8) );
   wary[1] = u32tobyte( ((wdata & 0x000000FF)     ) );
   if (TRC_FLASH_CMD == TRC_ON) printf("fw_Nonvolatile_Configuration_Register: devsel %s, wdata %2.2X %2.2X\n", flash_devsel_as_str(devsel), wary[0], wary[1]);
-  //       devsel  cmd   addr        num_addr, num_dummy, num_bytes, wdata[], rdata[], dir,
-  flash_op(devsel, 0xB1, 0x00000000, 0       , 0        , 2        , wary   , rary   , FO_DIR_WR, "WRITE NONVOLATILE CONFIGURATION REGISTER");
+  flash_cmd(devsel, &FOT_WRITE_NVCR, 0x00000000, 2, wary, rary);
   return;
 }
 
@@ -2029,8 +3183,7 @@ byte fr_Volatile_Configuration_Register(u32 devsel)
   byte rary[1];
   wary[0] = 0x00;
   if (check_TRC_FLASH_CMD()) printf("fr_Volatile_Configuration_Register: devsel %s\n", flash_devsel_as_str(devsel));
-  //       devsel  cmd   addr        num_addr, num_dummy, num_bytes, wdata[], rdata[], dir,
-  flash_op(devsel, 0x85, 0x00000000, 0       , 0        , 1        , wary   , rary   , FO_DIR_RD, "READ VOLATILE CONFIGURATION REGISTER");
+  flash_cmd(devsel, &FOT_READ_VCR, 0x00000000, 1, wary, rary);
   if (TRC_FLASH_CMD == TRC_ON) printf("fr_Volatile_Configuration_Register: (done) devsel %s, rdata %2.2X\n", flash_devsel_as_str(devsel), rary[0]);
   return rary[0];
 }
@@ -2040,8 +3193,7 @@ void fw_Volatile_Configuration_Register(u32 devsel, byte wdata)
   byte rary[1];
   wary[0] = wdata;
   if (TRC_FLASH_CMD == TRC_ON) printf("fw_Volatile_Configuration_Register: devsel %s, wdata %2X\n", flash_devsel_as_str(devsel), wdata);
-  //       devsel  cmd   addr        num_addr, num_dummy, num_bytes, wdata[], rdata[], dir,
-  flash_op(devsel, 0x81, 0x00000000, 0       , 0        , 1        , wary   , rary   , FO_DIR_WR, "WRITE VOLATILE CONFIGURATION REGISTER");
+  flash_cmd(devsel, &FOT_WRITE_VCR, 0x00000000, 1, wary, rary);
   return;
 }
 
@@ -2057,8 +3209,7 @@ void fr_Device_ID_Register(u32 devsel, byte *rdata)    // 20 bytes of read data
     wary[i] = 0x00;
   }
   if (check_TRC_FLASH_CMD()) printf("fr_Device_ID_Register: devsel %s\n", flash_devsel_as_str(devsel));
-  //       devsel  cmd   addr        num_addr, num_dummy, num_bytes, wdata[], rdata[], dir,
-  flash_op(devsel, 0x9E, 0x00000000, 0       , 0        , 20       , wary   , rary   , FO_DIR_RD, "READ DEVICE ID REGISTER");
+  flash_cmd(devsel, &FOT_READ_ID, 0x00000000, 20, wary, rary);
   for (i=0; i < 20; i++) {
     *(rdata + i) = rary[i];
   }
@@ -2075,12 +3226,30 @@ void fw_4KB_Subsector_Erase(u32 devsel, u32 addr)   // 3 byte address
   wary[0] = 0x00;
 
   if (TRC_FLASH_CMD == TRC_ON) printf("fw_4KB_Subsector_Erase: devsel %s, addr %4X\n", flash_devsel_as_str(devsel), addr);
-  //       devsel  cmd   addr  num_addr   num_dummy, num_bytes  , wdata[], rdata[], dir      , comment
 #ifdef USE_SIM_TO_TEST
   printf("fw_4KB_Subsector_Erase: Skip ERASE cmd when running sim, put back in when running on real hardware (takes too long to run in sim).\n");
   // However from comments from the FLASH model, it looks like the FLASH recognizes and begins to execute the ERASE command properly.
 #else
-  flash_op(devsel, 0x20, addr, 4        , 0        , 0          , wary   , rary   , FO_DIR_WR, "4KB SUBSECTOR ERASE");
+  flash_cmd(devsel, &flash_dev_of(devsel)->erase_4k, addr, 0, wary, rary);
+  flash_busy_issued(devsel, BUSY_SSE);
+#endif
+
+  return;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+void fw_32KB_Subsector_Erase(u32 devsel, u32 addr)   // 3 byte address
+{ byte wary[1];
+  byte rary[1];
+  wary[0] = 0x00;
+
+  if (TRC_FLASH_CMD == TRC_ON) printf("fw_32KB_Subsector_Erase: devsel %s, addr %4X\n", flash_devsel_as_str(devsel), addr);
+#ifdef USE_SIM_TO_TEST
+  printf("fw_32KB_Subsector_Erase: Skip ERASE cmd when running sim, put back in when running on real hardware (takes too long to run in sim).\n");
+#else
+  flash_cmd(devsel, &flash_dev_of(devsel)->erase_32k, addr, 0, wary, rary);
+  flash_busy_issued(devsel, BUSY_SE32);
 #endif
 
   return;
@@ -2094,71 +3263,76 @@ void fw_64KB_Sector_Erase(u32 devsel, u32 addr)   // 3 byte address
   wary[0] = 0x00;
 
   if (TRC_FLASH_CMD == TRC_ON) printf("fw_64KB_Sector_Erase: devsel %s, addr %4X\n", flash_devsel_as_str(devsel), addr);
-  //       devsel  cmd   addr  num_addr   num_dummy, num_bytes  , wdata[], rdata[], dir      , comment
 #ifdef USE_SIM_TO_TEST
   printf("fw_64KB_Sector_Erase: Skip ERASE cmd when running sim, put back in when running on real hardware (takes too long to run in sim).\n");
    // However from comments from the FLASH model, it looks like the FLASH recognizes and begins to execute the ERASE command properly.
 
 #else
-  flash_op(devsel, 0xD8, addr, 4        , 0        , 0          , wary   , rary   , FO_DIR_WR, "4KB SUBSECTOR ERASE");
+  flash_cmd(devsel, &flash_dev_of(devsel)->erase_64k, addr, 0, wary, rary);
+  flash_busy_issued(devsel, BUSY_SE);
 #endif
 
   return;
 }
 
-// --------------------------------------------------------------------------------------------------------
-void fr_Read(u32 devsel, u32 addr, int num_bytes, byte *rary)   // 3 byte address
-{ byte *wary;
-  int i;
 
-  wary = (byte *) malloc(num_bytes * sizeof(byte));
-  if (wary == NULL) {
-    ERRORS_DETECTED++;
-    printf("(fr_Read):  *** ERROR - malloc() call failed. READ operation is skipped. ***\n");
-    return;
-  }
-  for (i=0; i < num_bytes; i++) { wary[i] = 0x00; }  // Clear write data
+// --------------------------------------------------------------------------------------------------------
+void fw_Die_Erase(u32 devsel, u32 addr)   // Die holding 'addr' (DIE ERASE), or the whole part (CHIP ERASE), see flash_caps
+{ byte wary[1];
+  byte rary[1];
+  wary[0] = 0x00;
 
-  if (TRC_FLASH_CMD == TRC_ON) printf("fr_Read: devsel %s, addr %4X, num_bytes %d\n", flash_devsel_as_str(devsel), addr, num_bytes);
-  //       devsel  cmd   addr  num_addr , num_dummy, num_bytes, wdata[], rdata[], dir      , comment
-  flash_op(devsel, 0x03, addr, 4        , 0        , num_bytes, wary   , rary   , FO_DIR_RD, "READ");
+  if (TRC_FLASH_CMD == TRC_ON) printf("fw_Die_Erase: devsel %s, addr %4X\n", flash_devsel_as_str(devsel), addr);
+#ifdef USE_SIM_TO_TEST
+  printf("fw_Die_Erase: Skip ERASE cmd when running sim, put back in when running on real hardware (takes too long to run in sim).\n");
+#else
+  flash_cmd(devsel, &flash_dev_of(devsel)->die_erase, addr, 0, wary, rary);
+  flash_busy_issued(devsel, BUSY_DIE);
+#endif
 
-  // Free malloc'd memory
-  free(wary);
+  return;
+}
 
+// --------------------------------------------------------------------------------------------------------
+void fr_Read(u32 devsel, u32 addr, int num_bytes, byte *rary)   // 3 byte address
+{
+  if (TRC_FLASH_CMD == TRC_ON) printf("fr_Read: devsel %s, addr %4X, num_bytes %d\n", flash_devsel_as_str(devsel), addr, num_bytes);
+  flash_cmd(devsel, &flash_dev_of(devsel)->read, addr, num_bytes, NULL, rary);   // Zeros are shifted in
   return;
 }
 
 
 
 // --------------------------------------------------------------------------------------------------------
-void fw_Page_Program(u32 devsel, u32 addr, int num_bytes, byte *wary)   // 3 byte address
+void fr_SFDP(u32 devsel, u32 addr, int num_bytes, byte *rary)   // 3 byte address into the SFDP space
 {
+  if (TRC_FLASH_CMD == TRC_ON) printf("fr_SFDP: devsel %s, addr %4X, num_bytes %d\n", flash_devsel_as_str(devsel), addr, num_bytes);
+  flash_cmd(devsel, &FOT_READ_SFDP, addr, num_bytes, NULL, rary);
+  return;
+}
 
-  //printf("Entered Page Program Function\n");
-  byte *rary;
-  //printf("Declared rary\n");
-  rary = (byte *) malloc(num_bytes * sizeof(byte));  // Just allocate, no need to initialize as it will overwritten by flash_op
-  if (rary == NULL) {
-    ERRORS_DETECTED++;
-    printf("(fr_Page_Program):  *** ERROR - malloc() call failed. READ operation is skipped. ***\n");
-    return;
-  }
 
-  //printf("Array alloced\n");
-  if (TRC_FLASH_CMD == TRC_ON) printf("fr_Page_Program: devsel %s, addr %4X, num_bytes %d\n", flash_devsel_as_str(devsel), addr, num_bytes);
-  //       devsel  cmd   addr  num_addr, num_dummy, num_bytes, wdata[], rdata[], dir      , comment
-  flash_op(devsel, 0x02, addr, 4       , 0        , num_bytes, wary   , rary   , FO_DIR_WR, "PAGE PROGRAM");
 
-  //printf("Flash Op page program complete\n");
+// --------------------------------------------------------------------------------------------------------
+// Read any number of bytes (a whole sector, an image) with one FAST READ, chip select stays asserted all along and the
+// data goes straight into 'rary'
+void fr_Fast_Read(u32 devsel, u32 addr, int num_bytes, byte *rary)   // 4 byte address
+{ flash_dev *d = flash_dev_of(devsel);
+
+  if (TRC_FLASH_CMD == TRC_ON) printf("fr_Fast_Read: devsel %s, addr %4X, num_bytes %d\n", flash_devsel_as_str(devsel), addr, num_bytes);
+  flash_cmd(devsel, d->quad ? &d->quad_read : &d->fast_read, addr, num_bytes, NULL, rary);
+  return;
+}
 
-  //printf("Deallocating array\n");
-  // Free malloc'd memory
-  free(rary);
 
-  //printf("Free array complete\n");
-  //printf("Finished deallocating array\n");
 
+// --------------------------------------------------------------------------------------------------------
+void fw_Page_Program(u32 devsel, u32 addr, int num_bytes, byte *wary)   // 3 byte address
+{ flash_dev *d = flash_dev_of(devsel);
+
+  if (TRC_FLASH_CMD == TRC_ON) printf("fr_Page_Program: devsel %s, addr %4X, num_bytes %d\n", flash_devsel_as_str(devsel), addr, num_bytes);
+  flash_cmd(devsel, (d->quad && d->quad_program.cmd != 0 && FLASH_QUAD == FQ_ON) ? &d->quad_program : &d->program, addr, num_bytes, wary, NULL);   // Shifted out data is not kept
+  flash_busy_issued(devsel, BUSY_PP);
   return;
 }
 
@@ -2176,6 +3350,8 @@ void Check_Accumulated_Errors(void)  // Check Global error flag to determine if
      return;
   } else
   {  printf("Check_Accumulated_Errors: #### FAIL #### (%d errors detected)\n", ERRORS_DETECTED);
+     trace_dump(stdout, TRACE_EVENTS_ON_FAIL);   // AXI and FLASH operations leading up to the failure
+     trace_save();
      return;   // main() only allows value of 0 or 1 as return values
   }
 }
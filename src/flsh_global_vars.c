@@ -33,10 +33,49 @@ int ERRORS_DETECTED = 0;
 
 // When enabled, flash_op does extra checking on the Quad SPI core. However this may impact performance.
 int FLASH_OP_CHECK = FO_CHK_OFF;
+int FLASH_OP_CHECK_EVERY = 64;     // FO_CHK_SAMPLED: mean spacing of the checked ops
+
+// How flash_op moves data through the QSPI FIFOs, lockstep fill / drain cycles or streaming
+int FLASH_OP_ENGINE = FOE_LOCKSTEP;
+
+// When enabled, the DTR FIFO and ICAP waits use the device status in CFG_FLASH_ADDR instead of AXI reads of IPISR and SR
+int DEVSTAT_WAIT = DSW_OFF;
+
+// When enabled, axi_write skips writes that leave a shadowed QSPI / ICAP control register unchanged
+int AXI_SHADOW_REGS = SHD_ON;
+
+// When enabled, flash_session_begin() keeps the FLASH selected across the commands of a sequence
+int FLASH_SESSIONS = FSS_OFF;
+
+// When enabled, the facility functions erase, program and read with the 4-byte opcodes of the FLASH
+int FLASH_4B_OPCODES = F4B_OFF;
+
+// Which status register fr_wait_for_WRITE_IN_PROGRESS_to_clear polls, and how many samples of it one poll clocks out
+int FLASH_WIP_WAIT    = WIPW_SR;
+int FLASH_WIP_SAMPLES = 1;
+
+// When enabled, waits for the end of a program / erase sleep through the time it is known to take
+int FLASH_BUSY_MODEL = BSY_OFF;
+
+// Whether reads and programs move their data on 4 lanes
+int FLASH_QUAD = FQ_OFF;
+
+// When enabled, update_image erases and programs only the sectors that differ from the FLASH contents
+int FLASH_DIFF = FDF_OFF;
+
+// When enabled, the erases and page programs of the two FLASH of SPIx8 mode overlap
+int FLASH_INTERLEAVE = FIL_OFF;
 
 // Accumulate the number of FLASH ops performed since the test started
 int FLASH_OP_COUNT = 0;    
 
+// Accumulate the number of config space accesses (one syscall each on real hardware) since the test started
+long CONFIG_OP_COUNT = 0;
+
+// Accumulate the number of AXI operations issued, and of axi_write's skipped by the register shadow, since the test started
+long AXI_OP_COUNT = 0;
+long AXI_WRITES_SKIPPED = 0;
+
 // Reusable array of bytes to hold lower 3 bytes of address, use for invoking FLASH operation
 byte FLASH_ADDR[] = { 0x00, 0x00, 0x00 };
 
@@ -45,9 +84,9 @@ byte FLASH_ADDR[] = { 0x00, 0x00, 0x00 };
 byte FLASH_UPPER_ADDR_DEV1 = 0x00;
 byte FLASH_UPPER_ADDR_DEV2 = 0x00;
 
-// Set to size of DTR / DRR FIFOs used in IP wizard when generating Quad SPI core (16 or 256 bytes)
-//const int FIFO_DEPTH = 256;    
-  const int FIFO_DEPTH = 16;     
+// Size of DTR / DRR FIFOs used in IP wizard when generating Quad SPI core (16 or 256 bytes).
+// QSPI_setup() probes the core and sets it, 16 is the smallest the core allows.
+int FIFO_DEPTH = 16;
 
 
 #endif
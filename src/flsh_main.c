@@ -24,7 +24,12 @@
 #include <getopt.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include "flsh_common_defs.h"
+#include "flsh_cfg_backend.h"
+#include "flsh_trace.h"
+#include "flsh_poll.h"
+#include "flsh_sfdp.h"
 #include "flsh_common_funcs.h"
 #include "flsh_global_vars.h"
 
@@ -39,11 +44,13 @@
 
 extern void my_test();
 int update_image(u32 devsel,char binfile[1024], char cfgbdf[1024], int start_addr, int verbose_flag);
+int update_images(int num_images, u32 devsel[], char *binfile[], int start_addr, int verbose_flag);
 int update_image_zynqmp(char binfile[1024], char cfgbdf[1024], int start_addr, int verbose_flag);
 
 int main(int argc, char *argv[])
 {
   static int verbose_flag = 0;
+  static int poll_stats_flag = 0;
   static int dualspi_mode_flag = 1; //default to assume x8 spi programming/loading
   static struct option long_options[] =
   {
@@ -52,25 +59,47 @@ int main(int argc, char *argv[])
     {"brief",   no_argument,       &verbose_flag, 0},
     {"singlespi",    no_argument,  &dualspi_mode_flag, 0},
     {"dualspi",      no_argument,  &dualspi_mode_flag, 1},
+    {"devstat_wait", no_argument,  &DEVSTAT_WAIT, DSW_ON},    // Wait on DTR Empty / ICAP EOS through CFG_FLASH_ADDR status
+    {"regpoll",      no_argument,  &DEVSTAT_WAIT, DSW_OFF},   // Wait on DTR Empty / ICAP EOS with AXI reads of IPISR / SR (default)
+    {"noshadow",     no_argument,  &AXI_SHADOW_REGS, SHD_OFF}, // Write QSPI / ICAP control registers even when the value is unchanged
+    {"lockstep",     no_argument,  &FLASH_OP_ENGINE, FOE_LOCKSTEP},  // flash_op fills the DTR FIFO, waits for it to drain, reads the DRR (default)
+    {"stream",       no_argument,  &FLASH_OP_ENGINE, FOE_STREAM},    // flash_op tops up the DTR and drains the DRR while the SPI master runs
+    {"session",      no_argument,  &FLASH_SESSIONS, FSS_ON},   // Keep the FLASH selected across the commands of an erase / program / read back
+    {"nosession",    no_argument,  &FLASH_SESSIONS, FSS_OFF},  // Select and deselect the FLASH around every command (default)
+    {"opcodes4b",    no_argument,  &FLASH_4B_OPCODES, F4B_ON}, // Erase, program and read with the 4-byte opcodes (0x21, 0xDC, 0x13, 0x12)
+    {"busy",         no_argument,  &FLASH_BUSY_MODEL, BSY_ON},  // Sleep through most of the known program / erase time before polling for its end
+    {"nobusy",       no_argument,  &FLASH_BUSY_MODEL, BSY_OFF}, // Poll for the end of program / erase right away (default)
+    {"diff",         no_argument,  &FLASH_DIFF, FDF_ON},      // Read the FLASH first, erase and program only the sectors that differ from the image
+    {"interleave",   no_argument,  &FLASH_INTERLEAVE, FIL_ON},  // SPIx8: overlap the erases, page programs and read backs of DEV1 and DEV2
+    {"serial",       no_argument,  &FLASH_INTERLEAVE, FIL_OFF}, // SPIx8: program DEV1 to completion, then DEV2 (default)
     {"image_file1",  required_argument, 0, 'a'},
     {"image_file2",  required_argument, 0, 'b'},
     {"devicebdf",    required_argument, 0, 'c'},
     {"startaddr",    required_argument, 0, 'd'},
+    {"backend",      required_argument, 0, 'e'},
+    {"trace_file",   required_argument, 0, 'f'},
+    {"trace_events", required_argument, 0, 'g'},
+    {"trace_decode", required_argument, 0, 'h'},
+    {"poll",         required_argument, 0, 'i'},   // <site>:spin=<n>,sleep_min=<us>,sleep_max=<us>,timeout=<ms>
+    {"wip_wait",     required_argument, 0, 'j'},   // sr|fsr[,<samples>]: status register polled for the end of program / erase
+    {"quad",         required_argument, 0, 'k'},   // off|auto|on: read and program on 4 data lanes when the core and FLASH allow it
+    {"opcheck",      required_argument, 0, 'l'},   // off|sampled[,<n>]|on: QSPI checks of no FLASH op, about one in n (default 64), or all
+    {"poll_stats",   no_argument,  &poll_stats_flag, 1},   // Print poll counts and histograms at the end
           {0, 0, 0, 0}
   };
 
   char binfile[1024];
   char binfile2[1024];
   char cfgbdf[1024];
-  char cfg_file[1024];
-  int CFG;
   int start_addr=0;
   char temp_addr[256];
+  int trace_events = TRACE_EVENTS_DEFAULT;
+  char *trace_decode_file = NULL;
 
   while(1) {
       int option_index = 0;
       int c;
-      c = getopt_long (argc, argv, "a:b:c:d:",
+      c = getopt_long (argc, argv, "a:b:c:d:e:f:g:h:i:j:k:l:",
                        long_options, &option_index);
 
       /* Detect the end of the options. */
@@ -112,6 +141,65 @@ int main(int argc, char *argv[])
 	  start_addr = (int)strtol(temp_addr,NULL,16);
           if(verbose_flag)
 	    printf(" Start Address (same address for SPIx8 on both parts): %d\n", start_addr);
+          break;
+
+        case 'e':
+          if (cfg_backend_select(optarg) != 0)
+            exit(-1);
+          if(verbose_flag)
+            printf(" Config space backend: %s\n", optarg);
+          break;
+
+        case 'f':
+          trace_set_file(optarg);
+          break;
+
+        case 'g':
+          trace_events = atoi(optarg);
+          break;
+
+        case 'h':
+          trace_decode_file = optarg;
+          break;
+
+        case 'i':
+          if (poll_config(optarg) != 0)
+            exit(-1);
+          break;
+
+        case 'j':
+          if      (strncmp(optarg, "sr" , 2) == 0 && (optarg[2] == '\0' || optarg[2] == ',')) FLASH_WIP_WAIT = WIPW_SR;
+          else if (strncmp(optarg, "fsr", 3) == 0 && (optarg[3] == '\0' || optarg[3] == ',')) FLASH_WIP_WAIT = WIPW_FSR;
+          else {
+            printf("ERROR: --wip_wait must be sr or fsr, optionally followed by ,<samples per poll>\n");
+            exit(-1);
+          }
+          if (strchr(optarg, ',') != NULL) FLASH_WIP_SAMPLES = atoi(strchr(optarg, ',') + 1);
+          if (FLASH_WIP_SAMPLES < 1) FLASH_WIP_SAMPLES = 1;
+          break;
+
+        case 'k':
+          if      (strcmp(optarg, "off" ) == 0) FLASH_QUAD = FQ_OFF;
+          else if (strcmp(optarg, "auto") == 0) FLASH_QUAD = FQ_AUTO;
+          else if (strcmp(optarg, "on"  ) == 0) FLASH_QUAD = FQ_ON;
+          else {
+            printf("ERROR: --quad must be off, auto or on\n");
+            exit(-1);
+          }
+          break;
+
+        case 'l':
+          if      (strcmp(optarg, "off") == 0) FLASH_OP_CHECK = FO_CHK_OFF;
+          else if (strcmp(optarg, "on" ) == 0) FLASH_OP_CHECK = FO_CHK_ON;
+          else if (strncmp(optarg, "sampled", 7) == 0 && (optarg[7] == '\0' || optarg[7] == ',')) FLASH_OP_CHECK = FO_CHK_SAMPLED;
+          else {
+            printf("ERROR: --opcheck must be off, sampled[,<ops per check>] or on\n");
+            exit(-1);
+          }
+          if (strchr(optarg, ',') != NULL) FLASH_OP_CHECK_EVERY = atoi(strchr(optarg, ',') + 1);
+          if (FLASH_OP_CHECK_EVERY < 1) FLASH_OP_CHECK_EVERY = 1;
+          break;
+
         case '?':
           /* getopt_long already printed an error message. */
           break;
@@ -121,24 +209,19 @@ int main(int argc, char *argv[])
         }
     }
 
+  // A saved trace ring is decoded without touching a card
+  if (trace_decode_file != NULL)
+    exit(trace_decode(trace_decode_file) == 0 ? 0 : -1);
+  trace_init(trace_events);
+
   if(verbose_flag)
     printf("Registers value: TRC_CONFIG = %d, TRC_AXI = %d, TRC_FLASH = %d, TRC_FLASH_CMD = %d\n", TRC_CONFIG, TRC_AXI, TRC_FLASH, TRC_FLASH_CMD);
 
   u32 temp;
   int vendor,device, subsys;
   int BIN,i, j;
-  strcpy(cfg_file,"/sys/bus/pci/devices/");
-  strcat(cfg_file,cfgbdf);
-  strcat(cfg_file,"/config");
-
-  if ((CFG = open(cfg_file, O_RDWR)) < 0) {
-    printf("Can not open %s\n",cfg_file);
-    exit(-1);
-  }
-
-  //TODO/FIXME: passing this on to global cfg descriptor
-  if ((CFG_FD = open(cfg_file, O_RDWR)) < 0) {
-    printf("Can not open %s\n",cfg_file);
+  if (cfg_backend_open(cfgbdf) != 0) {
+    printf("Can not open config space of %s through backend %s\n", cfgbdf, CFG_BACKEND->name);
     exit(-1);
   }
 
@@ -216,6 +299,7 @@ int main(int argc, char *argv[])
      update_image_zynqmp(binfile,cfgbdf,start_addr, verbose_flag);
      printf("\033[1mFinished Programming Sequence\033[0m\n");
      printf("----------------------------------\n");
+     if (ERRORS_DETECTED != 0) Check_Accumulated_Errors();
 
 
 //===============================================
@@ -253,11 +337,7 @@ int main(int argc, char *argv[])
   }
 
   num_package_icap = fsize/4 + (fsize % 4 != 0); //reading 32b words
-  rdata = 0;
-  while (rdata != SR_ICAPEn_EOS) {
-    rdata = axi_read(FA_ICAP, FA_ICAP_SR  , FA_EXP_OFF, FA_EXP_0123, "ICAP: read SR (monitor ICAPEn)");
-    //printf("Waiting for ICAP EOS set \e[1A\n");
-  }
+  wait_ICAP_EOS("ICAP: read SR (monitor ICAPEn)");
   if(verbose_flag) {
       printf("ICAP EOS done.            \n");
       read_QSPI_regs();
@@ -288,26 +368,14 @@ int main(int argc, char *argv[])
     for (j=0;j<icap_burst_size;j++) {
       dif = read(BIN,&wdatatmp,4);
       wdata = ((wdatatmp>>24)&0xff) | ((wdatatmp<<8)&0xff0000) | ((wdatatmp>>8)&0xff00) | ((wdatatmp<<24)&0xff000000);
-      axi_write(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
-      rdata = 1;
-      while (rdata != CR_Write_clear) {
-        rdata = axi_read(FA_ICAP, FA_ICAP_CR  , FA_EXP_OFF, FA_EXP_0123, "ICAP: read CR (monitor ICAPEn)");
-      }
-      rdata = 0;
-      while (rdata != SR_ICAPEn_EOS) {
-        rdata = axi_read(FA_ICAP, FA_ICAP_SR  , FA_EXP_OFF, FA_EXP_0123, "ICAP: read SR (monitor ICAPEn)");
-      }
+      // CR and SR don't change while the write FIFO is only being filled, so the burst is posted and checked once
+      axi_write_post(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
     }
+    axi_fence("ICAP: fence WF (burst complete, before flushing the write FIFO)");
     // Flush the WR FIFO
     axi_write(FA_ICAP, FA_ICAP_CR, FA_EXP_OFF, FA_EXP_0123, CR_Write_cmd, "ICAP: write CR (initiate bitstream writing)");
-    rdata = 1;
-    while (rdata != CR_Write_clear) {
-      rdata = axi_read(FA_ICAP, FA_ICAP_CR  , FA_EXP_OFF, FA_EXP_0123, "ICAP: read CR (monitor ICAPEn)");
-    }
-    rdata = 0;
-    while (rdata != SR_ICAPEn_EOS) {
-      rdata = axi_read(FA_ICAP, FA_ICAP_SR  , FA_EXP_OFF, FA_EXP_0123, "ICAP: read SR (monitor ICAPEn)");
-    }
+    axi_poll(FA_ICAP, FA_ICAP_CR, 0xFFFFFFFF, CR_Write_clear, &POLL_ICAP_CR, "ICAP: read CR (monitor ICAPEn)");
+    wait_ICAP_EOS("ICAP: read SR (monitor ICAPEn)");
     prev_percentage = percentage;
   }
 
@@ -315,25 +383,12 @@ int main(int argc, char *argv[])
   for (i=0;i<num_package_lastburst;i++) {
     dif = read(BIN,&wdatatmp,4);
     wdata = ((wdatatmp>>24)&0xff) | ((wdatatmp<<8)&0xff0000) | ((wdatatmp>>8)&0xff00) | ((wdatatmp<<24)&0xff000000);
-    axi_write(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
-    rdata = 1;
-    while (rdata != CR_Write_clear) {
-      rdata = axi_read(FA_ICAP, FA_ICAP_CR  , FA_EXP_OFF, FA_EXP_0123, "ICAP: read CR (monitor ICAPEn)");
-    }
-    rdata = 0;
-    while (rdata != SR_ICAPEn_EOS) {
-      rdata = axi_read(FA_ICAP, FA_ICAP_SR  , FA_EXP_OFF, FA_EXP_0123, "ICAP: read SR (monitor ICAPEn)");
-    }
+    axi_write_post(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
   }
+  axi_fence("ICAP: fence WF (last burst complete, before flushing the write FIFO)");
   axi_write(FA_ICAP, FA_ICAP_CR, FA_EXP_OFF, FA_EXP_0123, CR_Write_cmd, "ICAP: write CR (initiate bitstream writing)");
-  rdata = 1;
-  while (rdata != CR_Write_clear) {
-    rdata = axi_read(FA_ICAP, FA_ICAP_CR  , FA_EXP_OFF, FA_EXP_0123, "ICAP: read CR (monitor ICAPEn)");
-  }
-  rdata = 0;
-  while (rdata != SR_ICAPEn_EOS) {
-    rdata = axi_read(FA_ICAP, FA_ICAP_SR  , FA_EXP_OFF, FA_EXP_0123, "ICAP: read SR (monitor ICAPEn)");
-  }
+  axi_poll(FA_ICAP, FA_ICAP_CR, 0xFFFFFFFF, CR_Write_clear, &POLL_ICAP_CR, "ICAP: read CR (monitor ICAPEn)");
+  wait_ICAP_EOS("ICAP: read SR (monitor ICAPEn)");
   close(BIN);
   // The following read is just to remove the decoupling done in FPGA
   rdata = axi_read(FA_QSPI, FA_QSPI_SPICR, FA_EXP_OFF, FA_EXP_0123, "Test axi_read");
@@ -355,8 +410,10 @@ int main(int argc, char *argv[])
 // default code : not a 250SOC and not a PartialReconfiguration
     printf(" QSPI master core setup: started\r");
     QSPI_setup();          // Reset and set up Quad SPI core
-    if(verbose_flag) 
+    if(verbose_flag) {
+      printf(" QSPI DTR / DRR FIFO depth: %d bytes\n", FIFO_DEPTH);
       read_QSPI_regs();
+    }
 
     TRC_AXI = TRC_OFF;
     TRC_CONFIG = TRC_OFF;
@@ -369,9 +426,16 @@ int main(int argc, char *argv[])
     printf("\n----------------------------------\n");
 
     printf("\033[1m Programming Primary SPI with primary bitstream:\033[0m\n    %s\n",binfile);
-    update_image(SPISSR_SEL_DEV1,binfile,cfgbdf,start_addr, verbose_flag);
+    if(dualspi_mode_flag && FLASH_INTERLEAVE == FIL_ON) {   // Both FLASH at once
+      u32  devsels[2]  = { SPISSR_SEL_DEV1, SPISSR_SEL_DEV2 };
+      char *binfiles[2] = { binfile, binfile2 };
+      printf("\033[1m Programming Secondary SPI with secondary bitstream:\033[0m\n    %s\n",binfile2);
+      update_images(2, devsels, binfiles, start_addr, verbose_flag);
+    } else {
+      update_image(SPISSR_SEL_DEV1,binfile,cfgbdf,start_addr, verbose_flag);
+    }
 
-    if(dualspi_mode_flag) {
+    if(dualspi_mode_flag && FLASH_INTERLEAVE == FIL_OFF) {
       printf("----------------------------------\n");
       printf("\033[1m Programming Secondary SPI with secondary bitstream:\033[0m\n    %s\n",binfile2);
       update_image(SPISSR_SEL_DEV2,binfile2,cfgbdf,start_addr, verbose_flag);
@@ -384,154 +448,439 @@ int main(int argc, char *argv[])
 
    }
 }
+  trace_save();
+  if (poll_stats_flag) {
+    poll_stats(stdout);
+    flash_busy_stats(stdout);
+  }
+  cfg_backend_close();
   return 0;  // Incisive simulator doesn't like anything other than 0 as return value from main() 
 }
 
 
 //========================================
 
-// Programming Primary/Secondary SPI with primary/secondary bitstream
-int update_image(u32 devsel,char binfile[1024], char cfgbdf[1024], int start_addr, int verbose_flag)
-{
-  int priv1,priv2;
-  int dat, dif;
-  int cp;
-  int CFG;
-  int BIN;
-  time_t st, et, eet, set, ept, spt, svt, evt;
-  int address_primary, raddress_primary, eaddress_primary, paddress_primary , address_secondary, raddress_secondary, eaddress_secondary, paddress_secondary;
-
-  char bin_file[256];
-  char cfg_file[256];
-
-  int  print_cnt = 0;
+// Bytes of page 'page' in an image of 'fsize' bytes: 256, fewer for the last one
+static int image_page_bytes(off_t fsize, int page)
+{ off_t left = fsize - (off_t) page * 256;
+  return (left < 256) ? (int) left : 256;
+}
 
-  //if (argc < 2) {
-  //  printf("Usage: capi_flash <rbf_file> <card#>\n\n");
-  //}
-  strcpy (bin_file, binfile);
+// The page is erased FLASH already: all 0xFF, nothing to program
+static int image_page_blank(byte *data, int num_bytes)
+{ int i;
+  for (i = 0; i < num_bytes; i++)
+    if (data[i] != 0xFF) return 0;
+  return 1;
+}
 
-  if ((BIN = open(bin_file, O_RDONLY)) < 0) {
-    printf("ERROR: Can not open %s\n",bin_file);
-    exit(-1);
+// Decisions of update_image() for a sector, see plan_sector()
+#define SECTOR_SAME    0            // The FLASH holds the image already
+#define SECTOR_PROGRAM 1            // Differing pages only clear bits: program them without an erase
+#define SECTOR_ERASE   2            // Erase the sector and program all its pages
+
+// Compare 'num_pages' pages of the FLASH read back in 'flash' with the image from page 'first_page' on (the bytes past
+// the end of the image are not looked at). Marks the pages to program in 'plan', returns the decision for the sector.
+static int plan_sector(byte *flash, byte *image, off_t fsize, int first_page, int num_pages, byte *plan)
+{ byte *img, *cur;
+  int  i, k, n, differ = 0, erase = 0;
+
+  for (i = 0; i < num_pages; i++) {
+    img = image + (off_t) (first_page + i) * 256;
+    cur = flash + i * 256;
+    n   = image_page_bytes(fsize, first_page + i);
+    plan[i] = (memcmp(cur, img, n) != 0);
+    if (!plan[i]) continue;
+    differ = 1;
+    for (k = 0; k < n && !erase; k++)
+      if ((cur[k] & img[k]) != img[k]) erase = 1;   // A 0 to 1 transition needs an erase
   }
+  if (erase) {                      // All pages but the blank ones, erased already
+    for (i = 0; i < num_pages; i++)
+      plan[i] = !image_page_blank(image + (off_t) (first_page + i) * 256, image_page_bytes(fsize, first_page + i));
+    return SECTOR_ERASE;
+  }
+  return differ ? SECTOR_PROGRAM : SECTOR_SAME;
+}
 
-  strcpy(cfg_file, "/sys/bus/pci/devices/");
-  strcat(cfg_file, cfgbdf);
-  strcat(cfg_file, "/config");
+#define SECTOR_TRIES 3              // Erase and program a sector that doesn't read back as the image up to this many times
 
+// One FLASH written by update_images(): its image, what to erase and program, and how far that got
+typedef struct {
+  u32   devsel;
+  int   BIN;
   off_t fsize;
+  byte *image;                      // The image file, mapped: pages are programmed and compared straight from it
+  int   address;                    // FLASH address of the image
+  int   num_64KB_sectors, num_256B_pages;
+  byte *sector_plan, *page_plan;    // What to do per sector and per page: everything, or with --diff only what differs
+  int   num_pages_programmed;       // Page programs sent, the ones of retries included
+  int   prepared;                   // Sectors whose page plan is made, see image_job_prepare()
+  flash_erase_step *erase_plan;     // See flash_erase_plan()
+  int   num_erases;
+  int   sector;                     // Sector being written, see image_job_issue()
+  int   next_erase, next_page;      // First erase / page not sent yet
+  int   tries;                      // Times the sector was written
+  flash_erase_step retry[FLASH_ERASE_PLAN_MAX(65536)];   // Erases of the sector, to write it again
+  int   num_retry, next_retry;
+  long  axi_ops_other;              // AXI ops of the erases and read backs, left out of the ops per programmed page
+} image_job;
+
+static byte rsector[65536];         // Read back of one sector
+
+// Open and map the image, set up the FLASH and plan its erases and programs
+static void image_job_open(image_job *job, u32 devsel, char *bin_file, int start_addr, int verbose_flag)
+{
+  int i, j, num_run, max_erases;
+  int percentage = 0;
+  int prev_percentage = 1;
+  int num_same = 0, num_program = 0, num_erase = 0, num_pages = 0;
   struct stat tempstat;
-  int num_64KB_sectors, num_256B_pages;
-  address_primary = start_addr;  //TODO/FIXME: decide starting address within primary spi.
-  address_secondary = start_addr;  //TODO/FIXME: decide starting address within secondary spi.
-  raddress_primary = paddress_primary = eaddress_primary = address_primary;
-  raddress_secondary = paddress_secondary = eaddress_secondary = address_secondary;
+  time_t st;
+
+  memset(job, 0, sizeof(*job));
+  job->devsel  = devsel;
+  job->address = start_addr;  //TODO/FIXME: decide starting address within primary / secondary spi.
+  if ((job->BIN = open(bin_file, O_RDONLY)) < 0) {
+    printf("ERROR: Can not open %s\n",bin_file);
+    exit(-1);
+  }
   if (stat(bin_file, &tempstat) != 0) {
     fprintf(stderr, "Cannot determine size of %s: %s\n", bin_file, strerror(errno));
     exit(-1);
   } else {
-    fsize = tempstat.st_size;
+    job->fsize = tempstat.st_size;
   }
   if (verbose_flag)
-    printf("\n Flashing file of size %ld bytes\n",fsize);
-  num_64KB_sectors = fsize/65536 + 1;
-  num_256B_pages = fsize/256 + 1;
-  if(verbose_flag) {
-    printf("Performing %d 64KiB sector erases\n",num_64KB_sectors);
-    printf("Performing %d 256B Programs/Reads\n",num_256B_pages);
+    printf("\n Flashing file of size %ld bytes\n",job->fsize);
+  job->num_64KB_sectors = (job->fsize + 65535) / 65536;   // The last sector and page may be partly covered
+  job->num_256B_pages   = (job->fsize + 255) / 256;
+  if(verbose_flag)
+    printf("Performing %d 256B Programs/Reads\n",job->num_256B_pages);
+
+  if (job->fsize > 0 && (job->image = mmap(NULL, job->fsize, PROT_READ, MAP_PRIVATE, job->BIN, 0)) == MAP_FAILED) {
+    printf("ERROR: Can not map %s: %s\n", bin_file, strerror(errno));
+    exit(-1);
   }
 
- // Set stdout to autoflush
- setvbuf(stdout, NULL, _IONBF, 0);
+  //Initial Flash memory setup
+  flash_session_begin(devsel);   // The commands below go to this FLASH, keep it selected
+  flash_setup(devsel);
+  if(verbose_flag)
+    read_flash_regs(devsel);
 
- int i,j;
- byte wdata[256], rdata[256], edat[256];
- int percentage = 0;
- int prev_percentage = 1;
+  job->sector_plan = malloc(job->num_64KB_sectors + 1);
+  job->page_plan   = malloc(job->num_256B_pages + 1);
+  if (job->sector_plan == NULL || job->page_plan == NULL) {
+    printf("ERROR: Can not allocate the plan of %d sectors\n", job->num_64KB_sectors);
+    exit(-1);
+  }
+  memset(job->sector_plan, SECTOR_ERASE, job->num_64KB_sectors);   // Their page plans are made while writing
+
+  st = time(NULL);
+  if (FLASH_DIFF == FDF_ON) {
+    //printf("Entering Compare Segment\n");
+    for(i=0;i<job->num_64KB_sectors;i++) {
+      percentage = (int)(i*100/job->num_64KB_sectors);
+      if( ((percentage %5) == 0) && (prev_percentage != percentage))
+         printf(" Comparing Sectors  : \033[1m%d %%\033[0m of %d sectors   \r", percentage, job->num_64KB_sectors);
+      j = (job->num_256B_pages - i * 256 < 256) ? job->num_256B_pages - i * 256 : 256;
+      fr_Fast_Read(devsel, job->address + i * 65536, j * 256, rsector);
+      job->sector_plan[i] = plan_sector(rsector, job->image, job->fsize, i * 256, j, &job->page_plan[i * 256]);
+      if (verbose_flag && job->sector_plan[i] != SECTOR_SAME)
+        printf(" Sector %5d at h%8.8X: %s\n", i, job->address + i * 65536,
+               (job->sector_plan[i] == SECTOR_PROGRAM) ? "program without erase" : "erase and program");
+      prev_percentage = percentage;
+    }
+    printf(" Comparing Sectors  : \033[1mcompleted\033[0m in   %d seconds           \n", (int) (time(NULL) - st));
+    job->prepared = job->num_64KB_sectors;   // plan_sector() made the page plans
+    for(i=0;i<job->num_64KB_sectors;i++) {
+      if (job->sector_plan[i] == SECTOR_SAME)    num_same++;
+      if (job->sector_plan[i] == SECTOR_PROGRAM) num_program++;
+      if (job->sector_plan[i] == SECTOR_ERASE)   num_erase++;
+    }
+    for(i=0;i<job->num_256B_pages;i++)
+      num_pages += job->page_plan[i];
+    printf(" Sectors            : %d unchanged, %d programmed without erase, %d erased and programmed (%d pages)\n",
+           num_same, num_program, num_erase, num_pages);
+  }
 
- //Initial Flash memory setup
- flash_setup(devsel);
- if(verbose_flag)
-   read_flash_regs(devsel);
+  // Erases: each run of sectors to erase, up to the end of the image, gets the cheapest mix of the FLASH's erase sizes
+  max_erases = FLASH_ERASE_PLAN_MAX(job->fsize) + 2 * job->num_64KB_sectors;
+  job->erase_plan = malloc(max_erases * sizeof(flash_erase_step));
+  if (job->erase_plan == NULL) {
+    printf("ERROR: Can not allocate the erase plan of %d sectors\n", job->num_64KB_sectors);
+    exit(-1);
+  }
+  for(i=0;i<job->num_64KB_sectors;i=j) {
+    for(j=i;j<job->num_64KB_sectors && job->sector_plan[j] == job->sector_plan[i];j++);
+    if (job->sector_plan[i] != SECTOR_ERASE) continue;
+    num_run = flash_erase_plan(devsel, job->address + i * 65536,
+                               (u32) ((((off_t) j * 65536 < job->fsize) ? (off_t) j * 65536 : job->fsize) - (off_t) i * 65536),
+                               &job->erase_plan[job->num_erases], max_erases - job->num_erases);
+    if (num_run < 0) exit(-1);
+    job->num_erases += num_run;
+  }
+  if (verbose_flag)
+    flash_erase_plan_print(devsel, job->erase_plan, job->num_erases);
+  return;
+}
 
- //printf("Entering Erase Segment\n");
- st = set = time(NULL);
- cp = 1;
- lseek(BIN, 0, SEEK_SET);   // Reset to beginning of file
- for(i=0;i<num_64KB_sectors;i++) {
-   percentage = (int)(i*100/num_64KB_sectors);
-   if( ((percentage %5) == 0) && (prev_percentage != percentage))
-      printf(" Erasing Sectors    : \033[1m%d %%\033[0m of %d sectors   \r", percentage, num_64KB_sectors);
-   fw_Write_Enable(devsel);
-   fw_64KB_Sector_Erase(devsel, eaddress_secondary);
-   fr_wait_for_WRITE_IN_PROGRESS_to_clear(devsel);
-   eaddress_secondary = eaddress_secondary + 65536;
-   prev_percentage = percentage;
- }
+// Make the page plan of the next sector while the FLASH erases or programs: pages left all 0xFF by the erase are not
+// programmed. Going through its image data also brings it in from the file. Does nothing when a sector ahead is ready.
+static void image_job_prepare(image_job *job)
+{
+  int i, last_page;
 
- eet = spt = time(NULL);
- eet = eet - set;
- printf(" Erasing Sectors    : \033[1mcompleted\033[0m in   %d seconds           \n", (int)eet);
- 
- //printf("Entering Program Segment\n");
+  if (job->prepared >= job->num_64KB_sectors || job->prepared > job->sector + 1) return;
+  last_page = (job->num_256B_pages < (job->prepared + 1) * 256) ? job->num_256B_pages : (job->prepared + 1) * 256;
+  for (i = job->prepared * 256; i < last_page; i++)
+    job->page_plan[i] = !image_page_blank(job->image + (off_t) i * 256, image_page_bytes(job->fsize, i));
+  job->prepared++;
+}
 
- lseek(BIN, 0, SEEK_SET);   // Reset to beginning of file
- for(i=0;i<num_256B_pages;i++) {
-   percentage = (int)(i*100/num_256B_pages);
-   if( ((percentage %5) == 0) && (prev_percentage != percentage))
-       printf("\033[1m Writing\033[0m image code : \033[1m%d %%\033[0m of %d pages                        \r", percentage, num_256B_pages);
-   dif = read(BIN,&wdata,256);
-   if (!(dif)) {
-     //edat = 0xFFFFFFFF;
-   }
-   fw_Write_Enable(devsel);
-   fw_Page_Program(devsel, paddress_secondary, 256, wdata);
-   //printf("program checkpoint 1\n");
-   fr_wait_for_WRITE_IN_PROGRESS_to_clear(devsel);
-   //printf("program checkpoint 2\n");
-   paddress_secondary = paddress_secondary + 256;
-   prev_percentage = percentage;
- }
- ept = svt = time(NULL); 
- ept = ept - spt;
- printf(" Writing Image code : \033[1mcompleted\033[0m in   %d seconds           \n", (int)ept);
+// Read back the sector and compare it with the image. Returns the number of differing bytes, printed with 'report',
+// and the offset of the first one in 'first_diff' (if not NULL).
+static int image_job_check_sector(image_job *job, int sector, int report, int *first_diff)
+{
+  int  i, j, n, first_page, num_pages, num_diff = 0;
+  byte *rdata, *edat;
+  long start_axi_ops = AXI_OP_COUNT;
+
+  first_page = sector * 256;
+  num_pages  = (job->num_256B_pages - first_page < 256) ? job->num_256B_pages - first_page : 256;
+  fr_Fast_Read(job->devsel, job->address + first_page * 256, num_pages * 256, rsector);   // One FAST READ
+  for(i=0;i<num_pages;i++) {
+    rdata = &rsector[i * 256];
+    edat  = job->image + (off_t) (first_page + i) * 256;   // Blank pages that were not programmed are checked as blank
+    n     = image_page_bytes(job->fsize, first_page + i);
+    if (memcmp(edat, rdata, n) == 0) continue;
+    for(j=0;j<n;j++) {
+      if(edat[j] == rdata[j]) continue;
+      if (num_diff == 0 && first_diff != NULL) *first_diff = i * 256 + j;
+      num_diff++;
+      if (report) printf("ERROR: EDAT byte %d: %x   RDAT byte %d: %x\n",j ,edat[j], j, rdata[j]);
+    }
+  }
+  job->axi_ops_other += AXI_OP_COUNT - start_axi_ops;
+  return num_diff;
+}
 
- //printf("Entering Read Segment\n");
-	
-  int misc_pntcnt = 0;
- lseek(BIN, 0, SEEK_SET);   // Reset to beginning of file
- for(i=0;i<num_256B_pages;i++) {
-   percentage = (int)(i*100/num_256B_pages);
-   if( ((percentage %5) == 0) && (prev_percentage != percentage))
-       printf(" Checking image code: %d %% of %d pages      \r", percentage, num_256B_pages);
-   fr_Read(devsel, raddress_secondary, 256, rdata);
-   raddress_secondary = raddress_secondary + 256;
-   prev_percentage = percentage;
-   dif = read(BIN,&edat,256);
-   if (!(dif)) {
-     //edat = 0xFFFFFFFF;
-   }
-   for(j=0;j<256;j++) {
-       if(edat[j] != rdata[j]) {
-         printf("ERROR: EDAT byte %d: %x   RDAT byte %d: %x\n",j ,edat[j], j, rdata[j]);
-       }
-   }
- }
- et = evt = time(NULL); 
- evt = evt - svt;
- printf(" Checking Image code: \033[1mcompleted\033[0m in   %d seconds           \n", (int)evt);
- 
- et = et - st;
- printf("\033[1m Total Time to write the new Image:  %d seconds.\033[0m           \n", (int)et);
- printf("\n");
+// Plan the erases to write the sector again. They stay in the sector: the erase unit it shares with the sector before
+// holds data checked already. Returns their number, or -1 (reported) when the sector can't be erased again.
+static int image_job_plan_retry(image_job *job, u32 sector_addr, int num_diff, int first_diff)
+{
+  u32 unit = flash_erase_unit(job->devsel);
+  u32 lo   = sector_addr;
+  u32 len  = (u32) ((job->fsize - (off_t) job->sector * 65536 < 65536) ? job->fsize - (off_t) job->sector * 65536 : 65536);
+
+  if (job->sector > 0 && unit != 0 && (lo & (unit - 1)) != 0) lo = (lo | (unit - 1)) + 1;
+  if (sector_addr + first_diff < lo) {
+    ERRORS_DETECTED++;
+    printf("\n(update_image):  *** ERROR - Sector %d at h%8.8X of FLASH %s has %d bytes different from the image from h%8.8X on, in the %uKB erase it shares with the sector before: not written again ***\n",
+           job->sector, sector_addr, flash_devsel_as_str(job->devsel), num_diff, sector_addr + first_diff, unit >> 10);
+    return -1;
+  }
+  job->num_retry  = flash_erase_plan(job->devsel, lo, sector_addr + len - lo, job->retry, FLASH_ERASE_PLAN_MAX(65536));
+  job->next_retry = 0;
+  if (job->num_retry <= 0) {   // flash_erase_plan() reported its errors
+    if (job->num_retry == 0) {
+      ERRORS_DETECTED++;
+      printf("\n(update_image):  *** ERROR - No erase to write sector %d at h%8.8X of FLASH %s again ***\n",
+             job->sector, sector_addr, flash_devsel_as_str(job->devsel));
+    }
+    job->num_retry = 0;
+    return -1;
+  }
+  printf("\n(update_image):  Sector %d at h%8.8X of FLASH %s has %d bytes different from the image, writing it again\n",
+         job->sector, sector_addr, flash_devsel_as_str(job->devsel), num_diff);
+  return job->num_retry;
+}
 
- close(BIN);
-/*
- close(CFG);
- close(CFG_FD);
-*/
- return 0;
+// Write the sectors of the image one after the other: the erases the sector needs, its page programs, then its read
+// back, while its image data is still in the cache. A sector that doesn't read back as the image is erased and
+// programmed again, up to SECTOR_TRIES times.
+// Sends the next erase or page program to the FLASH and returns 1 without waiting for it, returns 0 when all sectors
+// are done. Call it again once the FLASH is ready.
+static int image_job_issue(image_job *job)
+{
+  u32  sector_addr, sector_end;
+  int  i, last_page, num_diff, first_diff = 0;
+  long start_axi_ops;
+
+  flash_session_begin(job->devsel);
+  while (job->sector < job->num_64KB_sectors) {
+    sector_addr = job->address + job->sector * 65536;
+    sector_end  = sector_addr + 65536;
+    last_page   = (job->num_256B_pages < (job->sector + 1) * 256) ? job->num_256B_pages : (job->sector + 1) * 256;
+
+    // Erases first: of the sector to write it again, else those of the plan that start in it (or before it)
+    if (job->next_retry < job->num_retry) {
+      start_axi_ops = AXI_OP_COUNT;
+      fw_Write_Enable(job->devsel);
+      flash_erase_issue(job->devsel, &job->retry[job->next_retry++]);
+      job->axi_ops_other += AXI_OP_COUNT - start_axi_ops;
+      return 1;
+    }
+    if (job->next_erase < job->num_erases && job->erase_plan[job->next_erase].addr < sector_end) {
+      start_axi_ops = AXI_OP_COUNT;
+      fw_Write_Enable(job->devsel);
+      flash_erase_issue(job->devsel, &job->erase_plan[job->next_erase++]);
+      job->axi_ops_other += AXI_OP_COUNT - start_axi_ops;
+      return 1;
+    }
+
+    // Its pages
+    while (job->prepared <= job->sector) image_job_prepare(job);   // Not made while the FLASH was busy
+    while (job->next_page < last_page && !job->page_plan[job->next_page]) job->next_page++;
+    if (job->next_page < last_page) {
+      fw_Write_Enable(job->devsel);
+      fw_Page_Program(job->devsel, job->address + job->next_page * 256, image_page_bytes(job->fsize, job->next_page),
+                      job->image + (off_t) job->next_page * 256);
+      job->next_page++;
+      job->num_pages_programmed++;
+      return 1;
+    }
+
+    // Its read back, unless the sector was found to match the image before
+    job->tries++;
+    if (job->sector_plan[job->sector] != SECTOR_SAME && (num_diff = image_job_check_sector(job, job->sector, 0, &first_diff)) != 0) {
+      if (job->tries < SECTOR_TRIES && image_job_plan_retry(job, sector_addr, num_diff, first_diff) > 0) {
+        job->sector_plan[job->sector] = SECTOR_ERASE;
+        for (i = job->sector * 256; i < last_page; i++)
+          job->page_plan[i] = !image_page_blank(job->image + (off_t) i * 256, image_page_bytes(job->fsize, i));
+        job->next_page = job->sector * 256;
+        continue;
+      }
+      image_job_check_sector(job, job->sector, 1, NULL);
+      if (job->tries >= SECTOR_TRIES) {
+        ERRORS_DETECTED++;
+        printf("(update_image):  *** ERROR - Sector %d at h%8.8X of FLASH %s does not read back as the image after %d tries ***\n",
+               job->sector, sector_addr, flash_devsel_as_str(job->devsel), job->tries);
+      }
+    }
+    job->sector++;
+    job->tries     = 0;
+    job->num_retry = job->next_retry = 0;
+  }
+  return 0;
+}
+
+// Write one or two FLASH. A FLASH gets its next command as soon as it is done with the previous one: while one erases
+// or programs, the commands and read backs of the other go out. With both busy, sleep until the first one is expected
+// to be done, then poll them in turn.
+static void image_jobs_run(image_job *jobs, int num_jobs, int total)
+{ int busy[2] = { 0, 0 };
+  int k, n, done;
+  int percentage = 0;
+  int prev_percentage = 1;
+  poll_wait w;
+
+  for (;;) {
+    for (k = 0; k < num_jobs; k++)
+      if (!busy[k]) busy[k] = image_job_issue(&jobs[k]);
+    for (k = 0, done = 0; k < num_jobs; k++) done += jobs[k].sector;
+    percentage = (int)(done*100/(total ? total : 1));
+    if( ((percentage %5) == 0) && (prev_percentage != percentage))
+      printf("\033[1m Writing\033[0m image code : \033[1m%d %%\033[0m of %d sectors                        \r", percentage, total);
+    prev_percentage = percentage;
+
+    if (!busy[0] && !busy[1]) break;
+    for (k = 0; k < num_jobs; k++)  // The FLASH are busy: plan what comes next meanwhile
+      image_job_prepare(&jobs[k]);
+    if (!busy[0] || !busy[1]) {     // The other FLASH is done: plain wait
+      k = busy[0] ? 0 : 1;
+      flash_session_begin(jobs[k].devsel);
+      fr_wait_for_WRITE_IN_PROGRESS_to_clear(jobs[k].devsel);
+      busy[k] = 0;
+      continue;
+    }
+    k = (flash_busy_left_us(jobs[0].devsel) <= flash_busy_left_us(jobs[1].devsel)) ? 0 : 1;
+    flash_busy_sleep_expected(jobs[k].devsel);
+    poll_start(&w, &POLL_FLASH_WIP);
+    poll_set_timeout(&w, 0);        // fr_WRITE_IN_PROGRESS_cleared() gives up on each FLASH on its own
+    for (;;) {
+      for (n = 0; n < 2 && busy[0] && busy[1]; n++, k = 1 - k) {
+        flash_session_begin(jobs[k].devsel);
+        if (fr_WRITE_IN_PROGRESS_cleared(jobs[k].devsel)) busy[k] = 0;
+      }
+      if (!busy[0] || !busy[1]) break;
+      poll_again(&w);
+    }
+    poll_end(&w);
+  }
+  return;
+}
+
+static void image_job_close(image_job *job)
+{
+  free(job->sector_plan);
+  free(job->page_plan);
+  free(job->erase_plan);
+  if (job->image != NULL) munmap(job->image, job->fsize);
+  close(job->BIN);
+  return;
+}
+
+// Programming Primary and/or Secondary SPI with primary/secondary bitstream, sector by sector (see image_job_issue).
+// With two, their erases, page programs and read backs overlap (see image_jobs_run).
+int update_images(int num_images, u32 devsel[], char *binfile[], int start_addr, int verbose_flag)
+{
+  image_job jobs[2];
+  int  i, k, num_sectors = 0, num_pages_programmed = 0, num_pages_blank = 0;
+  long start_config_ops = CONFIG_OP_COUNT;
+  int  start_flash_ops  = FLASH_OP_COUNT;
+  long start_axi_ops, start_axi_skipped;
+  time_t st, spt;
+
+  // Set stdout to autoflush
+  setvbuf(stdout, NULL, _IONBF, 0);
+
+  // --diff leaves sectors alone, so the erases of the others must not reach into them: the image must start on a sector
+  if (FLASH_DIFF == FDF_ON && (start_addr & 0xFFFF) != 0) {
+    printf(" --diff needs a start address on a 64KB boundary, h%8.8X is not: erasing and programming the whole image\n", start_addr);
+    FLASH_DIFF = FDF_OFF;
+  }
+
+  st = time(NULL);
+  for (k = 0; k < num_images; k++) {
+    image_job_open(&jobs[k], devsel[k], binfile[k], start_addr, verbose_flag);
+    num_sectors += jobs[k].num_64KB_sectors;
+  }
+
+  //printf("Entering Erase / Program / Read Segment\n");
+  spt = time(NULL);
+  start_axi_ops     = AXI_OP_COUNT;
+  start_axi_skipped = AXI_WRITES_SKIPPED;
+  image_jobs_run(jobs, num_images, num_sectors);
+  printf(" Writing Image code : \033[1mcompleted\033[0m in   %d seconds (erased, programmed and checked per sector)\n", (int) (time(NULL) - spt));
+  for (k = 0; k < num_images; k++) {
+    start_axi_ops        += jobs[k].axi_ops_other;
+    num_pages_programmed += jobs[k].num_pages_programmed;
+    for (i = 0; i < jobs[k].num_256B_pages; i++)
+      if (!jobs[k].page_plan[i] && jobs[k].sector_plan[i / 256] == SECTOR_ERASE) num_pages_blank++;
+  }
+  if (verbose_flag && num_pages_blank > 0)
+    printf(" Skipped %d blank 256B pages, left erased\n", num_pages_blank);
+  if (verbose_flag && num_pages_programmed > 0)
+    printf(" AXI ops per programmed page: %.1f (%.1f control register writes per page skipped by the shadow)\n",
+           (double) (AXI_OP_COUNT - start_axi_ops) / num_pages_programmed, (double) (AXI_WRITES_SKIPPED - start_axi_skipped) / num_pages_programmed);
+
+  for (k = 0; k < num_images; k++)
+    image_job_close(&jobs[k]);
+
+  printf("\033[1m Total Time to write the new Image:  %d seconds.\033[0m           \n", (int) (time(NULL) - st));
+  if (verbose_flag)
+    printf(" Config space accesses: %ld for %d FLASH ops\n", CONFIG_OP_COUNT - start_config_ops, FLASH_OP_COUNT - start_flash_ops);
+  printf("\n");
+  flash_session_end();
+  return 0;
+}
+
+// Programming Primary/Secondary SPI with primary/secondary bitstream
+int update_image(u32 devsel,char binfile[1024], char cfgbdf[1024], int start_addr, int verbose_flag)
+{ (void) cfgbdf;   // The config space backend is opened by main()
+  return update_images(1, &devsel, &binfile, start_addr, verbose_flag);
 }
 
 
@@ -598,6 +947,7 @@ int update_image_zynqmp(char binfile[1024], char cfgbdf[1024], int start_addr, i
  u32 ack_status; 
 
  u32 ack_addr;
+ poll_wait w;
  int percentage = 0;
  int prev_percentage = 1;
 
@@ -621,10 +971,17 @@ int update_image_zynqmp(char binfile[1024], char cfgbdf[1024], int start_addr, i
    } else {
      printf("Waiting for card acknowledgement (\033[1mPlease be patient. It can take up to a minute!)\033[0m \r");
    }
-   ack_status = axi_read_zynq(FA_QSPI, ack_addr, FA_EXP_OFF, FA_EXP_0123, "");
-
-   while(ack_status == 0x00000001){
+   poll_start(&w, &POLL_ZYNQ_ACK);
+   do {
      ack_status = axi_read_zynq(FA_QSPI, ack_addr, FA_EXP_OFF, FA_EXP_0123, "");
+   } while (ack_status == 0x00000001 && poll_again(&w) == 0);
+   poll_end(&w);
+   if (w.timed_out) {
+     ERRORS_DETECTED++;
+     printf("\n(update_image_zynqmp):  *** ERROR - card did not take page %d of %d within %ld s (mailbox h%8x) ***\n",
+            i, num_256B_pages, POLL_ZYNQ_ACK.timeout_us / 1000000, ack_status);
+     close(BIN);
+     return -1;
    }
 
    for(y=0;y<=64;y++){
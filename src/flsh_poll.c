@@ -0,0 +1,208 @@
+#ifndef FLSH_POLL_C_
+#define FLSH_POLL_C_
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/prctl.h>
+
+#include "flsh_common_defs.h"
+#include "flsh_cfg_backend.h"
+#include "flsh_poll.h"
+
+// Defaults, tune with --poll <site>:<key>=<value>,...
+#define POLL_SITE(n, h, tmo, sp, smin, smax) \
+  { .name = n, .help = h, .timeout_us = tmo, .spin = sp, .sleep_min_ns = (smin) * 1000L, .sleep_max_ns = (smax) * 1000L }
+
+//                                                                                                         timeout (us)  spin   sleep (us)
+poll_site POLL_AXI_STROBE = POLL_SITE("axi_strobe", "AXI Write / Read Strobe in CFG_FLASH_ADDR",                1000000, 1000,     1,    64);
+poll_site POLL_DTR_EMPTY  = POLL_SITE("dtr_empty" , "QSPI DTR FIFO drained",                                     100000,   16,     1,    32);
+poll_site POLL_SPI_STREAM = POLL_SITE("spi_stream", "Room in the QSPI FIFOs while streaming",                      100000,   64,     1,    16);
+poll_site POLL_FLASH_WIP  = POLL_SITE("flash_wip" , "FLASH Write In Progress clear (page program, erase)",      10000000,    2,    10,  1000);
+poll_site POLL_ICAP_CR    = POLL_SITE("icap_cr"   , "ICAP CR write command done",                                1000000,  100,     1,   100);
+poll_site POLL_ICAP_EOS   = POLL_SITE("icap_eos"  , "ICAP SR done and EOS",                                      1000000,  100,     1,  1000);
+poll_site POLL_ZYNQ_ACK   = POLL_SITE("zynq_ack"  , "250SOC ZynqMP firmware took the mailbox page",            120000000,   10,    10, 10000);
+
+static poll_site *POLL_SITES[] = { &POLL_AXI_STROBE, &POLL_DTR_EMPTY, &POLL_SPI_STREAM, &POLL_FLASH_WIP, &POLL_ICAP_CR, &POLL_ICAP_EOS, &POLL_ZYNQ_ACK };
+#define POLL_NUM_SITES ((int) (sizeof(POLL_SITES) / sizeof(POLL_SITES[0])))
+
+
+// --------------------------------------------------------------------------------------------------------
+static unsigned long long poll_now(void)
+{ struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void poll_slack(void)   // The default 50 us timer slack would dwarf the short sleeps, so it is cut to 1 us once
+{ static int slack_set = 0;
+  if (!slack_set) {
+    prctl(PR_SET_TIMERSLACK, 1000UL, 0UL, 0UL, 0UL);
+    slack_set = 1;
+  }
+}
+
+static int poll_bucket(unsigned long long v)   // Histogram bucket of a value, see POLL_HIST_BUCKETS
+{ int b = 0;
+  while (v != 0 && b < POLL_HIST_BUCKETS - 1) {
+    v = v >> 1;
+    b++;
+  }
+  return b;
+}
+
+static void poll_record(poll_wait *w)
+{ poll_site *p = w->site;
+  unsigned long long ns = poll_now() - w->start_ns;
+
+  p->waits++;
+  p->polls += w->polls;
+  if ((unsigned long long) w->polls > p->max_polls) p->max_polls = w->polls;
+  p->total_ns += ns;
+  if (ns > p->max_ns) p->max_ns = ns;
+  p->hist_polls[poll_bucket(w->polls)]++;
+  p->hist_us[poll_bucket(ns / 1000)]++;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+void poll_start(poll_wait *w, poll_site *site)
+{ w->site        = site;
+  w->start_ns    = poll_now();
+  w->deadline_ns = (site->timeout_us > 0) ? w->start_ns + site->timeout_us * 1000ULL : 0;
+  w->sleep_ns    = site->sleep_min_ns;
+  w->polls       = 0;
+  w->timed_out   = 0;
+}
+
+int poll_again(poll_wait *w)
+{ poll_site *p = w->site;
+  unsigned long long now;
+  struct timespec ts;
+  long sleep_ns;
+
+  if (w->timed_out) return -1;
+  w->polls++;
+  if (w->polls <= p->spin && w->deadline_ns == 0) return 0;
+
+  now = poll_now();
+  if (w->deadline_ns != 0 && now >= w->deadline_ns) {
+    w->timed_out = 1;
+    p->timeouts++;
+    poll_record(w);
+    return -1;
+  }
+  if (w->polls <= p->spin || w->sleep_ns <= 0) return 0;
+
+  // Sleep, but not past the deadline
+  poll_slack();
+  sleep_ns = w->sleep_ns;
+  if (w->deadline_ns != 0 && now + sleep_ns > w->deadline_ns) sleep_ns = w->deadline_ns - now;
+  ts.tv_sec  = sleep_ns / 1000000000L;
+  ts.tv_nsec = sleep_ns % 1000000000L;
+  clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+  w->sleep_ns = (w->sleep_ns * 2 < p->sleep_max_ns) ? w->sleep_ns * 2 : p->sleep_max_ns;
+  return 0;
+}
+
+void poll_end(poll_wait *w)
+{ if (!w->timed_out) poll_record(w);
+}
+
+long poll_elapsed_us(poll_wait *w)
+{ return (long) ((poll_now() - w->start_ns) / 1000);
+}
+
+void poll_set_timeout(poll_wait *w, long timeout_us)
+{ w->deadline_ns = (timeout_us > 0) ? w->start_ns + timeout_us * 1000ULL : 0;
+}
+
+unsigned long long poll_now_ns(void)
+{ return poll_now();
+}
+
+void poll_sleep_ns(long ns)
+{ struct timespec ts;
+
+  if (ns <= 0) return;
+  poll_slack();
+  ts.tv_sec  = ns / 1000000000L;
+  ts.tv_nsec = ns % 1000000000L;
+  clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+int poll_config(char *arg)   // "<site>:<key>=<value>,..."
+{ char *args;
+  int i, len;
+
+  args = strchr(arg, ':');
+  len  = (args != NULL) ? (int) (args - arg) : (int) strlen(arg);
+  for (i = 0; i < POLL_NUM_SITES; i++)
+    if ((int) strlen(POLL_SITES[i]->name) == len && strncmp(arg, POLL_SITES[i]->name, len) == 0) break;
+  if (i == POLL_NUM_SITES || args == NULL) {
+    printf("Unknown poll site '%s', use --poll <site>:spin=<n>,sleep_min=<us>,sleep_max=<us>,timeout=<ms> with <site> one of:\n", arg);
+    for (i = 0; i < POLL_NUM_SITES; i++)
+      printf("  %-10s %s (spin %d, sleep %ld..%ld us, timeout %ld ms)\n", POLL_SITES[i]->name, POLL_SITES[i]->help, POLL_SITES[i]->spin,
+             POLL_SITES[i]->sleep_min_ns / 1000, POLL_SITES[i]->sleep_max_ns / 1000, POLL_SITES[i]->timeout_us / 1000);
+    return -1;
+  }
+  args++;
+  POLL_SITES[i]->spin         = (int) cfg_backend_arg_num(args, "spin", POLL_SITES[i]->spin);
+  POLL_SITES[i]->sleep_min_ns = cfg_backend_arg_num(args, "sleep_min", POLL_SITES[i]->sleep_min_ns / 1000) * 1000;
+  POLL_SITES[i]->sleep_max_ns = cfg_backend_arg_num(args, "sleep_max", POLL_SITES[i]->sleep_max_ns / 1000) * 1000;
+  POLL_SITES[i]->timeout_us   = cfg_backend_arg_num(args, "timeout", POLL_SITES[i]->timeout_us / 1000) * 1000;
+  if (POLL_SITES[i]->sleep_max_ns < POLL_SITES[i]->sleep_min_ns) POLL_SITES[i]->sleep_max_ns = POLL_SITES[i]->sleep_min_ns;
+  return 0;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+static void poll_hist_print(FILE *f, const char *what, unsigned long long *hist)
+{ int b, last;
+
+  for (last = POLL_HIST_BUCKETS - 1; last > 0 && hist[last] == 0; last--) ;
+  fprintf(f, "    %-8s", what);
+  for (b = 0; b <= last; b++) {
+    if (hist[b] == 0) continue;
+    if (b == 0)                          fprintf(f, "  0:%llu", hist[b]);
+    else if (b == POLL_HIST_BUCKETS - 1) fprintf(f, "  %llu+:%llu", 1ULL << (b - 1), hist[b]);
+    else                                 fprintf(f, "  %llu-%llu:%llu", 1ULL << (b - 1), (1ULL << b) - 1, hist[b]);
+  }
+  fprintf(f, "\n");
+}
+
+void poll_stats(FILE *f)
+{ poll_site *p;
+  int i;
+
+  fprintf(f, "Poll sites (polls after the first check, latency in us):\n");
+  for (i = 0; i < POLL_NUM_SITES; i++) {
+    p = POLL_SITES[i];
+    if (p->waits == 0) continue;
+    fprintf(f, "  %-10s %llu waits, %llu timeouts, %.1f polls and %.1f us per wait, max %llu polls / %llu us\n",
+            p->name, p->waits, p->timeouts, (double) p->polls / p->waits, p->total_ns / 1e3 / p->waits, p->max_polls, p->max_ns / 1000);
+    poll_hist_print(f, "polls", p->hist_polls);
+    poll_hist_print(f, "latency", p->hist_us);
+  }
+}
+
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef FLSH_SFDP_C_
+#define FLSH_SFDP_C_
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "flsh_common_defs.h"
+#include "flsh_sfdp.h"
+
+#define SFDP_ID_BFPT   0xFF00       // Basic Flash Parameter Table
+#define SFDP_ID_4BAIT  0xFF84       // 4-byte Address Instruction Table
+
+
+// --------------------------------------------------------------------------------------------------------
+void sfdp_defaults(flash_caps *c)
+{ static const flash_erase_type micron[3] = {
+    //  size      cmd   cmd_4b   typ_us    max_us
+    { 0x01000, 0x20, 0x21,   50000,   400000 },
+    { 0x08000, 0x52, 0x5C,  100000,  1000000 },
+    { 0x10000, 0xD8, 0xDC,  150000,  1000000 },
+  };
+
+  memset(c, 0, sizeof(*c));
+  c->source              = "defaults";
+  c->page_size           = 256;
+  c->num_erase           = 3;
+  memcpy(c->erase, micron, sizeof(micron));
+  c->pp_typ_us           = 120;
+  c->pp_max_us           = 1800;
+  c->die_typ_us          = 153000000;
+  c->die_max_us          = 460000000;
+  c->die_cmd             = 0xC4;  c->die_size            = 0;   // Size not known without SFDP
+  c->read_cmd            = 0x03;  c->read_cmd_4b         = 0x13;
+  c->fast_read_cmd       = 0x0B;  c->fast_read_cmd_4b    = 0x0C;
+  c->quad_read_cmd       = 0x6B;  c->quad_read_cmd_4b    = 0x6C;  c->quad_read_dummy = 8;
+  c->program_cmd         = 0x02;  c->program_cmd_4b      = 0x12;
+  c->quad_program_cmd    = 0x32;  c->quad_program_cmd_4b = 0x34;
+  return;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+static u32 sfdp_dword(byte *sfdp, int len, u32 ptr, int ndw, int n)   // DWORD n (1 based) of a table, 0 if not in it
+{ u32 at = ptr + 4 * (n - 1);
+  if (n > ndw || at + 4 > (u32) len) return 0;
+  return sfdp[at] | (sfdp[at+1] << 8) | (sfdp[at+2] << 16) | ((u32) sfdp[at+3] << 24);
+}
+
+static long sfdp_erase_typ_us(u32 count, u32 units)   // BFPT DWORD 10 typical erase time
+{ static const long unit_us[4] = { 1000, 16000, 128000, 1000000 };
+  return (long) (count + 1) * unit_us[units & 3];
+}
+
+int sfdp_parse(flash_caps *c, byte *sfdp, int len)
+{ flash_caps p;
+  u32  bfpt = 0, b4ait = 0, ptr, dw, dw10, dw11, mult;
+  int  bfpt_ndw = 0, b4ait_ndw = 0, nph, i, j, id, ndw;
+  flash_erase_type e;
+  static const long pp_unit_us[2]  = { 8, 64 };
+  static const long die_unit_us[4] = { 16000, 256000, 4000000, 64000000 };
+
+  if (len < 16 || memcmp(sfdp, "SFDP", 4) != 0) return -1;
+  memset(&p, 0, sizeof(p));
+
+  // Parameter headers follow the SFDP header, the first one is the BFPT
+  nph = sfdp[6] + 1;
+  for (i = 0; i < nph && 8 + 8 * i + 8 <= len; i++) {
+    byte *h = &sfdp[8 + 8 * i];
+    id  = h[0] | (h[7] << 8);
+    ndw = h[3];
+    ptr = h[4] | (h[5] << 8) | (h[6] << 16);
+    if (id == SFDP_ID_BFPT && bfpt_ndw == 0) {
+      bfpt = ptr;  bfpt_ndw = ndw;  p.sfdp_rev = (h[2] << 8) | h[1];
+    }
+    if (id == SFDP_ID_4BAIT && b4ait_ndw == 0) {
+      b4ait = ptr;  b4ait_ndw = ndw;
+    }
+  }
+  if (bfpt_ndw < 9 || bfpt + 9 * 4 > (u32) len) return -1;
+
+  p.id[0] = c->id[0];  p.id[1] = c->id[1];  p.id[2] = c->id[2];
+  p.source = "SFDP";
+
+  // DWORD 2: density in bits
+  dw = sfdp_dword(sfdp, len, bfpt, bfpt_ndw, 2);
+  p.size = (dw & 0x80000000) ? (((dw & 0x7FFFFFFF) >= 35) ? 0x80000000 : (u32) (1ULL << ((dw & 0x7FFFFFFF) - 3)))
+                             : (u32) (((unsigned long long) dw + 1) / 8);
+
+  // Erase types in DWORDs 8 and 9 (size 2^N bytes, opcode), typical times in DWORD 10
+  dw10 = sfdp_dword(sfdp, len, bfpt, bfpt_ndw, 10);
+  mult = 2 * ((dw10 & 0xF) + 1);
+  for (i = 0; i < SFDP_MAX_ERASE; i++) {
+    dw = sfdp_dword(sfdp, len, bfpt, bfpt_ndw, 8 + i / 2) >> (16 * (i % 2));
+    if ((dw & 0xFF) == 0 || (dw & 0xFF) > 31) continue;
+    e.size   = 1u << (dw & 0xFF);
+    e.cmd    = (byte) (dw >> 8);
+    e.cmd_4b = 0;
+    e.typ_us = (dw10 != 0) ? sfdp_erase_typ_us((dw10 >> (4 + 7 * i)) & 0x1F, (dw10 >> (9 + 7 * i)) & 0x3) : 0;
+    e.max_us = e.typ_us * mult;
+    if (b4ait_ndw >= 2 && (sfdp_dword(sfdp, len, b4ait, b4ait_ndw, 1) & (1u << (9 + i))))
+      e.cmd_4b = (byte) (sfdp_dword(sfdp, len, b4ait, b4ait_ndw, 2) >> (8 * i));
+    for (j = p.num_erase; j > 0 && p.erase[j-1].size > e.size; j--)   // Keep them smallest first
+      p.erase[j] = p.erase[j-1];
+    p.erase[j] = e;
+    p.num_erase++;
+  }
+
+  // DWORD 11: page size, page program and chip erase times
+  dw11 = sfdp_dword(sfdp, len, bfpt, bfpt_ndw, 11);
+  p.page_size = (dw11 != 0) ? 1 << ((dw11 >> 4) & 0xF) : 256;
+  if (dw11 != 0) {
+    mult = 2 * ((dw11 & 0xF) + 1);
+    p.pp_typ_us  = (((dw11 >> 8) & 0x1F) + 1) * pp_unit_us[(dw11 >> 13) & 1];
+    p.pp_max_us  = p.pp_typ_us * mult;
+    p.die_typ_us = (((dw11 >> 24) & 0x1F) + 1) * die_unit_us[(dw11 >> 29) & 3];
+    p.die_max_us = p.die_typ_us * mult;
+  }
+  p.die_cmd  = 0xC7;                // JEDEC CHIP ERASE, the whole part
+  p.die_size = p.size;
+
+  // Reads and programs every part has, 1-1-4 fast read if DWORD 1 says so (dummy and mode clocks in DWORD 3)
+  p.read_cmd      = 0x03;
+  p.fast_read_cmd = 0x0B;
+  p.program_cmd   = 0x02;
+  dw = sfdp_dword(sfdp, len, bfpt, bfpt_ndw, 1);
+  if (dw & (1u << 21)) {
+    dw = sfdp_dword(sfdp, len, bfpt, bfpt_ndw, 3);
+    p.quad_read_cmd   = (byte) (dw >> 24);
+    p.quad_read_dummy = ((dw >> 16) & 0x1F) + ((dw >> 21) & 0x7);
+  }
+
+  // 4-byte address opcodes from the 4BAIT. The BFPT has no 1-1-4 program, a part with the 4-byte one (0x34) is taken
+  // to have the 3-byte 0x32 as well.
+  if (b4ait_ndw >= 1) {
+    dw = sfdp_dword(sfdp, len, b4ait, b4ait_ndw, 1);
+    if (dw & (1u << 0)) p.read_cmd_4b      = 0x13;
+    if (dw & (1u << 1)) p.fast_read_cmd_4b = 0x0C;
+    if ((dw & (1u << 4)) && p.quad_read_cmd != 0) p.quad_read_cmd_4b = 0x6C;
+    if (dw & (1u << 6)) p.program_cmd_4b   = 0x12;
+    if (dw & (1u << 7)) { p.quad_program_cmd = 0x32;  p.quad_program_cmd_4b = 0x34; }
+  }
+
+  *c = p;
+  return 0;
+}
+
+flash_erase_type *sfdp_erase_type(flash_caps *c, u32 size)
+{ int i;
+  for (i = 0; i < c->num_erase; i++)
+    if (c->erase[i].size == size) return &c->erase[i];
+  return NULL;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+static void sfdp_print_cmd(FILE *f, const char *what, byte cmd, byte cmd_4b)
+{ if (cmd == 0) return;
+  if (cmd_4b != 0) fprintf(f, ", %s %2.2X/%2.2X", what, cmd, cmd_4b);
+  else             fprintf(f, ", %s %2.2X", what, cmd);
+}
+
+void sfdp_print(FILE *f, flash_caps *c)
+{ int i;
+
+  fprintf(f, "FLASH ID %2.2X %2.2X %2.2X, %s", c->id[0], c->id[1], c->id[2], c->source);
+  if (c->sfdp_rev != 0) fprintf(f, " %d.%d", c->sfdp_rev >> 8, c->sfdp_rev & 0xFF);
+  if (c->size != 0)     fprintf(f, ": %u MiB", c->size >> 20);
+  fprintf(f, ", %d B pages", c->page_size);
+  if (c->pp_typ_us != 0) fprintf(f, " (typ %ld us)", c->pp_typ_us);
+  fprintf(f, "\n  erase");
+  for (i = 0; i < c->num_erase; i++) {
+    fprintf(f, " %uK %2.2X", c->erase[i].size >> 10, c->erase[i].cmd);
+    if (c->erase[i].cmd_4b != 0) fprintf(f, "/%2.2X", c->erase[i].cmd_4b);
+    if (c->erase[i].typ_us != 0) fprintf(f, " (typ %ld ms)", c->erase[i].typ_us / 1000);
+  }
+  if (c->die_size != 0) {
+    fprintf(f, ", %s %uM %2.2X", (c->die_cmd == 0xC4) ? "die" : "chip", c->die_size >> 20, c->die_cmd);
+    if (c->die_typ_us >= 10000000) fprintf(f, " (typ %ld s)", c->die_typ_us / 1000000);
+    else if (c->die_typ_us != 0)   fprintf(f, " (typ %ld ms)", c->die_typ_us / 1000);
+  }
+  fprintf(f, "\n  opcodes (3B/4B address)");
+  sfdp_print_cmd(f, "read", c->read_cmd, c->read_cmd_4b);
+  sfdp_print_cmd(f, "fast read", c->fast_read_cmd, c->fast_read_cmd_4b);
+  sfdp_print_cmd(f, "quad read", c->quad_read_cmd, c->quad_read_cmd_4b);
+  if (c->quad_read_cmd != 0) fprintf(f, " (%d dummy)", c->quad_read_dummy);
+  sfdp_print_cmd(f, "program", c->program_cmd, c->program_cmd_4b);
+  sfdp_print_cmd(f, "quad program", c->quad_program_cmd, c->quad_program_cmd_4b);
+  fprintf(f, "\n");
+  return;
+}
+
+
+#endif
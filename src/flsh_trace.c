@@ -0,0 +1,272 @@
+#ifndef FLSH_TRACE_C_
+#define FLSH_TRACE_C_
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "flsh_common_defs.h"
+#include "flsh_global_vars.h"
+#include "flsh_cfg_backend.h"
+#include "flsh_poll.h"
+#include "flsh_sfdp.h"
+#include "flsh_common_funcs.h"
+#include "flsh_trace.h"
+
+static trace_event *TRACE_RING = NULL;
+static unsigned     TRACE_MASK = 0;       // Ring size - 1 (ring size is a power of 2)
+static unsigned long long TRACE_NEXT = 0; // Total events recorded, next slot is TRACE_NEXT & TRACE_MASK
+static unsigned long long TRACE_T0   = 0;
+static char        *TRACE_FILE = NULL;
+
+// Layout of an event in a saved file: comment replaced by an index into the string table that follows the header
+typedef struct {
+  unsigned long long ts;
+  u32  type, devsel, addr, data, aux;
+  u32  s_idx;
+} trace_file_event;
+
+#define TRACE_FILE_MAGIC "OCTRACE1"
+
+
+// --------------------------------------------------------------------------------------------------------
+static unsigned long long trace_now(void)
+{ struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+void trace_init(int num_events)   // Allocate a ring of num_events (0 = ring off, TRC_* printing still works)
+{ unsigned size = 1;
+
+  free(TRACE_RING);
+  TRACE_RING = NULL;
+  TRACE_NEXT = 0;
+  TRACE_T0   = trace_now();
+  if (num_events <= 0) return;
+
+  while (size < (unsigned) num_events) size = size << 1;
+  if ((TRACE_RING = calloc(size, sizeof(trace_event))) == NULL) {
+    printf("WARNING: no memory for %u trace events, trace ring is off\n", size);
+    return;
+  }
+  TRACE_MASK = size - 1;
+  return;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+static void trace_format(FILE *f, const trace_event *e, int with_ts)   // Print one event as the TRC_* trace text
+{ u32 exp_enab = e->aux & FA_EXP_ON;
+  u32 exp_dir  = e->aux & FA_EXP_3210;
+
+  if (with_ts) fprintf(f, "[%12.6f] ", e->ts / 1e9);
+  switch (e->type)
+    { case TRC_EV_CONFIG_WR:
+        fprintf(f, "trace      config_write  addr h%8x, wdata h%8x, num_bytes %1d, <%s>\n", e->addr, e->data, e->aux, e->s);
+        break;
+      case TRC_EV_CONFIG_RD:
+        fprintf(f, "trace      config_read   addr h%8x, rdata h%8x,              <%s>\n", e->addr, e->data, e->s);
+        break;
+      case TRC_EV_CONFIG_RD2:
+        fprintf(f, "trace      config_read   addr h%8x, rdata h%8x h%8x,  <%s>\n", e->addr, e->data, e->aux, e->s);
+        break;
+      case TRC_EV_AXI_WR:
+        fprintf(f, "trace    axi_write     devsel %s, addr %s (h%8.8X), wdata h%8.8x, exp_enab %s, exp_dir %s, <%s>\n",
+                axi_devsel_as_str(e->devsel), axi_addr_as_str(e->devsel, e->addr), e->addr, e->data, exp_enab_as_str(exp_enab), exp_dir_as_str(exp_dir), e->s);
+        break;
+      case TRC_EV_AXI_RD:
+        fprintf(f, "trace    axi_read      devsel %s, addr %s (h%8.8X),                  exp_enab %s, exp_dir %s, <%s>\n",
+                axi_devsel_as_str(e->devsel), axi_addr_as_str(e->devsel, e->addr), e->addr, exp_enab_as_str(exp_enab), exp_dir_as_str(exp_dir), e->s);
+        break;
+      case TRC_EV_AXI_RD_DONE:
+        fprintf(f, "trace    axi_read completion   (rdata h%8x)\n", e->data);
+        break;
+      case TRC_EV_FLASH_OP:
+        fprintf(f, "trace  flash_op        devsel %s, cmd h%2X, addr h%8X, num_addr %2d, num_dummy %2d, num_bytes %d, dir %s <%s>\n",
+                flash_devsel_as_str(e->devsel), e->data & 0xFF, e->addr, (e->data >> 8) & 0xFF, (e->data >> 16) & 0xFF,
+                e->aux, fo_dir_as_str((e->data >> 24) & 0xFF), e->s);
+        break;
+      default:
+        fprintf(f, "trace  <unknown event type %d>\n", e->type);
+    }
+  return;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+void trace_record(u32 type, u32 devsel, u32 addr, u32 data, u32 aux, const char *s)   // Record an event
+{ trace_event *e, live;
+  int print;
+
+  // Layers traced on the console print the event at once
+  switch (type)
+    { case TRC_EV_CONFIG_WR: case TRC_EV_CONFIG_RD: case TRC_EV_CONFIG_RD2:
+        print = (TRC_CONFIG == TRC_ON); break;
+      case TRC_EV_AXI_WR: case TRC_EV_AXI_RD: case TRC_EV_AXI_RD_DONE:
+        print = (TRC_AXI    == TRC_ON); break;
+      case TRC_EV_FLASH_OP:
+        print = (TRC_FLASH  == TRC_ON); break;
+      default:
+        print = 0;
+    }
+  if (TRACE_RING == NULL && !print) return;
+
+  e = (TRACE_RING != NULL) ? &TRACE_RING[TRACE_NEXT++ & TRACE_MASK] : &live;
+  e->ts     = trace_now() - TRACE_T0;
+  e->type   = type;
+  e->devsel = devsel;
+  e->addr   = addr;
+  e->data   = data;
+  e->aux    = aux;
+  e->s      = (s != NULL) ? s : "";
+
+  if (print) trace_format(stdout, e, 0);
+  return;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+void trace_dump(FILE *f, int last_n)   // Print the last 'last_n' events
+{ unsigned long long first, i;
+
+  if (TRACE_RING == NULL) return;
+  first = (TRACE_NEXT > (unsigned long long) last_n) ? TRACE_NEXT - last_n : 0;
+  if (TRACE_NEXT - first > TRACE_MASK + 1ULL) first = TRACE_NEXT - (TRACE_MASK + 1ULL);
+  fprintf(f, "----- Last %llu of %llu trace events -----\n", TRACE_NEXT - first, TRACE_NEXT);
+  for (i = first; i < TRACE_NEXT; i++)
+    trace_format(f, &TRACE_RING[i & TRACE_MASK], 1);
+  fprintf(f, "----- (End of trace events) -----\n");
+  return;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+void trace_set_file(char *path)   // Save ring to 'path' with trace_save()
+{ TRACE_FILE = path;
+}
+
+int trace_save(void)   // Save ring to the file set with trace_set_file(), if any
+{ unsigned long long first, i;
+  const char **strs;
+  u32  num_strs = 0, num_events, j, len;
+  trace_file_event fe;
+  trace_event *e;
+  FILE *f;
+
+  if (TRACE_FILE == NULL || TRACE_RING == NULL) return 0;
+  first      = (TRACE_NEXT > TRACE_MASK + 1ULL) ? TRACE_NEXT - (TRACE_MASK + 1ULL) : 0;
+  num_events = (u32) (TRACE_NEXT - first);
+
+  // String table: comments of the saved events, each distinct pointer once
+  if ((strs = malloc(sizeof(char *) * (num_events + 1))) == NULL) {
+    printf("*** ERROR in trace_save(): Can not allocate the string table of %u events, %s not saved\n", num_events, TRACE_FILE);
+    return -1;
+  }
+  if ((f = fopen(TRACE_FILE, "wb")) == NULL) {
+    printf("*** ERROR in trace_save(): Can not open %s\n", TRACE_FILE);
+    free(strs);
+    return -1;
+  }
+  for (i = first; i < TRACE_NEXT; i++) {
+    e = &TRACE_RING[i & TRACE_MASK];
+    for (j = 0; j < num_strs && strs[j] != e->s; j++) ;
+    if (j == num_strs) strs[num_strs++] = e->s;
+  }
+
+  fwrite(TRACE_FILE_MAGIC, 1, 8, f);
+  fwrite(&num_strs,   sizeof(u32), 1, f);
+  fwrite(&num_events, sizeof(u32), 1, f);
+  for (j = 0; j < num_strs; j++) {
+    len = strlen(strs[j]);
+    fwrite(&len, sizeof(u32), 1, f);
+    fwrite(strs[j], 1, len, f);
+  }
+  for (i = first; i < TRACE_NEXT; i++) {
+    e = &TRACE_RING[i & TRACE_MASK];
+    for (j = 0; strs[j] != e->s; j++) ;
+    memset(&fe, 0, sizeof(fe));
+    fe.ts = e->ts;  fe.type = e->type;  fe.devsel = e->devsel;  fe.addr = e->addr;  fe.data = e->data;  fe.aux = e->aux;
+    fe.s_idx = j;
+    fwrite(&fe, sizeof(fe), 1, f);
+  }
+  free(strs);
+  fclose(f);
+  return 0;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+int trace_decode(char *path)   // Print a saved ring
+{ char  magic[8];
+  char **strs;
+  u32   num_strs, num_events, i, len;
+  trace_file_event fe;
+  trace_event e;
+  FILE *f;
+  long  size = -1;
+  int   rc = 0;
+
+  if ((f = fopen(path, "rb")) == NULL) {
+    printf("*** ERROR in trace_decode(): Can not open %s\n", path);
+    return -1;
+  }
+  if (fread(magic, 1, 8, f) != 8 || memcmp(magic, TRACE_FILE_MAGIC, 8) != 0 ||
+      fread(&num_strs, sizeof(u32), 1, f) != 1 || fread(&num_events, sizeof(u32), 1, f) != 1) {
+    printf("*** ERROR in trace_decode(): %s is not a trace file\n", path);
+    fclose(f);
+    return -1;
+  }
+  // Each string takes at least its length word and each event its record: larger counts can't come from this file
+  if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 16 || fseek(f, 16, SEEK_SET) != 0 ||
+      num_strs > (unsigned long) (size - 16) / sizeof(u32) || num_events > (unsigned long) (size - 16) / sizeof(fe)) {
+    printf("*** ERROR in trace_decode(): %s is not a trace file (%u strings and %u events in %ld bytes)\n", path, num_strs, num_events, size);
+    fclose(f);
+    return -1;
+  }
+  if ((strs = calloc(num_strs + 1, sizeof(char *))) == NULL) {
+    printf("*** ERROR in trace_decode(): Can not allocate the string table of %u strings\n", num_strs);
+    fclose(f);
+    return -1;
+  }
+  for (i = 0; i < num_strs; i++) {
+    if (fread(&len, sizeof(u32), 1, f) != 1 || len > 65536 || (strs[i] = calloc(len + 1, 1)) == NULL ||
+        fread(strs[i], 1, len, f) != len) {
+      rc = -1;
+      break;
+    }
+  }
+  for (i = 0; rc == 0 && i < num_events; i++) {
+    if (fread(&fe, sizeof(fe), 1, f) != 1) { rc = -1; break; }
+    e.ts = fe.ts;  e.type = fe.type;  e.devsel = fe.devsel;  e.addr = fe.addr;  e.data = fe.data;  e.aux = fe.aux;
+    e.s  = (fe.s_idx < num_strs) ? strs[fe.s_idx] : "?";
+    trace_format(stdout, &e, 1);
+  }
+  if (rc != 0) printf("*** ERROR in trace_decode(): %s is truncated\n", path);
+  for (i = 0; i < num_strs; i++) free(strs[i]);
+  free(strs);
+  fclose(f);
+  return rc;
+}
+
+
+#endif
@@ -29,6 +29,10 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include "flsh_common_defs.h"
+#include "flsh_cfg_backend.h"
+#include "flsh_trace.h"
+#include "flsh_poll.h"
+#include "flsh_sfdp.h"
 #include "flsh_common_funcs.h"
 #include "flsh_global_vars.h"
 
@@ -36,6 +40,7 @@
 int main(int argc, char *argv[])
 {
   static int verbose_flag = 0;
+  static int poll_stats_flag = 0;
   static int dualspi_mode_flag = 1; //default to assume x8 spi programming/loading
   static struct option long_options[] =
   {
@@ -44,25 +49,34 @@ int main(int argc, char *argv[])
     {"brief",   no_argument,       &verbose_flag, 0},
     {"singlespi",    no_argument,  &dualspi_mode_flag, 0},
     {"dualspi",      no_argument,  &dualspi_mode_flag, 1},
+    {"devstat_wait", no_argument,  &DEVSTAT_WAIT, DSW_ON},    // Wait on DTR Empty / ICAP EOS through CFG_FLASH_ADDR status
+    {"regpoll",      no_argument,  &DEVSTAT_WAIT, DSW_OFF},   // Wait on DTR Empty / ICAP EOS with AXI reads of IPISR / SR (default)
+    {"noshadow",     no_argument,  &AXI_SHADOW_REGS, SHD_OFF}, // Write QSPI / ICAP control registers even when the value is unchanged
     //{"image_file1",  required_argument, 0, 'a'},
     //{"image_file2",  required_argument, 0, 'b'},
     {"devicebdf",    required_argument, 0, 'c'},
     {"startaddr",    required_argument, 0, 'd'},
+    {"backend",      required_argument, 0, 'e'},
+    {"trace_file",   required_argument, 0, 'f'},
+    {"trace_events", required_argument, 0, 'g'},
+    {"trace_decode", required_argument, 0, 'h'},
+    {"poll",         required_argument, 0, 'i'},   // <site>:spin=<n>,sleep_min=<us>,sleep_max=<us>,timeout=<ms>
+    {"poll_stats",   no_argument,  &poll_stats_flag, 1},   // Print poll counts and histograms at the end
           {0, 0, 0, 0}
   };
 
   char binfile[1024];
   char binfile2[1024];
   char cfgbdf[1024];
-  char cfg_file[1024];
-  int CFG;
   int start_addr=0;
   char temp_addr[256];
+  int trace_events = TRACE_EVENTS_DEFAULT;
+  char *trace_decode_file = NULL;
 
   while(1) {
       int option_index = 0;
       int c;
-      c = getopt_long (argc, argv, "c:d:",
+      c = getopt_long (argc, argv, "c:d:e:f:g:h:i:",
                        long_options, &option_index);
 
       /* Detect the end of the options. */
@@ -104,6 +118,32 @@ int main(int argc, char *argv[])
 	  start_addr = (int)strtol(temp_addr,NULL,16);
           if(verbose_flag)
 	    printf(" Start Address (same address for SPIx8 on both parts): %d\n", start_addr);
+          break;
+
+        case 'e':
+          if (cfg_backend_select(optarg) != 0)
+            exit(-1);
+          if(verbose_flag)
+            printf(" Config space backend: %s\n", optarg);
+          break;
+
+        case 'f':
+          trace_set_file(optarg);
+          break;
+
+        case 'g':
+          trace_events = atoi(optarg);
+          break;
+
+        case 'h':
+          trace_decode_file = optarg;
+          break;
+
+        case 'i':
+          if (poll_config(optarg) != 0)
+            exit(-1);
+          break;
+
         case '?':
           /* getopt_long already printed an error message. */
           break;
@@ -113,24 +153,19 @@ int main(int argc, char *argv[])
         }
     }
 
+  // A saved trace ring is decoded without touching a card
+  if (trace_decode_file != NULL)
+    exit(trace_decode(trace_decode_file) == 0 ? 0 : -1);
+  trace_init(trace_events);
+
   if(verbose_flag)
     printf("Registers value: TRC_CONFIG = %d, TRC_AXI = %d, TRC_FLASH = %d, TRC_FLASH_CMD = %d\n", TRC_CONFIG, TRC_AXI, TRC_FLASH, TRC_FLASH_CMD);
 
   u32 temp;
   int vendor,device, subsys;
   int BIN,i, j;
-  strcpy(cfg_file,"/sys/bus/pci/devices/");
-  strcat(cfg_file,cfgbdf);
-  strcat(cfg_file,"/config");
-
-  if ((CFG = open(cfg_file, O_RDWR)) < 0) {
-    printf("Can not open %s\n",cfg_file);
-    exit(-1);
-  }
-
-  //TODO/FIXME: passing this on to global cfg descriptor
-  if ((CFG_FD = open(cfg_file, O_RDWR)) < 0) {
-    printf("Can not open %s\n",cfg_file);
+  if (cfg_backend_open(cfgbdf) != 0) {
+    printf("Can not open config space of %s through backend %s\n", cfgbdf, CFG_BACKEND->name);
     exit(-1);
   }
 
@@ -152,22 +187,21 @@ int main(int argc, char *argv[])
   u32 wdata, wdatatmp, rdata, burst_size;
   u32 CR_Write_clear = 0, CR_Write_cmd = 1, SR_ICAPEn_EOS=5;
   u32 SZ_Read_One_Word = 1, CR_Read_cmd = 2, RFO_wait_rd_done=1;
-  time_t start_time, current_time;
-  int timeout=0;
+  poll_wait w;
 
-  time(&start_time);
-  rdata = 0;
   if(verbose_flag) 
      printf("Waiting for ICAP EOS set \e[1A\n");
 
-  while ((rdata != SR_ICAPEn_EOS) && (timeout < 1)) {
+  poll_start(&w, &POLL_ICAP_EOS);
+  do {
     rdata = axi_read(FA_ICAP, FA_ICAP_SR  , FA_EXP_OFF, FA_EXP_0123, "ICAP: read SR (monitor ICAPEn)");
-    time(&current_time);
-    timeout = (int)difftime(current_time, start_time);
-  }
+  } while (rdata != SR_ICAPEn_EOS && poll_again(&w) == 0);
+  poll_end(&w);
   // timeout can occur for old images, then use the old reload from oc-utils-common.sh
-  if(timeout >= 1) {
+  if(w.timed_out) {
      //printf("Timeout! EOS cannot be set \n");
+     if (poll_stats_flag) poll_stats(stdout);
+     cfg_backend_close();
      return 0;
   }
      
@@ -184,27 +218,24 @@ int main(int argc, char *argv[])
   printf("\n----------------------------------\n");
   printf(" Reloading code from Flash for the card in slot %s\n", cfgbdf);
 
-  rdata = 0;
-  while ((u32)rdata != (u32)SR_ICAPEn_EOS)  {
-     rdata = axi_read(FA_ICAP, FA_ICAP_SR  , FA_EXP_OFF, FA_EXP_0123, "ICAP: read SR (monitor ICAPEn)");
-     //printf("Waiting for ICAP SR = h%4x (read:%8x) \e[1A\n", SR_ICAPEn_EOS, rdata);
-  }
+  wait_ICAP_EOS("ICAP: read SR (monitor ICAPEn)");
   wdata = 0xFFFFFFFF;
-  axi_write(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
+  axi_write_post(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
   wdata = 0xAA995566;
-  axi_write(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
+  axi_write_post(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
   wdata = 0x20000000;
-  axi_write(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
+  axi_write_post(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
   wdata = 0x30020001;
-  axi_write(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
+  axi_write_post(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
   wdata = 0x00000000;
-  axi_write(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
+  axi_write_post(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
   wdata = 0x20000000;
-  axi_write(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
+  axi_write_post(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
   wdata = 0x30008001;
-  axi_write(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
+  axi_write_post(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
   wdata = 0x0000000F;
-  axi_write(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
+  axi_write_post(FA_ICAP, FA_ICAP_WF, FA_EXP_OFF, FA_EXP_0123, wdata, "ICAP: write WF (4B to Keyhole Reg)");
+  axi_fence("ICAP: fence WF (IPROG sequence complete, before flushing the write FIFO)");
   // flush
   //printf("FLUSH START \n");
   //we need to use a specific axi_write since once the write done, we cannot read anymore in ICAP registers
@@ -215,6 +246,9 @@ int main(int argc, char *argv[])
 //==============================================
 
   
+  trace_save();
+  if (poll_stats_flag) poll_stats(stdout);
+  cfg_backend_close();
   return 0;  // Incisive simulator doesn't like anything other than 0 as return value from main() 
 }
 